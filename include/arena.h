@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Bump allocator over a caller-owned block.
+//
+// Allocating moves a pointer; nothing is freed on its own, and reset()
+// releases everything at once. The most recent allocation can grow in
+// place, which lets a string builder on top of it append without copying
+// as long as nothing else was allocated in between.
+class Arena
+{
+public:
+    Arena(uint8_t *block, size_t capacity) : block_(block), capacity_(capacity) {}
+
+    // nullptr (and a counted failure) when the block is full
+    void *allocate(size_t size, size_t align = alignof(max_align_t))
+    {
+        size_t start = (used_ + align - 1) & ~(align - 1);
+        if (start > capacity_ || size > capacity_ - start)
+        {
+            failures_++;
+            return nullptr;
+        }
+        last_ = start;
+        used_ = start + size;
+        if (used_ > highWater_)
+            highWater_ = used_;
+        return block_ + start;
+    }
+
+    // Resize the latest allocation in place. False if block is not the
+    // latest allocation or the arena cannot hold the new size.
+    bool extend(void *block, size_t size)
+    {
+        if (!block || (uint8_t *)block != block_ + last_ || size > capacity_ - last_)
+            return false;
+        used_ = last_ + size;
+        if (used_ > highWater_)
+            highWater_ = used_;
+        return true;
+    }
+
+    void reset()
+    {
+        used_ = 0;
+        last_ = SIZE_MAX;
+    }
+
+    size_t used() const { return used_; }
+    size_t capacity() const { return capacity_; }
+    size_t highWater() const { return highWater_; }
+    uint32_t failures() const { return failures_; }
+
+private:
+    uint8_t *block_;
+    size_t capacity_;
+    size_t used_ = 0;
+    size_t last_ = SIZE_MAX; // Offset of the latest allocation
+    size_t highWater_ = 0;
+    uint32_t failures_ = 0;
+};
+
+// Append-only, NUL-terminated text in an arena. Capacity doubles as it
+// grows, in place while the string is the arena's latest allocation.
+// Appends the arena cannot hold are dropped and flagged; check ok() once
+// the text is complete instead of after every call.
+class ArenaString
+{
+public:
+    explicit ArenaString(Arena &arena, size_t reserve = 64) : arena_(arena) { grow(reserve); }
+
+    ArenaString &operator+=(const char *text)
+    {
+        append(text, strlen(text));
+        return *this;
+    }
+
+    ArenaString &operator+=(char c)
+    {
+        append(&c, 1);
+        return *this;
+    }
+
+    void append(const char *text, size_t length)
+    {
+        if (!grow(length_ + length + 1))
+            return;
+        memcpy(data_ + length_, text, length);
+        length_ += length;
+        data_[length_] = '\0';
+    }
+
+    void appendf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        va_list retry;
+        va_copy(retry, args);
+        size_t room = capacity_ > length_ ? capacity_ - length_ : 0;
+        int length = vsnprintf(data_ ? data_ + length_ : nullptr, room, format, args);
+        va_end(args);
+        if (length >= 0 && (size_t)length >= room)
+        {
+            if (grow(length_ + length + 1))
+                vsnprintf(data_ + length_, capacity_ - length_, format, retry);
+            else
+                length = -1;
+        }
+        va_end(retry);
+        if (length > 0)
+            length_ += length;
+        if (data_)
+            data_[length_] = '\0';
+    }
+
+    const char *c_str() const { return data_ ? data_ : ""; }
+    size_t length() const { return length_; }
+    bool ok() const { return !overflow_; }
+
+private:
+    bool grow(size_t needed)
+    {
+        if (overflow_)
+            return false;
+        if (needed <= capacity_)
+            return true;
+
+        size_t wanted = capacity_ * 2 > needed ? capacity_ * 2 : needed;
+        if (arena_.extend(data_, wanted) || (wanted > needed && arena_.extend(data_, wanted = needed)))
+        {
+            capacity_ = wanted;
+            return true;
+        }
+        wanted = capacity_ * 2 > needed ? capacity_ * 2 : needed;
+        char *moved = (char *)arena_.allocate(wanted, 1);
+        if (!moved && wanted > needed)
+            moved = (char *)arena_.allocate(wanted = needed, 1);
+        if (!moved)
+        {
+            overflow_ = true;
+            return false;
+        }
+        if (data_)
+            memcpy(moved, data_, length_ + 1);
+        else
+            moved[0] = '\0';
+        data_ = moved;
+        capacity_ = wanted;
+        return true;
+    }
+
+    Arena &arena_;
+    char *data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t length_ = 0;
+    bool overflow_ = false;
+};
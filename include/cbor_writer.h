@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Minimal CBOR (RFC 8949) encoder into a caller-owned buffer.
+//
+// Covers what the telemetry payloads need: integers, text strings, null and
+// definite-length arrays and maps. Integers always use the shortest form.
+// Writes past the end of the buffer are dropped and flagged; check ok()
+// once the item is complete instead of after every call.
+class CborWriter
+{
+public:
+    CborWriter(uint8_t *buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {}
+
+    void uint(uint64_t value) { head(0, value); }
+
+    void integer(int64_t value)
+    {
+        if (value >= 0)
+            head(0, value);
+        else
+            head(1, (uint64_t)(-1 - value));
+    }
+
+    void text(const char *value)
+    {
+        size_t length = strlen(value);
+        head(3, length);
+        put((const uint8_t *)value, length);
+    }
+
+    void array(size_t items) { head(4, items); }
+    void map(size_t pairs) { head(5, pairs); }
+
+    void null()
+    {
+        static const uint8_t value = 0xF6;
+        put(&value, 1);
+    }
+
+    size_t length() const { return length_; }
+    size_t remaining() const { return capacity_ - length_; }
+    bool ok() const { return !overflow_; }
+
+private:
+    void head(uint8_t major, uint64_t value)
+    {
+        uint8_t bytes[9];
+        size_t count;
+        major <<= 5;
+        if (value < 24)
+        {
+            bytes[0] = major | value;
+            count = 1;
+        }
+        else
+        {
+            int size = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+            bytes[0] = major | (size == 1 ? 24 : size == 2 ? 25 : size == 4 ? 26 : 27);
+            for (int i = 0; i < size; i++)
+                bytes[1 + i] = value >> (8 * (size - 1 - i));
+            count = 1 + size;
+        }
+        put(bytes, count);
+    }
+
+    void put(const uint8_t *data, size_t count)
+    {
+        if (count > capacity_ - length_)
+        {
+            overflow_ = true;
+            return;
+        }
+        memcpy(buffer_ + length_, data, count);
+        length_ += count;
+    }
+
+    uint8_t *buffer_;
+    size_t capacity_;
+    size_t length_ = 0;
+    bool overflow_ = false;
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Geofences: named polygons with attributes, and which of them a position
+// lies in.
+//
+// Coordinates are micro-degrees, as in the log store. Zones are added one
+// at a time (beginZone, addVertex..., endZone) and index() then spreads
+// their bounding boxes over a uniform grid laid across all of them. A
+// position looks up its cell and runs the point-in-polygon test only for
+// the zones listed there, after a bounding box check, so the cost of a fix
+// follows the zones nearby rather than the number loaded.
+//
+// update() keeps the set of zones the last position was in and reports
+// every zone entered or left since, in zone order. Everything lives in
+// fixed arrays sized below; zones that do not fit are refused.
+#define GEOFENCE_MAX_ZONES 256
+#define GEOFENCE_MAX_VERTICES 3072   // Over all zones, 8 bytes each
+#define GEOFENCE_GRID_SIZE 32        // Cells per side at most
+#define GEOFENCE_MAX_CELL_ENTRIES 4096 // Zone references over all cells
+#define GEOFENCE_NAME_SIZE 20
+
+enum GeofenceFlags : uint8_t
+{
+    GEOFENCE_LOG = 1,   // Sensor events are logged inside the zone
+    GEOFENCE_ALERT = 2, // Entering and leaving are signalled
+};
+
+struct GeofenceZone
+{
+    char name[GEOFENCE_NAME_SIZE];
+    uint8_t flags;
+    uint16_t firstVertex;
+    uint16_t vertexCount;
+    int32_t minLat, minLng, maxLat, maxLng;
+};
+
+class Geofences
+{
+public:
+    // Drop every zone
+    void clear()
+    {
+        zoneCount_ = 0;
+        vertexCount_ = 0;
+        open_ = false;
+        grid_ = 0;
+        memset(inside_, 0, sizeof(inside_));
+        insideCount_ = 0;
+        insideFlags_ = 0xFF;
+        lastTests_ = 0;
+    }
+
+    bool beginZone(const char *name, uint8_t flags)
+    {
+        if (zoneCount_ == GEOFENCE_MAX_ZONES)
+            return false;
+        GeofenceZone &zone = zones_[zoneCount_];
+        snprintf(zone.name, sizeof(zone.name), "%.*s", (int)sizeof(zone.name) - 1, name);
+        zone.flags = flags;
+        zone.firstVertex = vertexCount_;
+        zone.vertexCount = 0;
+        zone.minLat = zone.minLng = INT32_MAX;
+        zone.maxLat = zone.maxLng = INT32_MIN;
+        open_ = true;
+        return true;
+    }
+
+    bool addVertex(int32_t lat, int32_t lng)
+    {
+        if (!open_ || vertexCount_ == GEOFENCE_MAX_VERTICES)
+            return false;
+        GeofenceZone &zone = zones_[zoneCount_];
+        lat_[vertexCount_] = lat;
+        lng_[vertexCount_] = lng;
+        vertexCount_++;
+        zone.vertexCount++;
+        zone.minLat = lat < zone.minLat ? lat : zone.minLat;
+        zone.maxLat = lat > zone.maxLat ? lat : zone.maxLat;
+        zone.minLng = lng < zone.minLng ? lng : zone.minLng;
+        zone.maxLng = lng > zone.maxLng ? lng : zone.maxLng;
+        return true;
+    }
+
+    // Forget the zone being added
+    void dropZone()
+    {
+        if (open_)
+            vertexCount_ = zones_[zoneCount_].firstVertex;
+        open_ = false;
+    }
+
+    // Keep the zone if it is a polygon (3 vertices or more); the closing
+    // edge back to the first vertex is implied
+    bool endZone()
+    {
+        if (!open_)
+            return false;
+        open_ = false;
+        GeofenceZone &zone = zones_[zoneCount_];
+        if (zone.vertexCount < 3)
+        {
+            vertexCount_ = zone.firstVertex;
+            return false;
+        }
+        zoneCount_++;
+        return true;
+    }
+
+    // Build the grid over the zones added so far. The grid is made coarser
+    // until every cell's zone list fits.
+    void index()
+    {
+        grid_ = 0;
+        if (zoneCount_ == 0)
+            return;
+
+        minLat_ = minLng_ = INT32_MAX;
+        int32_t maxLat = INT32_MIN;
+        int32_t maxLng = INT32_MIN;
+        for (size_t i = 0; i < zoneCount_; i++)
+        {
+            const GeofenceZone &zone = zones_[i];
+            minLat_ = zone.minLat < minLat_ ? zone.minLat : minLat_;
+            minLng_ = zone.minLng < minLng_ ? zone.minLng : minLng_;
+            maxLat = zone.maxLat > maxLat ? zone.maxLat : maxLat;
+            maxLng = zone.maxLng > maxLng ? zone.maxLng : maxLng;
+        }
+        spanLat_ = (int64_t)maxLat - minLat_ + 1;
+        spanLng_ = (int64_t)maxLng - minLng_ + 1;
+
+        for (uint32_t grid = GEOFENCE_GRID_SIZE; grid > 0; grid /= 2)
+        {
+            grid_ = grid;
+            if (fillCells())
+                return;
+        }
+    }
+
+    // Test a position against the zones near it and report changes to
+    // changed(zoneIndex, entered)
+    template <typename Changed>
+    void update(int32_t lat, int32_t lng, Changed changed)
+    {
+        uint32_t now[GEOFENCE_MAX_ZONES / 32] = {};
+        lastTests_ = 0;
+        int cell = cellOf(lat, lng);
+        if (cell >= 0)
+        {
+            for (uint16_t i = cellStart_[cell]; i < cellStart_[cell + 1]; i++)
+            {
+                uint16_t z = cellZones_[i];
+                if (contains(z, lat, lng))
+                    now[z / 32] |= 1UL << (z % 32);
+            }
+        }
+
+        insideCount_ = 0;
+        insideFlags_ = 0xFF;
+        for (size_t word = 0; word < GEOFENCE_MAX_ZONES / 32; word++)
+        {
+            uint32_t diff = now[word] ^ inside_[word];
+            inside_[word] = now[word];
+            for (uint32_t bits = now[word]; bits; bits &= bits - 1)
+            {
+                insideCount_++;
+                insideFlags_ &= zones_[word * 32 + __builtin_ctz(bits)].flags;
+            }
+            for (; diff; diff &= diff - 1)
+            {
+                size_t z = word * 32 + __builtin_ctz(diff);
+                changed(z, (now[word] >> (z % 32)) & 1);
+            }
+        }
+    }
+
+    // Point-in-polygon by crossing count, exact in 64-bit integers
+    bool contains(size_t z, int32_t lat, int32_t lng)
+    {
+        const GeofenceZone &zone = zones_[z];
+        if (lat < zone.minLat || lat > zone.maxLat || lng < zone.minLng || lng > zone.maxLng)
+            return false;
+        lastTests_++;
+
+        const int32_t *ys = lat_ + zone.firstVertex;
+        const int32_t *xs = lng_ + zone.firstVertex;
+        bool inside = false;
+        for (size_t i = 0, j = zone.vertexCount - 1; i < zone.vertexCount; j = i++)
+        {
+            if ((ys[i] > lat) == (ys[j] > lat))
+                continue;
+            // Does the edge cross the ray running east from the point?
+            int64_t dy = (int64_t)ys[j] - ys[i];
+            int64_t cross = ((int64_t)lng - xs[i]) * dy - ((int64_t)lat - ys[i]) * ((int64_t)xs[j] - xs[i]);
+            if (dy > 0 ? cross < 0 : cross > 0)
+                inside = !inside;
+        }
+        return inside;
+    }
+
+    size_t zoneCount() const { return zoneCount_; }
+    size_t vertexCount() const { return vertexCount_; }
+    const GeofenceZone &zone(size_t i) const { return zones_[i]; }
+    int32_t vertexLat(size_t i) const { return lat_[i]; }
+    int32_t vertexLng(size_t i) const { return lng_[i]; }
+    bool inside(size_t z) const { return (inside_[z / 32] >> (z % 32)) & 1; }
+    // Count the last position as inside a zone without reporting it, e.g.
+    // one it was in before the zones were reloaded
+    void setInside(size_t z) { inside_[z / 32] |= 1UL << (z % 32); }
+    size_t insideCount() const { return insideCount_; }
+    // Flags every zone the last position was in has set (all of them when
+    // it was in none)
+    uint8_t insideFlags() const { return insideFlags_; }
+    uint32_t gridSize() const { return grid_; }
+    size_t cellEntries() const { return grid_ ? cellStart_[grid_ * grid_] : 0; }
+    // Polygons tested in full for the last position
+    size_t lastTests() const { return lastTests_; }
+
+private:
+    int cellOf(int32_t lat, int32_t lng) const
+    {
+        if (grid_ == 0)
+            return -1;
+        int64_t y = (int64_t)lat - minLat_;
+        int64_t x = (int64_t)lng - minLng_;
+        if (y < 0 || y >= spanLat_ || x < 0 || x >= spanLng_)
+            return -1;
+        return (int)(y * grid_ / spanLat_) * grid_ + (int)(x * grid_ / spanLng_);
+    }
+
+    // Cells covered by a zone's bounding box, as inclusive row/column ranges
+    void cellRange(const GeofenceZone &zone, uint32_t &row0, uint32_t &row1, uint32_t &col0, uint32_t &col1) const
+    {
+        row0 = ((int64_t)zone.minLat - minLat_) * grid_ / spanLat_;
+        row1 = ((int64_t)zone.maxLat - minLat_) * grid_ / spanLat_;
+        col0 = ((int64_t)zone.minLng - minLng_) * grid_ / spanLng_;
+        col1 = ((int64_t)zone.maxLng - minLng_) * grid_ / spanLng_;
+    }
+
+    // Zone lists per cell, packed: cell c lists cellZones_[cellStart_[c]]
+    // up to cellStart_[c + 1]
+    bool fillCells()
+    {
+        uint32_t cells = grid_ * grid_;
+        memset(cellStart_, 0, (cells + 1) * sizeof(cellStart_[0]));
+        uint32_t total = 0;
+        for (size_t z = 0; z < zoneCount_; z++)
+        {
+            uint32_t row0, row1, col0, col1;
+            cellRange(zones_[z], row0, row1, col0, col1);
+            total += (row1 - row0 + 1) * (col1 - col0 + 1);
+            if (total > GEOFENCE_MAX_CELL_ENTRIES)
+                return false;
+            for (uint32_t row = row0; row <= row1; row++)
+            {
+                for (uint32_t col = col0; col <= col1; col++)
+                    cellStart_[row * grid_ + col + 1]++;
+            }
+        }
+        for (uint32_t c = 0; c < cells; c++)
+            cellStart_[c + 1] += cellStart_[c];
+
+        // Fill each cell from its start, then shift the starts back
+        for (size_t z = 0; z < zoneCount_; z++)
+        {
+            uint32_t row0, row1, col0, col1;
+            cellRange(zones_[z], row0, row1, col0, col1);
+            for (uint32_t row = row0; row <= row1; row++)
+            {
+                for (uint32_t col = col0; col <= col1; col++)
+                    cellZones_[cellStart_[row * grid_ + col]++] = z;
+            }
+        }
+        for (uint32_t c = cells; c > 0; c--)
+            cellStart_[c] = cellStart_[c - 1];
+        cellStart_[0] = 0;
+        return true;
+    }
+
+    GeofenceZone zones_[GEOFENCE_MAX_ZONES];
+    int32_t lat_[GEOFENCE_MAX_VERTICES];
+    int32_t lng_[GEOFENCE_MAX_VERTICES];
+    uint16_t cellStart_[GEOFENCE_GRID_SIZE * GEOFENCE_GRID_SIZE + 1];
+    uint16_t cellZones_[GEOFENCE_MAX_CELL_ENTRIES];
+    size_t zoneCount_ = 0;
+    size_t vertexCount_ = 0;
+    bool open_ = false;
+    uint32_t grid_ = 0; // Cells per side, 0 before index()
+    int32_t minLat_ = 0;
+    int32_t minLng_ = 0;
+    int64_t spanLat_ = 1;
+    int64_t spanLng_ = 1;
+    uint32_t inside_[GEOFENCE_MAX_ZONES / 32] = {};
+    size_t insideCount_ = 0;
+    uint8_t insideFlags_ = 0xFF;
+    size_t lastTests_ = 0;
+};
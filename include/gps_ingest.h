@@ -0,0 +1,82 @@
+#pragma once
+
+#include <TinyGPSPlus.h>
+#include <stdint.h>
+
+// NMEA ingest shared by the firmware and the host replay tool
+// (tools/nmea_replay). Nothing here touches the UART, the clock or the
+// scheduler, so a capture fed through it on the host behaves exactly as
+// the same bytes arriving from the NEO-6M.
+
+#define GPS_LOCK_MIN_SATELLITES 3
+
+struct GpsFix
+{
+    uint64_t timestamp; // µs, same base as nowUs()
+    double lat;
+    double lng;
+    float speedKmph;
+    float hdop;
+    uint8_t satellites;
+    bool valid;
+};
+
+// Feed one byte to the parser. Returns true with fix filled in when it
+// completed a sentence that carried a new position or a satellite count.
+//
+// TinyGPSPlus only commits a location from sentences that have a fix and
+// never clears location.isValid(), but commits the satellite count from
+// every GGA. Publishing on either, and calling the fix valid only when the
+// sentence itself committed a location, lets a GGA without a fix report the
+// lock as lost instead of leaving the last position standing.
+inline bool gpsIngestByte(TinyGPSPlus &gps, char c, uint64_t now, GpsFix &fix)
+{
+    if (!gps.encode(c))
+        return false;
+    bool located = gps.location.isUpdated();
+    if (!located && !gps.satellites.isUpdated())
+        return false;
+
+    fix.timestamp = now;
+    fix.lat = gps.location.lat();
+    fix.lng = gps.location.lng();
+    fix.speedKmph = located && gps.speed.isValid() ? gps.speed.kmph() : 0;
+    fix.hdop = located && gps.hdop.isValid() ? gps.hdop.hdop() : 99.9;
+    fix.satellites = gps.satellites.value();
+    fix.valid = located;
+    return true;
+}
+
+enum GpsLockEvent
+{
+    GPS_LOCK_UNCHANGED,
+    GPS_LOCK_ACQUIRED,
+    GPS_LOCK_LOST
+};
+
+// Lock is a valid fix with enough satellites; reports the edges only
+struct GpsLockMonitor
+{
+    bool locked = false;
+
+    GpsLockEvent update(const GpsFix &fix)
+    {
+        bool now = fix.valid && fix.satellites >= GPS_LOCK_MIN_SATELLITES;
+        GpsLockEvent event = now == locked ? GPS_LOCK_UNCHANGED : now ? GPS_LOCK_ACQUIRED : GPS_LOCK_LOST;
+        locked = now;
+        return event;
+    }
+};
+
+inline const char *gpsLockEventMessage(GpsLockEvent event)
+{
+    switch (event)
+    {
+    case GPS_LOCK_ACQUIRED:
+        return "GPS lock acquired";
+    case GPS_LOCK_LOST:
+        return "GPS lock lost";
+    default:
+        return "";
+    }
+}
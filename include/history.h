@@ -0,0 +1,197 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tiered in-RAM history of a sampled value.
+//
+// Each tier is a ring of fixed-interval buckets holding the mean, minimum
+// and maximum of what fell into them. Samples go into the finest tier;
+// whenever one of its buckets closes, that bucket is fed to the next
+// tier, which aggregates it into its own, longer bucket, and so on. With
+// 1 s, 10 s and 1 min tiers the last minutes are kept in detail and the
+// last day in outline, in a fixed amount of memory owned by the history.
+//
+// A bucket no sample fell into reads as NAN, so gaps stay visible instead
+// of being bridged. Times are µs in whatever base add() is called with.
+#define HISTORY_SPREAD_SCALE 100.0f // Bucket extremes are kept in hundredths
+
+// The mean, and how far the extremes lie below and above it (saturating at
+// 655.35), in 8 bytes
+struct HistoryBucket
+{
+    float mean; // NAN when nothing fell into the bucket
+    uint16_t below;
+    uint16_t above;
+
+    float min() const { return mean - below / HISTORY_SPREAD_SCALE; }
+    float max() const { return mean + above / HISTORY_SPREAD_SCALE; }
+};
+static_assert(sizeof(HistoryBucket) == 8, "HistoryBucket should pack into 8 bytes");
+
+struct HistoryTierConfig
+{
+    uint32_t intervalSeconds;
+    uint32_t capacity; // Buckets kept
+};
+
+// Buckets needed by a set of tiers, for sizing the storage at compile time
+template <size_t N>
+constexpr size_t historyBucketCount(const HistoryTierConfig (&tiers)[N])
+{
+    size_t count = 0;
+    for (size_t i = 0; i < N; i++)
+        count += tiers[i].capacity;
+    return count;
+}
+
+class HistoryTier
+{
+public:
+    void init(HistoryBucket *buckets, size_t capacity, uint64_t intervalUs, HistoryTier *next)
+    {
+        buckets_ = buckets;
+        capacity_ = capacity;
+        intervalUs_ = intervalUs;
+        next_ = next;
+    }
+
+    // Aggregate a sample (mean == min == max) or a closed finer bucket
+    void add(uint64_t timeUs, float mean, float min, float max)
+    {
+        uint64_t bucket = timeUs / intervalUs_;
+        if (samples_ > 0 && bucket > open_)
+        {
+            close();
+            // Empty buckets in between, at most a full ring of them
+            uint64_t gap = bucket - following_;
+            if (gap > capacity_)
+            {
+                following_ = bucket - capacity_;
+                gap = capacity_;
+            }
+            while (gap-- > 0)
+                push({NAN, 0, 0});
+        }
+        if (samples_ == 0)
+        {
+            open_ = bucket;
+            if (count_ == 0)
+                following_ = bucket;
+            min_ = min;
+            max_ = max;
+        }
+        sum_ += mean;
+        samples_++;
+        if (min < min_)
+            min_ = min;
+        if (max > max_)
+            max_ = max;
+    }
+
+    // Forget every bucket, closed or open
+    void reset()
+    {
+        head_ = 0;
+        count_ = 0;
+        following_ = 0;
+        open_ = 0;
+        sum_ = 0;
+        samples_ = 0;
+    }
+
+    size_t count() const { return count_; }
+    size_t capacity() const { return capacity_; }
+    uint64_t intervalUs() const { return intervalUs_; }
+    uint64_t spanUs() const { return capacity_ * intervalUs_; }
+
+    // i = 0 is the oldest closed bucket
+    const HistoryBucket &bucket(size_t i) const { return buckets_[(head_ + capacity_ - count_ + i) % capacity_]; }
+
+    // Start of bucket i
+    uint64_t startUs(size_t i) const { return (following_ - count_ + i) * intervalUs_; }
+
+private:
+    static uint16_t spread(float distance)
+    {
+        float scaled = distance * HISTORY_SPREAD_SCALE + 0.5f;
+        return scaled >= UINT16_MAX ? UINT16_MAX : (uint16_t)scaled;
+    }
+
+    void close()
+    {
+        float mean = sum_ / samples_;
+        push({mean, spread(mean - min_), spread(max_ - mean)});
+        if (next_)
+            next_->add(open_ * intervalUs_, mean, min_, max_);
+        samples_ = 0;
+        sum_ = 0;
+    }
+
+    void push(const HistoryBucket &bucket)
+    {
+        buckets_[head_] = bucket;
+        head_ = (head_ + 1) % capacity_;
+        if (count_ < capacity_)
+            count_++;
+        following_++;
+    }
+
+    HistoryBucket *buckets_ = nullptr;
+    size_t capacity_ = 0;
+    uint64_t intervalUs_ = 1;
+    HistoryTier *next_ = nullptr; // Coarser tier fed with closed buckets
+    size_t head_ = 0;             // Slot the next closed bucket goes to
+    size_t count_ = 0;
+    uint64_t following_ = 0;      // Bucket number the next closed bucket gets
+    uint64_t open_ = 0;           // Bucket number being filled
+    double sum_ = 0;              // Of the means added to the open bucket
+    uint32_t samples_ = 0;
+    float min_ = 0;
+    float max_ = 0;
+};
+
+template <size_t TierCount, size_t BucketCount>
+class TieredHistory
+{
+public:
+    // Tiers from the finest to the coarsest
+    explicit TieredHistory(const HistoryTierConfig (&tiers)[TierCount])
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < TierCount; i++)
+        {
+            tiers_[i].init(buckets_ + offset, tiers[i].capacity, tiers[i].intervalSeconds * 1000000ULL,
+                           i + 1 < TierCount ? &tiers_[i + 1] : nullptr);
+            offset += tiers[i].capacity;
+        }
+    }
+
+    void add(uint64_t timeUs, float value) { tiers_[0].add(timeUs, value, value, value); }
+
+    // Start over, e.g. when the samples change meaning
+    void reset()
+    {
+        for (size_t i = 0; i < TierCount; i++)
+            tiers_[i].reset();
+    }
+
+    const HistoryTier &tier(size_t i) const { return tiers_[i]; }
+    static constexpr size_t tierCount() { return TierCount; }
+
+    // The finest tier reaching back spanUs, or the coarsest
+    const HistoryTier &tierFor(uint64_t spanUs) const
+    {
+        for (size_t i = 0; i < TierCount; i++)
+        {
+            if (tiers_[i].spanUs() >= spanUs)
+                return tiers_[i];
+        }
+        return tiers_[TierCount - 1];
+    }
+
+private:
+    HistoryTier tiers_[TierCount];
+    HistoryBucket buckets_[BucketCount];
+};
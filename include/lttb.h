@@ -0,0 +1,68 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest-Triangle-Three-Buckets downsampling (Steinarsson, 2013).
+//
+// Picks at most threshold of the count points so that a line through them
+// keeps the visual shape of the full series: the first and last point are
+// always kept, the rest is split into threshold - 2 buckets and from each
+// the point forming the largest triangle with the previously kept point
+// and the average of the next bucket is taken. x must be increasing.
+// Writes the indexes of the kept points to selected, in order, and returns
+// how many there are. With threshold >= count (or below 3) every point is
+// kept.
+inline size_t lttbSelect(const float *x, const float *y, size_t count, size_t threshold, uint16_t *selected)
+{
+    if (threshold >= count || threshold < 3)
+    {
+        for (size_t i = 0; i < count; i++)
+            selected[i] = i;
+        return count;
+    }
+
+    float every = (float)(count - 2) / (threshold - 2);
+    size_t kept = 0;
+    size_t a = 0;
+    selected[kept++] = 0;
+
+    for (size_t bucket = 0; bucket < threshold - 2; bucket++)
+    {
+        // Average of the next bucket (the last point for the final one)
+        size_t nextStart = (size_t)((bucket + 1) * every) + 1;
+        size_t nextEnd = (size_t)((bucket + 2) * every) + 1;
+        if (nextEnd > count)
+            nextEnd = count;
+        float averageX = 0;
+        float averageY = 0;
+        for (size_t i = nextStart; i < nextEnd; i++)
+        {
+            averageX += x[i];
+            averageY += y[i];
+        }
+        averageX /= nextEnd - nextStart;
+        averageY /= nextEnd - nextStart;
+
+        size_t start = (size_t)(bucket * every) + 1;
+        size_t end = (size_t)((bucket + 1) * every) + 1;
+        float largest = -1;
+        size_t pick = start;
+        for (size_t i = start; i < end; i++)
+        {
+            // Twice the triangle area; the factor does not change the pick
+            float area = fabsf((x[a] - averageX) * (y[i] - y[a]) - (x[a] - x[i]) * (averageY - y[a]));
+            if (area > largest)
+            {
+                largest = area;
+                pick = i;
+            }
+        }
+        selected[kept++] = pick;
+        a = pick;
+    }
+
+    selected[kept++] = count - 1;
+    return kept;
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pages as compile-time templates.
+//
+// A template is a string literal with {{name}} placeholders. At compile
+// time it is split into an array of parts, each either a literal chunk
+// pointing into the text or the index of a placeholder in the page's slot
+// list. Rendering walks the parts, copying chunks and asking the page's
+// fill function for each slot, through a PageWriter that streams fixed
+// size pieces to the client. No heap, and no copy of the whole page.
+//
+// The template is checked while compiling: a placeholder that is not in the
+// slot list, a slot the template never uses, or a "{{" without a closing
+// "}}" fails the build with a call to templateError() in the diagnostic.
+//
+//   static constexpr char pageText[] = "<p>{{name}} is {{state}}</p>";
+//   static constexpr const char *pageSlots[] = {"name", "state"};
+//   static constexpr auto page = PAGE_TEMPLATE(pageText, pageSlots);
+//   ...
+//   renderPage(page, writer, [](int slot, PageWriter &out) { ... });
+
+struct TemplatePart
+{
+    const char *text = nullptr; // Literal chunk, or nullptr for a slot
+    size_t length = 0;
+    int slot = -1;
+};
+
+template <size_t N>
+struct PageTemplate
+{
+    TemplatePart parts[N];
+    static constexpr size_t count = N;
+};
+
+// Never defined: reaching it during constant evaluation is the error
+void templateError(const char *problem);
+
+namespace page_template
+{
+
+constexpr bool startsWith(const char *text, const char *prefix)
+{
+    while (*prefix)
+    {
+        if (*text++ != *prefix++)
+            return false;
+    }
+    return true;
+}
+
+constexpr bool sameName(const char *name, size_t length, const char *slot)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (slot[i] != name[i])
+            return false;
+    }
+    return slot[length] == '\0';
+}
+
+// Length of the placeholder name starting at text (after "{{")
+constexpr size_t nameLength(const char *text)
+{
+    size_t length = 0;
+    while (text[length] && !startsWith(text + length, "}}"))
+        length++;
+    if (!text[length])
+        templateError("unterminated {{ placeholder");
+    if (length == 0)
+        templateError("empty {{}} placeholder");
+    return length;
+}
+
+constexpr size_t partCount(const char *text)
+{
+    size_t count = 0;
+    size_t literal = 0;
+    while (*text)
+    {
+        if (startsWith(text, "{{"))
+        {
+            count += (literal > 0) + 1;
+            literal = 0;
+            text += 2 + nameLength(text + 2) + 2;
+        }
+        else
+        {
+            literal++;
+            text++;
+        }
+    }
+    return count + (literal > 0);
+}
+
+template <size_t N>
+constexpr PageTemplate<N> compile(const char *text, const char *const *slots, size_t slotCount)
+{
+    PageTemplate<N> page{};
+    bool used[64] = {};
+    if (slotCount > sizeof(used))
+        templateError("too many slots");
+
+    size_t part = 0;
+    const char *literal = text;
+    while (true)
+    {
+        bool end = *text == '\0';
+        if (end || startsWith(text, "{{"))
+        {
+            if (text > literal)
+            {
+                page.parts[part].text = literal;
+                page.parts[part].length = text - literal;
+                part++;
+            }
+            if (end)
+                break;
+
+            const char *name = text + 2;
+            size_t length = nameLength(name);
+            int slot = -1;
+            for (size_t i = 0; i < slotCount && slot < 0; i++)
+            {
+                if (sameName(name, length, slots[i]))
+                    slot = i;
+            }
+            if (slot < 0)
+                templateError("placeholder not in the slot list");
+            used[slot] = true;
+            page.parts[part].slot = slot;
+            part++;
+
+            text = name + length + 2;
+            literal = text;
+        }
+        else
+        {
+            text++;
+        }
+    }
+
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        if (!used[i])
+            templateError("slot not used by the template");
+    }
+    return page;
+}
+
+} // namespace page_template
+
+#define PAGE_TEMPLATE(text, slots)                                                                   \
+    page_template::compile<page_template::partCount(text)>(text, slots, sizeof(slots) / sizeof(slots[0]))
+
+// Buffers page output and hands it to the sink in pieces of up to the
+// buffer size. Literal chunks larger than the free space go out directly.
+class PageWriter
+{
+public:
+    typedef void (*Sink)(const char *data, size_t length);
+
+    PageWriter(char *buffer, size_t capacity, Sink sink) : buffer_(buffer), capacity_(capacity), sink_(sink) {}
+
+    void write(const char *data, size_t length)
+    {
+        if (length > capacity_ - used_)
+        {
+            flush();
+            if (length >= capacity_)
+            {
+                sink_(data, length);
+                total_ += length;
+                return;
+            }
+        }
+        memcpy(buffer_ + used_, data, length);
+        used_ += length;
+        total_ += length;
+    }
+
+    void print(const char *text) { write(text, strlen(text)); }
+
+    // Formatted output is limited to the buffer size
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            va_list args;
+            va_start(args, format);
+            int length = vsnprintf(buffer_ + used_, capacity_ - used_, format, args);
+            va_end(args);
+            if (length < 0)
+                return;
+            if ((size_t)length < capacity_ - used_ || (attempt == 1 && used_ == 0))
+            {
+                length = (size_t)length < capacity_ - used_ ? length : capacity_ - used_ - 1;
+                used_ += length;
+                total_ += length;
+                return;
+            }
+            flush();
+        }
+    }
+
+    // Text for an HTML element or quoted attribute
+    void printEscaped(const char *text)
+    {
+        while (*text)
+        {
+            size_t plain = strcspn(text, "&<>'\"");
+            write(text, plain);
+            text += plain;
+            switch (*text)
+            {
+            case '&':
+                print("&amp;");
+                break;
+            case '<':
+                print("&lt;");
+                break;
+            case '>':
+                print("&gt;");
+                break;
+            case '\'':
+                print("&#39;");
+                break;
+            case '"':
+                print("&quot;");
+                break;
+            default:
+                return;
+            }
+            text++;
+        }
+    }
+
+    void flush()
+    {
+        if (used_ > 0)
+            sink_(buffer_, used_);
+        used_ = 0;
+    }
+
+    size_t total() const { return total_; }
+
+private:
+    char *buffer_;
+    size_t capacity_;
+    Sink sink_;
+    size_t used_ = 0;
+    size_t total_ = 0;
+};
+
+// fill(slot, writer) produces the value of each placeholder
+template <size_t N, typename Fill>
+void renderPage(const PageTemplate<N> &page, PageWriter &out, Fill fill)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        const TemplatePart &part = page.parts[i];
+        if (part.text)
+            out.write(part.text, part.length);
+        else
+            fill(part.slot, out);
+    }
+    out.flush();
+}
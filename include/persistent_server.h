@@ -0,0 +1,252 @@
+#pragma once
+
+#include <WebServer.h>
+#include <WiFi.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+// WebServer with persistent connections.
+//
+// The stock server in the ESP32 core serves one connection at a time and
+// closes it after every response, so each request pays a TCP handshake on
+// the soft AP. This one keeps up to HTTP_MAX_CLIENTS connections open and
+// serves them round-robin, one request per ready connection per
+// handleClient() call, so a client pipelining requests takes turns with
+// the others. Pipelined requests are parsed in order as their connection
+// comes up. Requests are still served one at a time and each handler runs
+// to completion: a long response such as a download or a tile holds up
+// the loop and every other connection until it is sent.
+//
+// The base class still parses requests and runs the handlers. Its response
+// header always ends in "Connection: close"; that line is rewritten on the
+// way out when the connection stays open. Only HTTP/1.1 requests that did
+// not ask to close are kept, so every body is framed by Content-Length or
+// chunked encoding, both of which the base class already produces.
+//
+// A connection closes after idleTimeout ms without a request or after
+// maxRequests responses. When every slot is taken, a new connection
+// replaces the one idle the longest; if none is idle it waits in the
+// listen backlog.
+#define HTTP_MAX_CLIENTS 4 // Open connections, each holding lwIP socket buffers
+#define HTTP_MAX_HEADERS 8 // Request headers collected for the handlers
+
+struct HttpConnectionStats
+{
+    uint32_t accepted = 0; // Connections taken from the listener
+    uint32_t requests = 0;
+    uint32_t reused = 0;   // Requests on a connection that served one before
+    uint32_t evicted = 0;  // Idle connections closed to make room
+    uint32_t timedOut = 0; // Idle connections closed by the timeout
+};
+
+class PersistentWebServer : public WebServer
+{
+public:
+    PersistentWebServer(int port, unsigned long idleTimeout, uint16_t maxRequests)
+        : WebServer(port), idleTimeout_(idleTimeout), maxRequests_(maxRequests)
+    {
+    }
+
+    // Request headers handlers can read with header(); "Connection" is
+    // always collected on top of these
+    void collectHeaders(const char *keys[], size_t count)
+    {
+        const char *all[HTTP_MAX_HEADERS] = {"Connection"};
+        size_t total = 1;
+        for (size_t i = 0; i < count && total < HTTP_MAX_HEADERS; i++)
+            all[total++] = keys[i];
+        WebServer::collectHeaders(all, total);
+        headersCollected_ = true;
+    }
+
+    void begin()
+    {
+        if (!headersCollected_)
+            collectHeaders(nullptr, 0);
+        WebServer::begin();
+    }
+
+    void handleClient()
+    {
+        unsigned long now = millis();
+        closeIdle(now);
+        acceptClients(now);
+
+        for (size_t n = 0; n < HTTP_MAX_CLIENTS; n++)
+        {
+            Connection &connection = connections_[(next_ + n) % HTTP_MAX_CLIENTS];
+            if (connection.client && connection.client.available())
+                serve(connection);
+        }
+        next_ = (next_ + 1) % HTTP_MAX_CLIENTS;
+    }
+
+    size_t openClients()
+    {
+        size_t count = 0;
+        for (Connection &connection : connections_)
+            count += connection.client ? 1 : 0;
+        return count;
+    }
+
+    const HttpConnectionStats &connectionStats() const { return stats_; }
+
+    // Close the connection once the handler returns. A handler that sent a
+    // Content-Length and then could not produce that many bytes calls this,
+    // so the client sees the body cut short instead of reading the next
+    // response as the rest of it.
+    void closeAfterResponse() { keepAlive_ = false; }
+
+protected:
+    // Every write to the client comes through here, the header block in one
+    // piece starting with the status line
+    size_t _currentClientWrite(const char *data, size_t length) override
+    {
+        if (!headerPending_ || length < 7 || strncmp(data, "HTTP/1.", 7) != 0)
+            return WebServer::_currentClientWrite(data, length);
+
+        headerPending_ = false;
+        keepAlive_ = _currentVersion == 1 && requests_ < maxRequests_ &&
+                     strcasecmp(header("Connection").c_str(), "close") != 0;
+        static const char closeLine[] = "\r\nConnection: close\r\n";
+        const char *found = keepAlive_ ? find(data, length, closeLine) : nullptr;
+        if (!found)
+        {
+            keepAlive_ = false;
+            return WebServer::_currentClientWrite(data, length);
+        }
+
+        char keepLine[72];
+        int keepLength = snprintf(keepLine, sizeof(keepLine),
+                                  "\r\nConnection: keep-alive\r\nKeep-Alive: timeout=%lu, max=%u\r\n",
+                                  idleTimeout_ / 1000, (unsigned)(maxRequests_ - requests_));
+        size_t head = found - data;
+        size_t tail = length - head - (sizeof(closeLine) - 1);
+        if (WebServer::_currentClientWrite(data, head) != head ||
+            WebServer::_currentClientWrite(keepLine, keepLength) != (size_t)keepLength ||
+            WebServer::_currentClientWrite(found + sizeof(closeLine) - 1, tail) != tail)
+        {
+            return 0;
+        }
+        return length;
+    }
+
+private:
+    struct Connection
+    {
+        WiFiClient client;
+        unsigned long lastActivity = 0;
+        uint16_t requests = 0;
+    };
+
+    static const char *find(const char *data, size_t length, const char *text)
+    {
+        size_t textLength = strlen(text);
+        for (size_t i = 0; i + textLength <= length; i++)
+        {
+            if (memcmp(data + i, text, textLength) == 0)
+                return data + i;
+        }
+        return nullptr;
+    }
+
+    void close(Connection &connection)
+    {
+        connection.client.stop();
+        connection.client = WiFiClient();
+    }
+
+    void closeIdle(unsigned long now)
+    {
+        for (Connection &connection : connections_)
+        {
+            if (!connection.client)
+                continue;
+            if (!connection.client.connected())
+            {
+                close(connection);
+            }
+            else if (!connection.client.available() && now - connection.lastActivity > idleTimeout_)
+            {
+                close(connection);
+                stats_.timedOut++;
+            }
+        }
+    }
+
+    // Free slot, else the connection idle the longest, else nullptr
+    Connection *slotForNewClient()
+    {
+        Connection *idlest = nullptr;
+        for (Connection &connection : connections_)
+        {
+            if (!connection.client)
+                return &connection;
+            if (!connection.client.available() && (!idlest || connection.lastActivity < idlest->lastActivity))
+                idlest = &connection;
+        }
+        if (idlest)
+        {
+            close(*idlest);
+            stats_.evicted++;
+        }
+        return idlest;
+    }
+
+    void acceptClients(unsigned long now)
+    {
+        while (_server.hasClient())
+        {
+            Connection *connection = slotForNewClient();
+            if (!connection)
+                break;
+            connection->client = _server.available();
+            connection->lastActivity = now;
+            connection->requests = 0;
+            stats_.accepted++;
+        }
+    }
+
+    // One request: the same steps as WebServer::handleClient(), except that
+    // the connection goes back to its slot unless the response closed it
+    void serve(Connection &connection)
+    {
+        _currentClient = connection.client;
+        _currentStatus = HC_WAIT_READ;
+        _statusChange = millis();
+        requests_ = ++connection.requests;
+        headerPending_ = true;
+        keepAlive_ = false;
+
+        if (_parseRequest(_currentClient))
+        {
+            _currentClient.setTimeout(HTTP_MAX_SEND_WAIT / 1000);
+            _contentLength = CONTENT_LENGTH_NOT_SET;
+            _handleRequest();
+            stats_.requests++;
+            if (connection.requests > 1)
+                stats_.reused++;
+        }
+
+        if (keepAlive_ && connection.client.connected())
+            connection.lastActivity = millis();
+        else
+            close(connection);
+
+        headerPending_ = false;
+        _currentClient = WiFiClient();
+        _currentStatus = HC_NONE;
+        _currentUpload.reset();
+    }
+
+    Connection connections_[HTTP_MAX_CLIENTS];
+    size_t next_ = 0; // Slot served first on the next pass
+    unsigned long idleTimeout_;
+    uint16_t maxRequests_;
+    uint16_t requests_ = 0; // Requests on the connection being served, this one included
+    bool headerPending_ = false;
+    bool keepAlive_ = false;
+    bool headersCollected_ = false;
+    HttpConnectionStats stats_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single-producer / single-consumer ring buffer.
+//
+// Exactly one context may push and exactly one may pop; under that rule no
+// locks or interrupt masking are needed. push() and pop() are forced inline
+// so that a push from an IRAM interrupt handler stays in IRAM and never
+// touches flash. Capacity must be a power of two; all slots are usable.
+//
+// head and tail are free-running 32-bit counters, each written by one side
+// only. They are word aligned so every access is a single load/store, and
+// kept apart from each other so producer and consumer never share a line
+// on targets that have a data cache.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscQueue capacity must be a power of two");
+
+public:
+    // Producer side. Returns false (and counts a drop) when full.
+    __attribute__((always_inline)) inline bool push(const T &item)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= Capacity)
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        items_[head & (Capacity - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when empty.
+    __attribute__((always_inline)) inline bool pop(T &item)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+            return false;
+        item = items_[tail & (Capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: look at the oldest item without removing it
+    bool peek(T &item) const
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) == tail)
+            return false;
+        item = items_[tail & (Capacity - 1)];
+        return true;
+    }
+
+    size_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() >= Capacity; }
+    static constexpr size_t capacity() { return Capacity; }
+
+    // Items rejected by push() since boot (written by the producer only)
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    alignas(32) std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> dropped_{0};
+    alignas(32) std::atomic<uint32_t> tail_{0};
+    alignas(4) T items_[Capacity];
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <FS.h>
+#include <stdint.h>
+#include <string.h>
+
+// Map tiles packed into one file on the SD card.
+//
+// FAT handles tens of thousands of small files badly: every tile would cost
+// a directory walk before its first byte. tools/pack_tiles.py packs an XYZ
+// tile tree (or an MBTiles file) into a single archive instead:
+//
+//   TileArchiveHeader    48 bytes
+//   directory            uint64 key of the first entry of every index page
+//   index                TileIndexEntry per tile, sorted by key
+//   tile data
+//
+// The index is split into pages of pageEntries entries. begin() reads the
+// header and the directory, which stay in RAM; find() picks the page from
+// the directory, reads that page in one go into the caller's buffer and
+// searches it, so a tile costs one index read and one data read on an
+// archive that stays open. All numbers are little-endian.
+#define TILE_ARCHIVE_MAGIC "TPAK"
+#define TILE_ARCHIVE_VERSION 1
+#define TILE_DIRECTORY_MAX 512     // Index pages; the directory is held in RAM
+#define TILE_PAGE_MAX_ENTRIES 1024 // Largest page a lookup reads, 16 bytes per entry
+
+enum TileFormat : uint8_t
+{
+    TILE_PNG,
+    TILE_JPEG,
+    TILE_WEBP,
+    TILE_FORMAT_COUNT
+};
+
+struct TileArchiveHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t format; // TileFormat
+    uint8_t reserved;
+    uint32_t created;     // Unix time of packing, so caches can tell archives apart
+    uint32_t tileCount;
+    uint32_t pageEntries; // Index entries per directory page
+    uint32_t directoryOffset;
+    uint32_t indexOffset;
+    uint8_t minZoom;
+    uint8_t maxZoom;
+    uint16_t reserved2;
+    int32_t south, west, north, east; // Micro-degrees
+};
+static_assert(sizeof(TileArchiveHeader) == 48, "TileArchiveHeader must match the packer");
+
+struct TileIndexEntry
+{
+    uint64_t key; // tileKey(z, x, y)
+    uint32_t offset;
+    uint32_t length;
+};
+static_assert(sizeof(TileIndexEntry) == 16, "TileIndexEntry must match the packer");
+
+// Sorts by zoom, then column, then row
+inline uint64_t tileKey(uint32_t z, uint32_t x, uint32_t y)
+{
+    return (uint64_t)z << 48 | (uint64_t)x << 24 | y;
+}
+
+class TileArchive
+{
+public:
+    // Open an archive and load its directory. Fails, and leaves the archive
+    // closed, on anything it does not understand.
+    bool begin(fs::FS &fs, const char *path)
+    {
+        end();
+        file_ = fs.open(path, FILE_READ);
+        if (!file_)
+            return false;
+
+        size_t size = file_.size();
+        uint32_t pages = 0;
+        bool ok = file_.read((uint8_t *)&header_, sizeof(header_)) == sizeof(header_) &&
+                  memcmp(header_.magic, TILE_ARCHIVE_MAGIC, 4) == 0 && header_.version == TILE_ARCHIVE_VERSION &&
+                  header_.format < TILE_FORMAT_COUNT && header_.tileCount > 0 && header_.pageEntries > 0 &&
+                  header_.pageEntries <= TILE_PAGE_MAX_ENTRIES;
+        if (ok)
+        {
+            pages = (header_.tileCount + header_.pageEntries - 1) / header_.pageEntries;
+            ok = pages <= TILE_DIRECTORY_MAX && header_.directoryOffset + pages * sizeof(uint64_t) <= size &&
+                 header_.indexOffset + (uint64_t)header_.tileCount * sizeof(TileIndexEntry) <= size &&
+                 file_.seek(header_.directoryOffset) &&
+                 file_.read((uint8_t *)directory_, pages * sizeof(uint64_t)) == pages * sizeof(uint64_t);
+        }
+        if (!ok)
+        {
+            end();
+            return false;
+        }
+        pageCount_ = pages;
+        size_ = size;
+        return true;
+    }
+
+    void end()
+    {
+        if (file_)
+            file_.close();
+        file_ = fs::File();
+        pageCount_ = 0;
+    }
+
+    bool isOpen() const { return pageCount_ > 0; }
+    const TileArchiveHeader &header() const { return header_; }
+
+    // Bytes a lookup needs in its page buffer
+    size_t pageBytes() const { return header_.pageEntries * sizeof(TileIndexEntry); }
+
+    // Look a tile up; page must hold pageBytes()
+    bool find(uint32_t z, uint32_t x, uint32_t y, TileIndexEntry &entry, TileIndexEntry *page)
+    {
+        if (!isOpen())
+            return false;
+        uint64_t key = tileKey(z, x, y);
+
+        // Last page starting at or before the key
+        size_t low = 0;
+        size_t high = pageCount_;
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+            if (directory_[middle] <= key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (low == 0)
+            return false;
+        size_t p = low - 1;
+
+        size_t first = p * header_.pageEntries;
+        size_t count = header_.tileCount - first < header_.pageEntries ? header_.tileCount - first
+                                                                         : header_.pageEntries;
+        size_t bytes = count * sizeof(TileIndexEntry);
+        if (!file_.seek(header_.indexOffset + first * sizeof(TileIndexEntry)) ||
+            file_.read((uint8_t *)page, bytes) != bytes)
+            return false;
+
+        low = 0;
+        high = count;
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+            if (page[middle].key < key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        if (low == count || page[low].key != key || page[low].offset + (uint64_t)page[low].length > size_)
+            return false;
+        entry = page[low];
+        return true;
+    }
+
+    // Position the archive at a tile's data for read()
+    bool seek(const TileIndexEntry &entry) { return file_.seek(entry.offset); }
+    size_t read(uint8_t *buffer, size_t length) { return file_.read(buffer, length); }
+
+private:
+    fs::File file_;
+    TileArchiveHeader header_ = {};
+    uint64_t directory_[TILE_DIRECTORY_MAX];
+    size_t pageCount_ = 0;
+    size_t size_ = 0;
+};
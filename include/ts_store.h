@@ -0,0 +1,180 @@
+#pragma once
+
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdint.h>
+#include <vector>
+
+// Append-only time-series store on the SD card.
+//
+// Each series lives in two files under TS_STORE_DIR:
+//   <name>.dat  fixed 512-byte blocks, one SD sector each
+//   <name>.idx  one TsIndexEntry per sealed block
+//
+// A block holds up to TS_BLOCK_MAX_RECORDS records stored column by column:
+// first the timestamps, then each value column. Every column is delta
+// encoded against the previous record and written as zigzag varints, so a
+// slowly changing column costs about one byte per record.
+//
+// The newest block stays in RAM while it fills. sync() writes it to its
+// slot unsealed so a power cut loses at most what was appended since the
+// last sync; begin() reloads it and carries on. Once full it is rewritten
+// sealed and its time range added to the index, which range scans use to
+// skip blocks without reading them.
+//
+// Every block carries a sequence number and a CRC32 over its header and
+// payload. Only the last TS_RECOVERY_BLOCKS blocks can be mid-write at a
+// power cut, so begin() verifies just those: the file is cut back to the
+// first block that fails its CRC or breaks the sequence, and the index
+// is trimmed to match. Boot cost does not grow with the log.
+//
+// All methods are safe to call from any task; each series has its own lock.
+
+#define TS_STORE_DIR "/ts"
+#define TS_BLOCK_SIZE 512
+#define TS_BLOCK_MAX_RECORDS 64
+#define TS_MAX_COLUMNS 4
+#define TS_RECOVERY_BLOCKS 4
+#ifndef TS_VFS_ROOT
+#define TS_VFS_ROOT "/sd" // Where the SD library mounts the card in the VFS
+#endif
+
+// One row. Values are fixed point; the caller picks the scale per column.
+struct TsRecord
+{
+    uint32_t time; // Unix seconds
+    int32_t values[TS_MAX_COLUMNS];
+};
+
+struct TsIndexEntry
+{
+    uint32_t minTime;
+    uint32_t maxTime;
+    uint16_t count;
+    uint16_t reserved;
+};
+
+// What begin() found and repaired
+struct TsRecovery
+{
+    uint16_t blocksChecked = 0;
+    uint16_t blocksTruncated = 0;  // Torn or stale blocks cut off the end
+    uint16_t indexRebuilt = 0;     // Index entries recreated from block headers
+    uint16_t bytesTruncated = 0;   // Partial block at the end of the file
+    bool truncateFailed = false;
+
+    bool repaired() const { return blocksTruncated || indexRebuilt || bytesTruncated; }
+};
+
+class TsSeries
+{
+public:
+    bool begin(fs::FS &fs, const char *name, uint8_t columns);
+
+    bool append(const TsRecord &record);
+    bool sync();
+    bool clear();
+
+    const char *name() const { return name_; }
+    uint8_t columns() const { return columns_; }
+    uint32_t blockCount();
+    uint32_t recordCount();
+    uint32_t writeErrors() const { return writeErrors_; }
+    const TsRecovery &recovery() const { return recovery_; }
+
+    // Pack the leading records into one sealed block in the on-card format,
+    // as many as fit, for shipping off the device. Returns how many were
+    // packed.
+    uint16_t packBlock(const TsRecord *records, uint16_t count, uint32_t sequence, uint8_t *block) const;
+    // Bytes of a block that carry data (header plus payload)
+    static size_t blockLength(const uint8_t *block);
+
+private:
+    friend class TsIterator;
+
+    struct BlockHeader
+    {
+        uint16_t magic;
+        uint8_t columns;
+        uint8_t flags;
+        uint16_t count;
+        uint16_t payloadLength;
+        uint32_t minTime;
+        uint32_t maxTime;
+        uint32_t sequence;
+        uint32_t crc; // CRC32 of the header (with crc zero) and payload
+    };
+
+    static const uint16_t BLOCK_MAGIC = 0x5354; // "TS"
+    static const uint8_t BLOCK_SEALED = 0x01;
+    static const size_t PAYLOAD_SIZE = TS_BLOCK_SIZE - sizeof(BlockHeader);
+
+    size_t recordCost(const TsRecord *previous, const TsRecord &record) const;
+    size_t encodeBlock(const TsRecord *records, uint16_t count, bool sealed, uint32_t sequence, uint8_t *block) const;
+    static int decodeBlock(const uint8_t *block, uint8_t columns, TsRecord *records);
+    static uint32_t blockCrc(const uint8_t *block);
+    bool verifyBlock(const uint8_t *block) const;
+    bool truncateData(uint32_t blocks);
+    bool writeBlock(uint32_t slot, bool sealed);
+    bool seal();
+    bool readBlock(uint32_t slot, uint8_t *block);
+    void lock() { xSemaphoreTake(lock_, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(lock_); }
+
+    fs::FS *fs_ = nullptr;
+    SemaphoreHandle_t lock_ = nullptr;
+    char name_[16] = "";
+    char dataPath_[32] = "";
+    char indexPath_[32] = "";
+    uint8_t columns_ = 0;
+    uint32_t writeErrors_ = 0;
+    TsRecovery recovery_;
+
+    std::vector<TsIndexEntry> index_; // Sealed blocks, in file order
+
+    // Open block, kept decoded; openBytes_ tracks its encoded payload size
+    TsRecord open_[TS_BLOCK_MAX_RECORDS];
+    uint16_t openCount_ = 0;
+    size_t openBytes_ = 0;
+    bool openDirty_ = false;
+    uint32_t openSequence_ = 0; // Sequence number of the open block
+};
+
+// Forward range scan over [from, to], oldest block first. Records inside a
+// block come out in append order. Blocks appended or sealed while the scan
+// runs are picked up; records appended to the open block after it has been
+// visited are not.
+//
+// Records are also numbered by ordinal, their position in the series
+// counting from 0. resetAtRecord() starts a scan at an ordinal without
+// reading the blocks before it.
+class TsIterator
+{
+public:
+    TsIterator() = default;
+    TsIterator(TsSeries &series, uint32_t from = 0, uint32_t to = UINT32_MAX) { reset(series, from, to); }
+
+    void reset(TsSeries &series, uint32_t from = 0, uint32_t to = UINT32_MAX);
+    void resetAtRecord(TsSeries &series, uint32_t ordinal);
+    bool next(TsRecord &record);
+
+    // Ordinal of the record last returned by next()
+    uint32_t ordinal() const { return ordinal_; }
+
+private:
+    bool loadNextBlock();
+
+    TsSeries *series_ = nullptr;
+    uint32_t from_ = 0;
+    uint32_t to_ = UINT32_MAX;
+    uint32_t start_ = 0;    // First ordinal wanted
+    uint32_t slot_ = 0;
+    uint32_t base_ = 0;     // Ordinal of records_[0]
+    uint32_t nextBase_ = 0; // Ordinal of the first record in block slot_
+    uint32_t ordinal_ = 0;
+    bool done_ = true;
+    TsRecord records_[TS_BLOCK_MAX_RECORDS];
+    int count_ = 0;
+    int position_ = 0;
+};
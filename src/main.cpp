@@ -6,6 +6,38 @@
 #include <RTClib.h>
 #include <Adafruit_BMP085.h>
 #include <TinyGPSPlus.h>
+#include <HTTPClient.h>
+#include <mqtt_client.h>
+#include <freertos/semphr.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include <esp_heap_caps.h>
+#include "spsc_queue.h"
+#include "ts_store.h"
+#include "cbor_writer.h"
+#include "gps_ingest.h"
+#include "arena.h"
+#include "page_template.h"
+#include "persistent_server.h"
+#include "history.h"
+#include "lttb.h"
+#include "geofence.h"
+#include "tile_archive.h"
+
+// Monotonic time base: 64-bit microseconds since boot. Every deadline,
+// interval, rate and record timestamp uses it, so nothing wraps after 49 days.
+typedef uint64_t TimeUs;
+#define MS_TO_US(ms) ((TimeUs)(ms) * 1000ULL)
+#define SEC_TO_US(s) ((TimeUs)(s) * 1000000ULL)
+
+inline TimeUs nowUs()
+{
+    return (TimeUs)esp_timer_get_time();
+}
 
 // Pin Definitions
 #define RXD2 16
@@ -30,11 +62,12 @@ struct PressureHistory
 PressureHistory pressureHistory;
 
 #define FLOW_SENSOR_PIN 15
-volatile uint16_t pulseCount = 0;
+// Flow ISR -> sampler: one timestamp per pulse
+SpscQueue<TimeUs, 512> pulseQueue;
 float flowRate = 0.0;
 const float calibrationFactor = 7.5; // Adjust based on sensor specs
 
-int lastLogTime = 3000;
+TimeUs lastLogTime = MS_TO_US(3000);
 
 struct FlowHistory
 {
@@ -47,30 +80,144 @@ void logGPSDataFlow(float flow);
 float flowA, flowB, flowC = 0.00;
 
 // Global Objects
-WebServer server(80);
+#define HTTP_KEEPALIVE_TIMEOUT 5000 // ms an open connection may wait for its next request
+#define HTTP_KEEPALIVE_MAX 100      // Requests on one connection before it is closed
+PersistentWebServer server(80, HTTP_KEEPALIVE_TIMEOUT, HTTP_KEEPALIVE_MAX);
 RTC_DS3231 rtc;
 Adafruit_BMP085 bmp;
 TinyGPSPlus gps;
 HardwareSerial neo6m(2);
+
+// Latest fix as published by the UART receive task
+GpsFix gpsFix = {};
+
+struct UbxAck
+{
+    uint8_t msgClass;
+    uint8_t msgId;
+    bool ack;
+};
+
+// UART receive task -> loop
+SpscQueue<GpsFix, 8> gpsFixQueue;
+SpscQueue<UbxAck, 4> ubxAckQueue;
+volatile uint32_t gpsRxBytes = 0;
+
+// Sensor/GPS paths -> SD writer
+enum LogRecordType : uint8_t
+{
+    LOG_PRESSURE_EVENT,
+    LOG_FLOW_EVENT,
+    LOG_TRACK_POINT
+};
+
+struct LogRecord
+{
+    LogRecordType type;
+    uint8_t satellites;
+    uint32_t unixTime; // RTC time of the record
+    double lat;
+    double lng;
+    float value;
+};
+SpscQueue<LogRecord, 32> logQueue;
+
+// Records are kept in the time-series store (ts_store.h), one series per
+// record type. Values are fixed point in the columns below.
+#define TS_COORD_SCALE 1e6 // Latitude/longitude in micro-degrees
+#define TS_VALUE_SCALE 100 // Pressure (hPa) and flow (L/min) in hundredths
+
+enum TsColumn
+{
+    TS_COL_LAT,
+    TS_COL_LNG,
+    TS_COL_VALUE, // Pressure, flow rate or satellites
+    TS_COLUMNS
+};
+
+// Double-buffered store writes: the loop appends records to the active
+// buffer while the logger task writes the other one into the store.
+#define LOG_BUFFER_RECORDS 64    // One store block's worth per buffer
+#define LOG_FLUSH_INTERVAL 5000  // ms before a partly filled buffer is written anyway
+#define LOG_TASK_STACK 4096
+
+enum LogOverflowPolicy
+{
+    LOG_OVERFLOW_BLOCK,       // Wait for the logger task to free a buffer; stalls the loop, opt-in only
+    LOG_OVERFLOW_DROP_OLDEST, // Discard the oldest unwritten records
+    LOG_OVERFLOW_DROP_NEWEST, // Discard the incoming record
+    LOG_OVERFLOW_POLICY_COUNT
+};
+
+// One stream per series, indexed by LogRecordType
+#define LOG_STREAM_COUNT 3
+
+struct LogBuffer
+{
+    TsRecord records[LOG_BUFFER_RECORDS];
+    size_t count = 0;
+    volatile bool flushing = false; // Owned by the logger task while set
+};
+
+struct LogStream
+{
+    TsSeries series;
+    LogBuffer buffers[2];
+    int active = 0;
+    uint32_t recordsWritten = 0;
+    uint32_t recordsDropped = 0;
+    uint32_t blockedWaits = 0;
+    uint32_t flushes = 0;
+    uint32_t flushErrors = 0;
+    uint32_t maxFlushUs = 0;
+};
+
+LogStream logStreams[LOG_STREAM_COUNT];
+TaskHandle_t loggerTaskHandle = nullptr;
+SemaphoreHandle_t logBufferFreed = nullptr; // Given by the task after each flush
 void checkPressureAndLog();
 void handlePressure();
 void handleTimeTemp();
+void handleApiStatus();
+void handleApiChart();
+void handleApiGeofences();
+void loadGeofences();
+void openTileArchive();
+void handleMap();
+void handleTile();
+void handleApiTiles();
 void saveConfig();
 void handleDownloadGPSLog();
 void handleDeleteGPSLog();
 void handleDownloadGPSTrack();
 void handleDeleteGPSTrack();
+void handlePower();
+void processGPS();
+void logGPSTrackData();
+void ubxAckFeed(uint8_t c);
+void gpsReceive();
+void queueLogRecord(LogRecordType type, float value);
+void runLoggerJob();
+const char *logOverflowPolicyName(int policy);
+void setupScheduler();
+bool uploadConfigured();
+void uploadResetSeries(int type);
+bool mqttConfigured();
+void mqttApplyConfig();
+void mqttResetSeries(int type);
+void serialPrintln(const char *message);
 
 // Optimized circular buffer for serial messages
 struct LogMessage
 {
-    unsigned long timestamp;
+    TimeUs timestamp;
     char message[80]; // Fixed size message buffer
 };
 
 LogMessage serialBuffer[SERIAL_BUFFER_SIZE];
 int serialBufferIndex = 0;
 int totalMessages = 0;
+uint32_t serialMessageCount = 0; // Messages ever logged, so clients can tell the log changed
 
 // Update Config structure to use percentage threshold
 struct Config
@@ -82,11 +229,543 @@ struct Config
     float pressureThreshold = 0.2;   // Default 0.2%
     float flowThreshold = 20.0;      // Default 20%
     uint32_t trackLogInterval = 300; // Add this line
+    uint32_t sampleIntervalMin = 100;  // Fastest sensor sampling (ms)
+    uint32_t sampleIntervalMax = 2000; // Slowest sensor sampling when idle (ms)
+    uint8_t logOverflowPolicy = LOG_OVERFLOW_DROP_OLDEST; // When both log buffers are busy
+    bool uploadEnabled = false;        // Forward new records to the collector in station mode
+    uint32_t uploadInterval = 60;      // Seconds between upload rounds
+    char staSsid[32] = "";             // Network to join for uploads
+    char staPassword[64] = "";
+    char collectorUrl[96] = "";        // e.g. http://192.168.1.10:8080/ingest
+    bool mqttEnabled = false;          // Publish telemetry batches to an MQTT broker
+    uint32_t mqttBatchWindow = 10;     // Seconds of records per batch
+    uint8_t mqttQos = 1;               // 0: fire and forget, 1: replay until acknowledged
+    char mqttUri[96] = "";             // e.g. mqtt://192.168.1.10:1883
+};
+
+// Adaptive sampling: back off while the signal is flat and the vehicle is
+// parked, jump straight back to the fastest rate on a spike or movement.
+struct AdaptiveSampler
+{
+    uint32_t interval = 100; // ms
+};
+AdaptiveSampler sampler;
+
+// Motion classifier: GPS speed plus the spread of recent fixes, with separate
+// start/stop thresholds and a dwell time so depot jitter never looks like driving.
+#define MOTION_WINDOW_SIZE 10
+#define MOTION_START_SPEED_KMPH 5.0
+#define MOTION_STOP_SPEED_KMPH 2.0
+#define MOTION_SPREAD_METERS 15.0    // Allowed fix spread at HDOP 1, scaled by HDOP
+#define MOTION_MAX_HDOP 5.0          // Fixes worse than this are ignored
+#define MOTION_START_FIXES 3         // Consecutive moving fixes before MOVING
+#define MOTION_STOP_TIME 60000       // ms of still fixes before STATIONARY
+#define LOW_POWER_IDLE_TIME 300000   // ms stationary before lowering the CPU clock
+#define LOW_POWER_CPU_MHZ 80
+#define FULL_POWER_CPU_MHZ 240
+
+enum MotionState
+{
+    MOTION_UNKNOWN,
+    MOTION_STATIONARY,
+    MOTION_MOVING
+};
+
+struct MotionTracker
+{
+    double lat[MOTION_WINDOW_SIZE];
+    double lng[MOTION_WINDOW_SIZE];
+    int index = 0;
+    int count = 0;
+    MotionState state = MOTION_UNKNOWN;
+    int movingFixes = 0;
+    TimeUs stillSince = 0;
+    TimeUs stateSince = 0;
+    bool trackPointLogged = false; // Stop position already written to the track
+};
+MotionTracker motion;
+
+// Latest live values for the dashboard, left here by the jobs that sample
+// the sensors, the RTC and the GPS so /api/status never touches hardware.
+// version changes only when one of the values does.
+struct LiveStatus
+{
+    uint32_t version = 1;
+    uint32_t changedAt = 0;  // RTC time of the latest change, 0 without an RTC
+    float value = NAN;       // Latest pressure (hPa) or flow (L/min) sample
+    float average = NAN;
+    float threshold = NAN;   // Level above which the sample is logged
+    float temperature = NAN; // °C, from the status job
+    double lat = 0;
+    double lng = 0;
+    uint8_t satellites = 0;
+    bool gpsValid = false;
+    MotionState motion = MOTION_UNKNOWN;
+    uint32_t clockUnix = 0; // RTC reading and when it was taken, so the
+    TimeUs clockAt = 0;     // clock runs on without I2C reads
+};
+LiveStatus liveStatus;
+
+// History of the active sensor in RAM for charts and baselines: 1 s
+// buckets for 10 minutes, 10 s for 2 hours and 1 min for a day, 8 bytes
+// each. Change the tiers here; the budget catches a set that outgrows it.
+#define HISTORY_MEMORY_BUDGET 24576 // bytes
+#define CHART_DEFAULT_SPAN 3600     // s shown without ?span=
+#define CHART_DEFAULT_WIDTH 300     // Points served without ?width=
+#define CHART_MAX_POINTS 800        // Bounds the chart's request arena use
+constexpr HistoryTierConfig historyTiers[] = {{1, 600}, {10, 720}, {60, 1440}};
+TieredHistory<sizeof(historyTiers) / sizeof(historyTiers[0]), historyBucketCount(historyTiers)>
+    sensorHistory(historyTiers);
+static_assert(sizeof(sensorHistory) <= HISTORY_MEMORY_BUDGET, "History tiers exceed HISTORY_MEMORY_BUDGET");
+
+// Power management: DFS always, automatic light sleep while the AP is down.
+// GPS RX and flow pulses wake the chip; PM locks keep it awake while an NMEA
+// burst or a flowing meter needs the UART or the pulse ISR running.
+//
+// The Wi-Fi driver keeps the chip out of light sleep for as long as the soft
+// AP beacons, so the AP goes down after AP_IDLE_TIMEOUT without a station. It
+// comes back for AP_WAKE_WINDOW every AP_WAKE_PERIOD, and for a full
+// AP_IDLE_TIMEOUT at once when the BOOT button is pressed; the button also
+// wakes the chip from light sleep.
+#define PM_MIN_CPU_MHZ 40
+#define GPS_BURST_PERIOD_MS 1000 // Default NMEA burst rate (1 Hz fixes)
+#define GPS_BURST_PERIOD_MAX 15000
+#define GPS_BURST_GAP_MS 100     // UART quiet time that ends a burst
+#define GPS_WAKE_LEAD_MS 30      // Wake this long before the next expected burst
+#define FLOW_IDLE_TIMEOUT 30000  // ms without pulses before the flow meter may sleep
+#define AP_IDLE_TIMEOUT 600000   // ms without a station before the AP goes down
+#define AP_WAKE_PERIOD 300000    // ms the AP stays down between wake windows
+#define AP_WAKE_WINDOW 60000     // ms the AP stays up after a periodic wake
+#define AP_WAKE_PIN 0            // BOOT button, low while pressed
+
+enum PowerState
+{
+    POWER_ACTIVE,
+    POWER_IDLE,        // Waiting for work, light sleep not allowed
+    POWER_LIGHT_SLEEP, // Waiting for work with automatic light sleep enabled
+    POWER_STATE_COUNT
+};
+
+struct PowerManager
+{
+    bool pmSupported = false;
+    bool lightSleepAllowed = false;
+    bool lowPower = false; // Clock capped at LOW_POWER_CPU_MHZ
+    bool apUp = false;
+    volatile bool apActivity = false; // Button or station seen, restarts the idle timeout
+    TimeUs apIdleSince = 0;
+    TimeUs apIdleLimit = MS_TO_US(AP_IDLE_TIMEOUT);
+    esp_pm_lock_handle_t gpsLock = nullptr;
+    esp_pm_lock_handle_t flowLock = nullptr;
+    bool gpsLockHeld = false;
+    bool flowLockHeld = false;
+    TimeUs gpsBurstStart = 0;
+    TimeUs gpsBurstPeriod = MS_TO_US(GPS_BURST_PERIOD_MS); // Follows GPS power-save update rate
+    TimeUs lastGpsData = 0;
+    TimeUs lastFlowPulse = 0;
+    PowerState state = POWER_ACTIVE;
+    TimeUs stateStart = 0;
+    uint64_t timeInState[POWER_STATE_COUNT] = {};
+};
+PowerManager power;
+volatile bool flowWakeArmed = false;
+portMUX_TYPE flowWakeMux = portMUX_INITIALIZER_UNLOCKED;
+
+void powerEnterState(PowerState state);
+PowerState powerIdleState();
+
+// Cooperative scheduler: a hashed timer wheel of periodic and one-shot jobs.
+// loop() runs whatever is due and then blocks until the next deadline or
+// until an event (GPS UART data, Wi-Fi client) wakes the task.
+#define SCHEDULER_MAX_JOBS 20
+#define WHEEL_SLOTS 64
+#define WHEEL_TICK_MS 10
+#define HTTP_POLL_ACTIVE 5    // ms between handleClient() calls with clients attached
+#define HTTP_POLL_IDLE 250    // ms between handleClient() calls with nobody connected
+#define GPS_POLL_INTERVAL 250 // ms, also the buzzer pattern resolution
+#define STATUS_UPDATE_INTERVAL 10000
+
+#define JOB_NOT_ARMED UINT64_MAX // firstDelay for jobs armed later
+
+typedef void (*JobCallback)();
+
+struct SchedulerJob
+{
+    JobCallback callback;
+    TimeUs period;   // 0 for one-shot jobs
+    TimeUs deadline; // nowUs() when due
+    int8_t next;     // Next job in the same wheel slot, -1 ends the list
+    bool armed;
+};
+
+struct Scheduler
+{
+    SchedulerJob jobs[SCHEDULER_MAX_JOBS];
+    int jobCount = 0;
+    int8_t slots[WHEEL_SLOTS];
+    uint64_t currentTick = 0;
+    volatile uint32_t pendingEvents = 0; // Bit per job id, set from other contexts
+    TaskHandle_t task = nullptr;
 };
+Scheduler scheduler;
+
+int jobHttp = -1;
+int jobGps = -1;
+int jobSample = -1;
+int jobTrackLog = -1;
+int jobStatus = -1;
+int jobGpsQuiet = -1;
+int jobGpsWake = -1;
+int jobGpsPower = -1;
+int jobGpsWakeup = -1;
+int jobLogger = -1;
+int jobLogFlush = -1;
+int jobUpload = -1;
+int jobMqtt = -1;
+int jobBuzzerOff = -1;
+int jobAp = -1;
+
+static inline int wheelSlot(TimeUs time)
+{
+    return (time / MS_TO_US(WHEEL_TICK_MS)) % WHEEL_SLOTS;
+}
+
+void schedulerInit()
+{
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        scheduler.slots[i] = -1;
+    scheduler.currentTick = nowUs() / MS_TO_US(WHEEL_TICK_MS);
+    scheduler.task = xTaskGetCurrentTaskHandle();
+}
+
+static void schedulerUnlink(int id)
+{
+    SchedulerJob &job = scheduler.jobs[id];
+    if (!job.armed)
+        return;
+
+    int8_t *link = &scheduler.slots[wheelSlot(job.deadline)];
+    while (*link != -1 && *link != id)
+        link = &scheduler.jobs[*link].next;
+    if (*link == id)
+        *link = job.next;
+    job.armed = false;
+}
+
+static void schedulerInsert(int id, TimeUs deadline)
+{
+    SchedulerJob &job = scheduler.jobs[id];
+    int slot = wheelSlot(deadline);
+    job.deadline = deadline;
+    job.next = scheduler.slots[slot];
+    job.armed = true;
+    scheduler.slots[slot] = id;
+}
+
+// Arm (or re-arm) a job to fire once after delay
+void schedulerArm(int id, TimeUs delay)
+{
+    if (id < 0)
+        return;
+    schedulerUnlink(id);
+    schedulerInsert(id, nowUs() + delay);
+}
+
+// Change the period of a repeating job and restart its timer
+void schedulerSetPeriod(int id, TimeUs period)
+{
+    if (id < 0)
+        return;
+    scheduler.jobs[id].period = period;
+    schedulerArm(id, period);
+}
+
+int schedulerAddJob(JobCallback callback, TimeUs period, TimeUs firstDelay)
+{
+    if (scheduler.jobCount >= SCHEDULER_MAX_JOBS)
+    {
+        serialPrintln("Scheduler job table full");
+        return -1;
+    }
+    int id = scheduler.jobCount++;
+    scheduler.jobs[id].callback = callback;
+    scheduler.jobs[id].period = period;
+    scheduler.jobs[id].armed = false;
+    if (firstDelay != JOB_NOT_ARMED)
+        schedulerArm(id, firstDelay);
+    return id;
+}
+
+// Run a job as soon as possible; safe to call from other tasks
+void schedulerTrigger(int id)
+{
+    if (id < 0)
+        return;
+    __atomic_fetch_or(&scheduler.pendingEvents, 1UL << id, __ATOMIC_RELEASE);
+    if (scheduler.task)
+        xTaskNotifyGive(scheduler.task);
+}
+
+// Interrupts attached before setupScheduler() can get here early: without a
+// job or a task to wake, the event is dropped
+void IRAM_ATTR schedulerTriggerFromISR(int id)
+{
+    if (id < 0 || !scheduler.task)
+        return;
+    __atomic_fetch_or(&scheduler.pendingEvents, 1UL << id, __ATOMIC_RELEASE);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(scheduler.task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void schedulerExpireSlot(int slot, TimeUs now)
+{
+    // Detach the due jobs first so callbacks can re-arm into this slot
+    int8_t due[SCHEDULER_MAX_JOBS];
+    int dueCount = 0;
+    int8_t *link = &scheduler.slots[slot];
+    while (*link != -1)
+    {
+        SchedulerJob &job = scheduler.jobs[*link];
+        if (job.deadline <= now)
+        {
+            due[dueCount++] = *link;
+            job.armed = false;
+            *link = job.next;
+        }
+        else
+        {
+            link = &job.next;
+        }
+    }
+
+    for (int i = 0; i < dueCount; i++)
+    {
+        SchedulerJob &job = scheduler.jobs[due[i]];
+        TimeUs deadline = job.deadline;
+        job.callback();
+
+        // Periodic jobs keep their phase unless they fell a whole period behind
+        if (job.period > 0 && !job.armed)
+        {
+            TimeUs nextDeadline = deadline + job.period;
+            if (nextDeadline <= now)
+                nextDeadline = now + job.period;
+            schedulerInsert(due[i], nextDeadline);
+        }
+    }
+}
+
+void schedulerRunDue()
+{
+    uint32_t events = __atomic_exchange_n(&scheduler.pendingEvents, 0, __ATOMIC_ACQUIRE);
+    for (int id = 0; events != 0; id++, events >>= 1)
+    {
+        if (events & 1)
+            scheduler.jobs[id].callback();
+    }
+
+    TimeUs now = nowUs();
+    uint64_t nowTick = now / MS_TO_US(WHEEL_TICK_MS);
+    uint64_t ticks = min(nowTick - scheduler.currentTick, (uint64_t)WHEEL_SLOTS - 1);
+    for (uint64_t i = 0; i <= ticks; i++)
+        schedulerExpireSlot((scheduler.currentTick + i) % WHEEL_SLOTS, now);
+    scheduler.currentTick = nowTick;
+}
+
+// Time until the earliest armed deadline, capped at one wheel turn
+TimeUs schedulerTimeUntilNext()
+{
+    const TimeUs horizon = MS_TO_US(WHEEL_SLOTS * WHEEL_TICK_MS);
+    TimeUs now = nowUs();
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+    {
+        TimeUs best = horizon;
+        for (int8_t id = scheduler.slots[(scheduler.currentTick + i) % WHEEL_SLOTS]; id != -1;
+             id = scheduler.jobs[id].next)
+        {
+            TimeUs deadline = scheduler.jobs[id].deadline;
+            if (deadline < now + horizon)
+                best = min(best, deadline > now ? deadline - now : 0);
+        }
+        if (best < horizon)
+            return best;
+    }
+    return horizon;
+}
+
+// Block the loop task until the next deadline or an event notification
+void schedulerSleep()
+{
+    TimeUs wait = schedulerTimeUntilNext();
+    if (wait > 0 && scheduler.pendingEvents == 0)
+    {
+        // Round up so we never wake a tick early and spin
+        TickType_t ticks = (wait + MS_TO_US(portTICK_PERIOD_MS) - 1) / MS_TO_US(portTICK_PERIOD_MS);
+        powerEnterState(powerIdleState());
+        ulTaskNotifyTake(pdTRUE, ticks);
+        powerEnterState(POWER_ACTIVE);
+    }
+}
+
+void powerApplyConfig()
+{
+    if (!power.pmSupported)
+    {
+        setCpuFrequencyMhz(power.lowPower ? LOW_POWER_CPU_MHZ : FULL_POWER_CPU_MHZ);
+        return;
+    }
+
+    esp_pm_config_esp32_t pm;
+    pm.max_freq_mhz = power.lowPower ? LOW_POWER_CPU_MHZ : FULL_POWER_CPU_MHZ;
+    pm.min_freq_mhz = PM_MIN_CPU_MHZ;
+    pm.light_sleep_enable = power.lightSleepAllowed;
+    esp_pm_configure(&pm);
+}
+
+void powerInit()
+{
+    esp_pm_config_esp32_t pm;
+    pm.max_freq_mhz = FULL_POWER_CPU_MHZ;
+    pm.min_freq_mhz = PM_MIN_CPU_MHZ;
+    pm.light_sleep_enable = false;
+    power.pmSupported = esp_pm_configure(&pm) == ESP_OK;
+    power.stateStart = nowUs();
+
+    if (!power.pmSupported)
+    {
+        serialPrintln("Power management not available in this build");
+        return;
+    }
+
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "gps", &power.gpsLock);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "flow", &power.flowLock);
+
+    // A UART start bit pulls RX low, which is enough to wake from light sleep
+    gpio_wakeup_enable((gpio_num_t)RXD2, GPIO_INTR_LOW_LEVEL);
+    gpio_wakeup_enable((gpio_num_t)AP_WAKE_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    serialPrintln("Power management enabled");
+}
+
+void powerEnterState(PowerState state)
+{
+    TimeUs now = nowUs();
+    power.timeInState[power.state] += now - power.stateStart;
+    power.stateStart = now;
+    power.state = state;
+}
+
+PowerState powerIdleState()
+{
+    bool sleepable = power.pmSupported && power.lightSleepAllowed &&
+                     !power.gpsLockHeld && !power.flowLockHeld;
+    return sleepable ? POWER_LIGHT_SLEEP : POWER_IDLE;
+}
+
+void powerSetLock(esp_pm_lock_handle_t lock, bool &held, bool hold)
+{
+    if (held == hold || lock == nullptr)
+        return;
+    if (hold)
+        esp_pm_lock_acquire(lock);
+    else
+        esp_pm_lock_release(lock);
+    held = hold;
+}
+
+// Light sleep only while the AP is down, which also means nobody is on it
+void powerUpdateClients()
+{
+    bool allowed = !power.apUp;
+    if (allowed == power.lightSleepAllowed)
+        return;
+    power.lightSleepAllowed = allowed;
+    powerApplyConfig();
+}
+
+void powerSetLowPower(bool lowPower)
+{
+    if (power.lowPower == lowPower)
+        return;
+    power.lowPower = lowPower;
+    powerApplyConfig();
+    schedulerArm(jobGpsPower, 0);
+    serialPrintln(lowPower ? "Entering low-power mode" : "Leaving low-power mode");
+}
+
+// NMEA bytes arrived: stay awake until the burst goes quiet
+void powerGpsData()
+{
+    TimeUs now = nowUs();
+    if (now - power.lastGpsData > MS_TO_US(GPS_BURST_GAP_MS))
+    {
+        TimeUs period = now - power.gpsBurstStart;
+        if (period >= MS_TO_US(GPS_BURST_PERIOD_MS / 2) && period <= MS_TO_US(GPS_BURST_PERIOD_MAX))
+            power.gpsBurstPeriod = period;
+        power.gpsBurstStart = now;
+    }
+    power.lastGpsData = now;
+    powerSetLock(power.gpsLock, power.gpsLockHeld, true);
+    schedulerArm(jobGpsQuiet, MS_TO_US(GPS_BURST_GAP_MS));
+}
+
+// Burst finished: allow sleep and come back just before the next one, since
+// the bytes received while waking from light sleep are lost
+void runGpsQuietJob()
+{
+    if (nowUs() - power.lastGpsData < MS_TO_US(GPS_BURST_GAP_MS))
+    {
+        schedulerArm(jobGpsQuiet, MS_TO_US(GPS_BURST_GAP_MS));
+        return;
+    }
+    powerSetLock(power.gpsLock, power.gpsLockHeld, false);
+
+    TimeUs wakeAt = power.gpsBurstStart + power.gpsBurstPeriod - MS_TO_US(GPS_WAKE_LEAD_MS);
+    TimeUs now = nowUs();
+    if (wakeAt > now && wakeAt - now < power.gpsBurstPeriod)
+        schedulerArm(jobGpsWake, wakeAt - now);
+}
+
+void runGpsWakeJob()
+{
+    powerSetLock(power.gpsLock, power.gpsLockHeld, true);
+    schedulerArm(jobGpsQuiet, MS_TO_US(GPS_WAKE_LEAD_MS + GPS_BURST_GAP_MS));
+}
+
+// The pulse ISR cannot run in light sleep, so a flowing meter holds a lock.
+// Once idle, the pin is set to wake on the level opposite its resting state
+// and the ISR restores edge triggering on the first pulse.
+void powerUpdateFlow(bool pulsesSeen)
+{
+    if (pulsesSeen)
+    {
+        power.lastFlowPulse = nowUs();
+        powerSetLock(power.flowLock, power.flowLockHeld, true);
+        return;
+    }
+    if (!power.pmSupported || flowWakeArmed ||
+        nowUs() - power.lastFlowPulse < MS_TO_US(FLOW_IDLE_TIMEOUT))
+        return;
+
+    portENTER_CRITICAL(&flowWakeMux);
+    gpio_wakeup_enable((gpio_num_t)FLOW_SENSOR_PIN,
+                       digitalRead(FLOW_SENSOR_PIN) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    flowWakeArmed = true;
+    portEXIT_CRITICAL(&flowWakeMux);
+    powerSetLock(power.flowLock, power.flowLockHeld, false);
+}
 
 void IRAM_ATTR pulseCounter()
 {
-    pulseCount++;
+    pulseQueue.push((TimeUs)esp_timer_get_time());
+    if (flowWakeArmed)
+    {
+        flowWakeArmed = false;
+        gpio_ll_wakeup_disable(&GPIO, (gpio_num_t)FLOW_SENSOR_PIN);
+        gpio_ll_set_intr_type(&GPIO, (gpio_num_t)FLOW_SENSOR_PIN, GPIO_INTR_NEGEDGE);
+        schedulerTriggerFromISR(jobSample);
+    }
 }
 
 Config currentConfig;
@@ -119,6 +798,47 @@ float calculateAveragePressure()
     return sum / pressureHistory.count;
 }
 
+// Spread of the history window as a percentage of its mean
+float calculateVariation(const float *readings, int count)
+{
+    if (count < 2)
+        return 0;
+
+    float sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += readings[i];
+    float mean = sum / count;
+    if (mean == 0)
+        return 0;
+
+    float sq = 0;
+    for (int i = 0; i < count; i++)
+        sq += (readings[i] - mean) * (readings[i] - mean);
+    return sqrt(sq / count) / fabs(mean) * 100.0;
+}
+
+bool vehicleIsMoving();
+const char *motionStateName(MotionState state);
+
+// Drop to the fastest rate when the signal moves by more than half the event
+// threshold (or the vehicle moves), otherwise stretch the interval by 50%.
+void adaptSampleInterval(float value, float average, float variation, float thresholdPercent)
+{
+    float deviation = average != 0 ? fabs(value - average) / fabs(average) * 100.0 : 0;
+    bool active = deviation > thresholdPercent / 2 || variation > thresholdPercent / 4;
+
+    if (active || vehicleIsMoving())
+    {
+        sampler.interval = currentConfig.sampleIntervalMin;
+    }
+    else
+    {
+        sampler.interval += sampler.interval / 2;
+        if (sampler.interval > currentConfig.sampleIntervalMax)
+            sampler.interval = currentConfig.sampleIntervalMax;
+    }
+}
+
 void loadConfig(); // Forward declaration
 
 // Serial logging function
@@ -127,13 +847,71 @@ void serialPrintln(const char *message)
     Serial.println(message);
 
     // Store in buffer
-    serialBuffer[serialBufferIndex].timestamp = millis();
+    serialBuffer[serialBufferIndex].timestamp = nowUs();
     strncpy(serialBuffer[serialBufferIndex].message, message, sizeof(serialBuffer[0].message) - 1);
     serialBuffer[serialBufferIndex].message[sizeof(serialBuffer[0].message) - 1] = '\0';
 
     serialBufferIndex = (serialBufferIndex + 1) % SERIAL_BUFFER_SIZE;
     if (totalMessages < SERIAL_BUFFER_SIZE)
         totalMessages++;
+    serialMessageCount++;
+}
+
+// Live status snapshot
+uint32_t liveStatusClock()
+{
+    if (!liveStatus.clockUnix)
+        return 0;
+    return liveStatus.clockUnix + (nowUs() - liveStatus.clockAt) / 1000000;
+}
+
+// Re-read the RTC: at boot, after it is set and with every status report
+void liveStatusSyncClock()
+{
+    if (!rtcInitialized)
+        return;
+    liveStatus.clockUnix = rtc.now().unixtime();
+    liveStatus.clockAt = nowUs();
+}
+
+void liveStatusChanged()
+{
+    liveStatus.version++;
+    liveStatus.changedAt = liveStatusClock();
+}
+
+void liveStatusSetReading(float value, float average, float threshold)
+{
+    if (value == liveStatus.value && average == liveStatus.average && threshold == liveStatus.threshold)
+        return;
+    liveStatus.value = value;
+    liveStatus.average = average;
+    liveStatus.threshold = threshold;
+    liveStatusChanged();
+}
+
+void liveStatusSetTemperature(float temperature)
+{
+    if (temperature == liveStatus.temperature)
+        return;
+    liveStatus.temperature = temperature;
+    liveStatusChanged();
+}
+
+// Copy the latest fix and motion state
+void liveStatusSetPosition()
+{
+    if (gpsFix.valid == liveStatus.gpsValid && gpsFix.lat == liveStatus.lat && gpsFix.lng == liveStatus.lng &&
+        gpsFix.satellites == liveStatus.satellites && motion.state == liveStatus.motion)
+    {
+        return;
+    }
+    liveStatus.gpsValid = gpsFix.valid;
+    liveStatus.lat = gpsFix.lat;
+    liveStatus.lng = gpsFix.lng;
+    liveStatus.satellites = gpsFix.satellites;
+    liveStatus.motion = motion.state;
+    liveStatusChanged();
 }
 
 // Initialization functions
@@ -154,6 +932,7 @@ void initRTC()
             rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
         }
         serialPrintln("RTC initialized successfully");
+        liveStatusSyncClock();
     }
 }
 
@@ -175,6 +954,7 @@ void initBMP()
     {
         bmpInitialized = true;
         serialPrintln("BMP180 initialized successfully");
+        liveStatusSetTemperature(bmp.readTemperature());
     }
 }
 
@@ -197,6 +977,8 @@ void initSDCard()
     }
 
     loadConfig();
+    loadGeofences();
+    openTileArchive();
     serialPrintln("SD Card initialized successfully");
 }
 
@@ -222,6 +1004,21 @@ void loadConfig()
     String currentSensor = configFile.readStringUntil('\n');
     float pressureThreshold = configFile.parseFloat();
     float flowThreshold = configFile.parseFloat();
+    uint32_t trackLogInterval = configFile.parseInt();
+    uint32_t sampleIntervalMin = configFile.parseInt();
+    uint32_t sampleIntervalMax = configFile.parseInt();
+    long logOverflowPolicy = configFile.parseInt();
+    long uploadEnabled = configFile.parseInt();
+    uint32_t uploadInterval = configFile.parseInt();
+    configFile.readStringUntil('\n'); // Rest of the last numeric line
+    String staSsid = configFile.readStringUntil('\n');
+    String staPassword = configFile.readStringUntil('\n');
+    String collectorUrl = configFile.readStringUntil('\n');
+    long mqttEnabled = configFile.parseInt();
+    uint32_t mqttBatchWindow = configFile.parseInt();
+    long mqttQos = configFile.parseInt();
+    configFile.readStringUntil('\n');
+    String mqttUri = configFile.readStringUntil('\n');
 
     // Clear any remaining newline characters
     while (configFile.available())
@@ -232,19 +1029,43 @@ void loadConfig()
     password.trim();
     deviceName.trim();
     currentSensor.trim();
+    staSsid.trim();
+    staPassword.trim();
+    collectorUrl.trim();
+    mqttUri.trim();
 
     ssid.toCharArray(currentConfig.ssid, sizeof(currentConfig.ssid));
     password.toCharArray(currentConfig.password, sizeof(currentConfig.password));
     deviceName.toCharArray(currentConfig.deviceName, sizeof(currentConfig.deviceName));
     currentSensor.toCharArray(currentConfig.currentSensor, sizeof(currentConfig.currentSensor));
-    currentConfig.trackLogInterval = configFile.parseInt();
+    staSsid.toCharArray(currentConfig.staSsid, sizeof(currentConfig.staSsid));
+    staPassword.toCharArray(currentConfig.staPassword, sizeof(currentConfig.staPassword));
+    collectorUrl.toCharArray(currentConfig.collectorUrl, sizeof(currentConfig.collectorUrl));
+    currentConfig.uploadEnabled = uploadEnabled == 1;
+    mqttUri.toCharArray(currentConfig.mqttUri, sizeof(currentConfig.mqttUri));
+    currentConfig.mqttEnabled = mqttEnabled == 1;
+    if (mqttBatchWindow > 0)
+        currentConfig.mqttBatchWindow = mqttBatchWindow;
+    if (mqttQos == 0 || mqttQos == 1)
+        currentConfig.mqttQos = mqttQos;
+    currentConfig.trackLogInterval = trackLogInterval;
 
     if (currentConfig.trackLogInterval == 0)
         currentConfig.trackLogInterval = 300;
+    if (sampleIntervalMin > 0)
+        currentConfig.sampleIntervalMin = sampleIntervalMin;
+    if (sampleIntervalMax > 0)
+        currentConfig.sampleIntervalMax = sampleIntervalMax;
+    if (currentConfig.sampleIntervalMax < currentConfig.sampleIntervalMin)
+        currentConfig.sampleIntervalMax = currentConfig.sampleIntervalMin;
     if (pressureThreshold > 0)
         currentConfig.pressureThreshold = pressureThreshold;
     if (flowThreshold > 0)
         currentConfig.flowThreshold = flowThreshold;
+    if (logOverflowPolicy >= 0 && logOverflowPolicy < LOG_OVERFLOW_POLICY_COUNT)
+        currentConfig.logOverflowPolicy = logOverflowPolicy;
+    if (uploadInterval > 0)
+        currentConfig.uploadInterval = uploadInterval;
 
     configFile.close();
     serialPrintln("Configuration loaded from SD card");
@@ -266,6 +1087,18 @@ void saveConfig()
     configFile.println(currentConfig.pressureThreshold);
     configFile.println(currentConfig.flowThreshold);
     configFile.println(currentConfig.trackLogInterval);
+    configFile.println(currentConfig.sampleIntervalMin);
+    configFile.println(currentConfig.sampleIntervalMax);
+    configFile.println(currentConfig.logOverflowPolicy);
+    configFile.println(currentConfig.uploadEnabled ? 1 : 0);
+    configFile.println(currentConfig.uploadInterval);
+    configFile.println(currentConfig.staSsid);
+    configFile.println(currentConfig.staPassword);
+    configFile.println(currentConfig.collectorUrl);
+    configFile.println(currentConfig.mqttEnabled ? 1 : 0);
+    configFile.println(currentConfig.mqttBatchWindow);
+    configFile.println(currentConfig.mqttQos);
+    configFile.println(currentConfig.mqttUri);
 
     configFile.close();
     serialPrintln("Configuration saved to SD card");
@@ -273,79 +1106,154 @@ void saveConfig()
 
 void setupWiFi()
 {
+    // Station mode is added only for uploads and MQTT
+    if (uploadConfigured() || mqttConfigured())
+    {
+        WiFi.mode(WIFI_AP_STA);
+        WiFi.setAutoReconnect(true);
+        if (WiFi.status() != WL_CONNECTED)
+            WiFi.begin(currentConfig.staSsid, currentConfig.staPassword);
+    }
+    else
+    {
+        WiFi.mode(WIFI_AP);
+    }
+
     WiFi.softAP(currentConfig.ssid, currentConfig.password);
     IPAddress IP = WiFi.softAPIP();
     char ipMsg[50];
     snprintf(ipMsg, sizeof(ipMsg), "AP IP address: %d.%d.%d.%d", IP[0], IP[1], IP[2], IP[3]);
     serialPrintln(ipMsg);
+
+    power.apUp = true;
+    power.apIdleSince = nowUs();
+    powerUpdateClients();
 }
 
-void logGPSTrackData()
+// Take the AP down so light sleep can engage; the station link stays if
+// uploads or MQTT need it
+void stopAccessPoint()
 {
-    if (!sdCardAvailable || !gps.location.isValid())
-        return;
-
-    DateTime now = rtc.now();
-    bool newFile = !SD.exists("/gps_track.csv");
-    File file = SD.open("/gps_track.csv", FILE_APPEND);
-    if (file) {
-        if (newFile) {
-            file.println("Date,Time,Latitude,Longitude,Satellites");
-        }
-        file.printf("%02d/%02d/%04d,%02d:%02d:%02d,%.6f,%.6f,%d\n",
-                    now.day(), now.month(), now.year(),
-                    now.hour(), now.minute(), now.second(),
-                    gps.location.lat(), gps.location.lng(),
-                    gps.satellites.value());
-        file.close();
-    }
+    WiFi.softAPdisconnect(true);
+    WiFi.mode(uploadConfigured() || mqttConfigured() ? WIFI_STA : WIFI_OFF);
+    power.apUp = false;
+    powerUpdateClients();
+    serialPrintln("AP down, no station connected");
 }
 
-// Web handlers
-void handleSerial()
+void IRAM_ATTR apWakeButton()
 {
-    String logs;
-    logs.reserve(SERIAL_BUFFER_SIZE * 100); // Pre-allocate space
+    power.apActivity = true;
+    schedulerTriggerFromISR(jobAp);
+}
 
-    int start = (serialBufferIndex - totalMessages + SERIAL_BUFFER_SIZE) % SERIAL_BUFFER_SIZE;
-    for (int i = 0; i < totalMessages; i++)
+// Bring the AP down once idle and up again at the end of each wake period
+void runApJob()
+{
+    bool activity = power.apActivity;
+    power.apActivity = false;
+    if (!power.apUp)
+    {
+        setupWiFi();
+        power.apIdleLimit = MS_TO_US(activity ? AP_IDLE_TIMEOUT : AP_WAKE_WINDOW);
+        schedulerArm(jobAp, power.apIdleLimit);
+        return;
+    }
+
+    TimeUs now = nowUs();
+    if (activity || WiFi.softAPgetStationNum() > 0)
+    {
+        power.apIdleSince = now;
+        power.apIdleLimit = MS_TO_US(AP_IDLE_TIMEOUT);
+    }
+    if (now - power.apIdleSince < power.apIdleLimit)
+    {
+        schedulerArm(jobAp, power.apIdleLimit - (now - power.apIdleSince));
+        return;
+    }
+    stopAccessPoint();
+    schedulerArm(jobAp, MS_TO_US(AP_WAKE_PERIOD));
+}
+
+void logGPSTrackData()
+{
+    if (!sdCardAvailable || !gpsFix.valid)
+        return;
+
+    // A parked vehicle only gets its stop position written once
+    if (motion.state == MOTION_STATIONARY && motion.trackPointLogged)
+        return;
+    motion.trackPointLogged = motion.state == MOTION_STATIONARY;
+
+    queueLogRecord(LOG_TRACK_POINT, 0);
+}
+
+// Reply bodies are built in one arena reserved at boot and released in a
+// single step once the response is out (heapTracedRequest), so page
+// traffic neither fragments the heap nor depends on what is left of it
+#define REQUEST_ARENA_SIZE 24576
+
+uint8_t requestArenaBlock[REQUEST_ARENA_SIZE];
+Arena requestArena(requestArenaBlock, sizeof(requestArenaBlock));
+
+void sendArena(int code, const char *contentType, const ArenaString &body)
+{
+    if (!body.ok())
+    {
+        server.send(500, "text/plain", "Response too large");
+        return;
+    }
+    server.send_P(code, contentType, body.c_str(), body.length());
+}
+
+// Web handlers
+void handleSerial()
+{
+    ArenaString logs(requestArena, SERIAL_BUFFER_SIZE * 100);
+
+    int start = (serialBufferIndex - totalMessages + SERIAL_BUFFER_SIZE) % SERIAL_BUFFER_SIZE;
+    for (int i = 0; i < totalMessages; i++)
     {
         int index = (start + i) % SERIAL_BUFFER_SIZE;
-        logs += String(serialBuffer[index].timestamp);
-        logs += ": ";
-        logs += serialBuffer[index].message;
-        logs += "\n";
+        logs.appendf("%llu: %s\n", (unsigned long long)(serialBuffer[index].timestamp / 1000),
+                     serialBuffer[index].message);
     }
 
-    server.send(200, "text/plain", logs);
+    sendArena(200, "text/plain", logs);
 }
 
-String getFileList()
+void writeFileList(PageWriter &out)
 {
     if (!sdCardAvailable)
-        return "<p>SD Card not available</p>";
+    {
+        out.print("<p>SD Card not available</p>");
+        return;
+    }
 
-    String html;
-    html.reserve(1024); // Pre-allocate space
-    html = "<h2>SD Card Files</h2><table>";
-    html += "<tr><th>File Name</th><th>Size</th><th>Actions</th></tr>";
+    out.print("<h2>SD Card Files</h2><table>");
+    out.print("<tr><th>File Name</th><th>Size</th><th>Actions</th></tr>");
 
     File root = SD.open("/");
     while (File file = root.openNextFile())
     {
-        String fileName = String(file.name());
-        html += "<tr><td>" + fileName + "</td>";
-        html += "<td>" + String(file.size()) + " bytes</td>";
-        html += "<td>";
-        html += "<a href='/download?file=" + fileName + "'>Download</a> | ";
-        html += "<a href='/delete?file=" + fileName + "' onclick='return confirm(\"Delete " + fileName + "?\")'>Delete</a>";
-        html += "</td></tr>";
+        const char *fileName = file.name();
+        out.print("<tr><td>");
+        out.printEscaped(fileName);
+        out.printf("</td><td>%u bytes</td><td>", (unsigned)file.size());
+        out.print("<a href='/download?file=");
+        out.printEscaped(fileName);
+        out.print("'>Download</a> | ");
+        out.print("<a href='/delete?file=");
+        out.printEscaped(fileName);
+        out.print("' onclick='return confirm(\"Delete ");
+        out.printEscaped(fileName);
+        out.print("?\")'>Delete</a>");
+        out.print("</td></tr>");
         file.close();
     }
     root.close();
 
-    html += "</table>";
-    return html;
+    out.print("</table>");
 }
 
 void handleDownload()
@@ -364,16 +1272,21 @@ void handleDownload()
         return;
     }
 
-    server.sendHeader("Content-Type", "application/octet-stream");
+    // With the length up front the connection can stay open afterwards
     server.sendHeader("Content-Disposition", "attachment; filename=" + fileName);
-    server.sendHeader("Connection", "close");
+    server.setContentLength(file.size());
+    server.send(200, "application/octet-stream", "");
 
     uint8_t buf[1024];
     size_t bytesRead;
+    size_t sent = 0;
     while ((bytesRead = file.read(buf, sizeof(buf))) > 0)
     {
         server.sendContent((char *)buf, bytesRead);
+        sent += bytesRead;
     }
+    if (sent < file.size())
+        server.closeAfterResponse(); // Card read failed part way
 
     file.close();
 }
@@ -396,12 +1309,29 @@ void handleConfig()
 {
     if (server.method() == HTTP_POST)
     {
-        // Handle sensor configuration
+        // Handle sensor configuration; the chart history holds the old
+        // sensor's unit, so a switch starts it over
+        if (server.arg("sensorType") != currentConfig.currentSensor)
+            sensorHistory.reset();
         server.arg("sensorType").toCharArray(currentConfig.currentSensor, sizeof(currentConfig.currentSensor));
 
         currentConfig.pressureThreshold = server.arg("pressureThreshold").toFloat();
         currentConfig.flowThreshold = server.arg("flowThreshold").toFloat();
-        currentConfig.trackLogInterval = server.arg("trackLogInterval").toInt();
+        long trackLogInterval = server.arg("trackLogInterval").toInt();
+        currentConfig.trackLogInterval = trackLogInterval > 0 ? trackLogInterval : 300;
+        if (server.arg("sampleIntervalMin").toInt() > 0)
+            currentConfig.sampleIntervalMin = server.arg("sampleIntervalMin").toInt();
+        if (server.arg("sampleIntervalMax").toInt() > 0)
+            currentConfig.sampleIntervalMax = server.arg("sampleIntervalMax").toInt();
+        if (currentConfig.sampleIntervalMax < currentConfig.sampleIntervalMin)
+            currentConfig.sampleIntervalMax = currentConfig.sampleIntervalMin;
+        long overflowPolicy = server.arg("logOverflowPolicy").toInt();
+        if (overflowPolicy >= 0 && overflowPolicy < LOG_OVERFLOW_POLICY_COUNT)
+            currentConfig.logOverflowPolicy = overflowPolicy;
+        sampler.interval = currentConfig.sampleIntervalMin;
+        schedulerArm(jobSample, MS_TO_US(sampler.interval));
+        schedulerSetPeriod(jobTrackLog, SEC_TO_US(currentConfig.trackLogInterval));
+        schedulerArm(jobGpsPower, 0);
 
         // Handle other parameters
         strncpy(currentConfig.ssid, server.arg("ssid").c_str(), sizeof(currentConfig.ssid));
@@ -413,8 +1343,29 @@ void handleConfig()
         strncpy(currentConfig.deviceName, server.arg("deviceName").c_str(),
                 sizeof(currentConfig.deviceName));
 
+        currentConfig.uploadEnabled = server.hasArg("uploadEnabled");
+        if (server.arg("uploadInterval").toInt() > 0)
+            currentConfig.uploadInterval = server.arg("uploadInterval").toInt();
+        strncpy(currentConfig.staSsid, server.arg("staSsid").c_str(), sizeof(currentConfig.staSsid) - 1);
+        if (server.arg("staPassword").length() > 0)
+        {
+            strncpy(currentConfig.staPassword, server.arg("staPassword").c_str(),
+                    sizeof(currentConfig.staPassword) - 1);
+        }
+        strncpy(currentConfig.collectorUrl, server.arg("collectorUrl").c_str(),
+                sizeof(currentConfig.collectorUrl) - 1);
+        schedulerSetPeriod(jobUpload, SEC_TO_US(currentConfig.uploadInterval));
+
+        currentConfig.mqttEnabled = server.hasArg("mqttEnabled");
+        if (server.arg("mqttBatchWindow").toInt() > 0)
+            currentConfig.mqttBatchWindow = server.arg("mqttBatchWindow").toInt();
+        currentConfig.mqttQos = server.arg("mqttQos").toInt() == 0 ? 0 : 1;
+        strncpy(currentConfig.mqttUri, server.arg("mqttUri").c_str(), sizeof(currentConfig.mqttUri) - 1);
+        schedulerSetPeriod(jobMqtt, SEC_TO_US(currentConfig.mqttBatchWindow));
+
         saveConfig(); // Save to SD card
         setupWiFi();  // Restart AP with new config
+        mqttApplyConfig();
 
         server.sendHeader("Location", "/");
         server.send(303);
@@ -435,6 +1386,7 @@ void handleDateTime()
 
         DateTime newDateTime(year, month, day, hour, minute, 0);
         rtc.adjust(newDateTime);
+        liveStatusSyncClock();
 
         char timeMsg[50];
         snprintf(timeMsg, sizeof(timeMsg), "Time updated to: %04d-%02d-%02d %02d:%02d:00",
@@ -446,524 +1398,3089 @@ void handleDateTime()
     server.send(303);
 }
 
-void handleRoot()
-{
-    String html;
-    html.reserve(4096);
+// Status page template. Static markup is compiled into flash as literal
+// chunks; fillRootPage() writes the {{placeholders}}, which must match
+// rootPageSlots (the build fails otherwise) and RootPageSlot, in order.
+#define PAGE_WRITE_BUFFER 1024 // Stack buffer between the page and the socket
 
+constexpr char rootPageText[] =
     // HTML Start and Head
-    html = "<!DOCTYPE html><html><head>";
-    html += "<meta charset='utf-8'>";
-    html += "<title>Aspol Tracker</title>";
+    "<!DOCTYPE html><html><head>"
+    "<meta charset='utf-8'>"
+    "<title>Aspol Tracker</title>"
 
     // CSS Styles
-    html += "<style>";
-    html += "body {";
-    html += "    font-family: Arial, sans-serif;";
-    html += "    max-width: 800px;";
-    html += "    margin: auto;";
-    html += "    padding: 20px;";
-    html += "    background-color: #f5f5f5;";
-    html += "}";
-    html += "h1, h2 {";
-    html += "    color: #333;";
-    html += "    border-bottom: 2px solid #ddd;";
-    html += "    padding-bottom: 10px;";
-    html += "}";
-    html += "table {";
-    html += "    width: 100%;";
-    html += "    border-collapse: collapse;";
-    html += "    margin-bottom: 20px;";
-    html += "    background-color: white;";
-    html += "    box-shadow: 0 1px 3px rgba(0,0,0,0.1);";
-    html += "}";
-    html += "th, td {";
-    html += "    border: 1px solid #ddd;";
-    html += "    padding: 12px;";
-    html += "    text-align: left;";
-    html += "}";
-    html += "th { background-color: #f8f9fa; font-weight: bold; }";
-    html += "input, select {";
-    html += "    width: 100%;";
-    html += "    padding: 8px;";
-    html += "    margin: 5px 0;";
-    html += "    border: 1px solid #ddd;";
-    html += "    border-radius: 4px;";
-    html += "    box-sizing: border-box;";
-    html += "}";
-    html += "input[type='submit'] {";
-    html += "    background-color: #007bff;";
-    html += "    color: white;";
-    html += "    border: none;";
-    html += "    padding: 10px;";
-    html += "    cursor: pointer;";
-    html += "    font-weight: bold;";
-    html += "}";
-    html += "input[type='submit']:hover { background-color: #0056b3; }";
-    html += "#serialMonitor {";
-    html += "    background: #f8f8f8;";
-    html += "    padding: 15px;";
-    html += "    font-family: monospace;";
-    html += "    height: 200px;";
-    html += "    overflow-y: auto;";
-    html += "    margin: 10px 0;";
-    html += "    white-space: pre;";
-    html += "    border: 1px solid #ddd;";
-    html += "    border-radius: 4px;";
-    html += "}";
-    html += "#sensorData {";
-    html += "    background: #f0f8ff;";
-    html += "    padding: 20px;";
-    html += "    margin: 20px 0;";
-    html += "    border-radius: 8px;";
-    html += "    box-shadow: 0 2px 4px rgba(0,0,0,0.1);";
-    html += "}";
-    html += ".status-card {";
-    html += "    background: white;";
-    html += "    padding: 15px;";
-    html += "    margin: 10px 0;";
-    html += "    border-radius: 8px;";
-    html += "    box-shadow: 0 2px 4px rgba(0,0,0,0.1);";
-    html += "}";
-    html += "</style>";
+    "<style>"
+    "body {"
+    "    font-family: Arial, sans-serif;"
+    "    max-width: 800px;"
+    "    margin: auto;"
+    "    padding: 20px;"
+    "    background-color: #f5f5f5;"
+    "}"
+    "h1, h2 {"
+    "    color: #333;"
+    "    border-bottom: 2px solid #ddd;"
+    "    padding-bottom: 10px;"
+    "}"
+    "table {"
+    "    width: 100%;"
+    "    border-collapse: collapse;"
+    "    margin-bottom: 20px;"
+    "    background-color: white;"
+    "    box-shadow: 0 1px 3px rgba(0,0,0,0.1);"
+    "}"
+    "th, td {"
+    "    border: 1px solid #ddd;"
+    "    padding: 12px;"
+    "    text-align: left;"
+    "}"
+    "th { background-color: #f8f9fa; font-weight: bold; }"
+    "input, select {"
+    "    width: 100%;"
+    "    padding: 8px;"
+    "    margin: 5px 0;"
+    "    border: 1px solid #ddd;"
+    "    border-radius: 4px;"
+    "    box-sizing: border-box;"
+    "}"
+    "input[type='submit'] {"
+    "    background-color: #007bff;"
+    "    color: white;"
+    "    border: none;"
+    "    padding: 10px;"
+    "    cursor: pointer;"
+    "    font-weight: bold;"
+    "}"
+    "input[type='submit']:hover { background-color: #0056b3; }"
+    "#serialMonitor {"
+    "    background: #f8f8f8;"
+    "    padding: 15px;"
+    "    font-family: monospace;"
+    "    height: 200px;"
+    "    overflow-y: auto;"
+    "    margin: 10px 0;"
+    "    white-space: pre;"
+    "    border: 1px solid #ddd;"
+    "    border-radius: 4px;"
+    "}"
+    "#sensorData {"
+    "    background: #f0f8ff;"
+    "    padding: 20px;"
+    "    margin: 20px 0;"
+    "    border-radius: 8px;"
+    "    box-shadow: 0 2px 4px rgba(0,0,0,0.1);"
+    "}"
+    ".status-card {"
+    "    background: white;"
+    "    padding: 15px;"
+    "    margin: 10px 0;"
+    "    border-radius: 8px;"
+    "    box-shadow: 0 2px 4px rgba(0,0,0,0.1);"
+    "}"
+    "</style>"
 
     // JavaScript
-    html += "<script>";
-    html += "function updateData() {";
-    html += "    fetch('/pressure')";
-    html += "        .then(response => response.json())";
-    html += "        .then(data => {";
-    html += "            document.getElementById('currentValue').textContent = data.current.toFixed(2);";
-    html += "            document.getElementById('avgValue').textContent = data.average.toFixed(2);";
-    html += "            document.getElementById('threshold').textContent = data.threshold.toFixed(2);";
-    html += "            const valueElement = document.getElementById('currentValue').parentElement;";
-    html += "            valueElement.style.backgroundColor = data.current > data.threshold ? '#ffebee' : '';";
-    html += "        });";
-    html += "    fetch('/serial')";
-    html += "        .then(response => response.text())";
-    html += "        .then(data => {";
-    html += "            const monitor = document.getElementById('serialMonitor');";
-    html += "            monitor.textContent = data;";
-    html += "            monitor.scrollTop = monitor.scrollHeight;";
-    html += "        });";
-    html += "    fetch('/timeTemp')";
-    html += "        .then(response => response.json())";
-    html += "        .then(data => {";
-    html += "            document.getElementById('time').textContent = data.time;";
-    html += "            if(data.temperature) {";
-    html += "                document.getElementById('temperature').textContent = data.temperature + ' °C';";
-    html += "            }";
-    html += "        });";
-    html += "}";
-    html += "setInterval(updateData, 1000);";
-    html += "document.addEventListener('DOMContentLoaded', function() {";
-    html += "    updateData();";
-    html += "    document.querySelector('[name=\"sensorType\"]').addEventListener('change', function() {";
-    html += "        document.getElementById('pressureRow').style.display = (this.value === 'BMP') ? 'table-row' : 'none';";
-    html += "        document.getElementById('flowRow').style.display = (this.value === 'YF401') ? 'table-row' : 'none';";
-    html += "    });";
-    html += "});";
-    html += "</script>";
-    html += "</head>";
+    "<script>"
+    "let logCount = -1, clockBase = 0, clockAt = 0;"
+    "function pad(n) { return (n < 10 ? '0' : '') + n; }"
+    // Tick from the device time of the latest status body
+    "function showClock() {"
+    "    const element = document.getElementById('time');"
+    "    if (!element || !clockBase) return;"
+    "    const t = clockBase + Math.floor((Date.now() - clockAt) / 1000);"
+    "    element.textContent = pad(Math.floor(t / 3600) % 24) + ':' + pad(Math.floor(t / 60) % 60) + ':' + pad(t % 60);"
+    "}"
+    "function updateSerial() {"
+    "    fetch('/serial')"
+    "        .then(response => response.text())"
+    "        .then(data => {"
+    "            const monitor = document.getElementById('serialMonitor');"
+    "            monitor.textContent = data;"
+    "            monitor.scrollTop = monitor.scrollHeight;"
+    "        });"
+    "}"
+    "function updateData() {"
+    "    fetch('/api/status')"
+    "        .then(response => response.json())"
+    "        .then(data => {"
+    "            if (data.value !== null) {"
+    "                document.getElementById('currentValue').textContent = data.value.toFixed(2);"
+    "                document.getElementById('avgValue').textContent = data.average.toFixed(2);"
+    "                document.getElementById('threshold').textContent = data.threshold.toFixed(2);"
+    "                const valueElement = document.getElementById('currentValue').parentElement;"
+    "                valueElement.style.backgroundColor = data.value > data.threshold ? '#ffebee' : '';"
+    "            }"
+    "            if (data.now && data.now !== clockBase) {"
+    "                clockBase = data.now;"
+    "                clockAt = Date.now();"
+    "            }"
+    "            showClock();"
+    "            const temperature = document.getElementById('temperature');"
+    "            if (temperature && data.temperature !== null) {"
+    "                temperature.textContent = data.temperature.toFixed(2) + ' °C';"
+    "            }"
+    "            document.getElementById('gps').textContent = data.gps ?"
+    "                'LAT: ' + data.gps.lat.toFixed(6) + '| LNG:' + data.gps.lng.toFixed(6) + '| SAT:' + data.gps.satellites :"
+    "                'No Valid GPS Data';"
+    "            document.getElementById('motion').textContent = data.motion;"
+    "            if (data.log !== logCount) {"
+    "                logCount = data.log;"
+    "                updateSerial();"
+    "            }"
+    "        });"
+    "}"
+    "function drawChart() {"
+    "    const canvas = document.getElementById('chart');"
+    "    fetch('/api/chart?width=' + canvas.width)"
+    "        .then(response => response.arrayBuffer())"
+    "        .then(buffer => {"
+    "            const header = new Uint32Array(buffer, 0, 4);"
+    "            const count = header[0], span = header[1];"
+    "            const summary = new Float32Array(buffer, 16, 3);"
+    "            const x = new Int32Array(buffer, 28, count);"
+    "            const y = new Float32Array(buffer, 28 + 4 * count, count);"
+    "            const context = canvas.getContext('2d');"
+    "            context.clearRect(0, 0, canvas.width, canvas.height);"
+    "            if (count < 2) return;"
+    "            let low = summary[1], high = summary[2];"
+    "            if (high - low < 0.01) { low -= 0.5; high += 0.5; }"
+    "            context.beginPath();"
+    "            for (let i = 0; i < count; i++) {"
+    "                const px = canvas.width * (1 + x[i] / span);"
+    "                const py = (canvas.height - 2) * (high - y[i]) / (high - low) + 1;"
+    "                if (i) context.lineTo(px, py); else context.moveTo(px, py);"
+    "            }"
+    "            context.strokeStyle = '#1565c0';"
+    "            context.stroke();"
+    "        });"
+    "}"
+    "setInterval(updateData, 1000);"
+    "setInterval(drawChart, 5000);"
+    "document.addEventListener('DOMContentLoaded', function() {"
+    "    updateData();"
+    "    drawChart();"
+    "    document.querySelector('[name=\"sensorType\"]').addEventListener('change', function() {"
+    "        document.getElementById('pressureRow').style.display = (this.value === 'BMP') ? 'table-row' : 'none';"
+    "        document.getElementById('flowRow').style.display = (this.value === 'YF401') ? 'table-row' : 'none';"
+    "    });"
+    "});"
+    "</script>"
+    "</head>"
 
     // Body Content
-    html += "<body>";
-    html += "<h1>Aspol Tracker Status</h1>";
+    "<body>"
+    "<h1>Aspol Tracker Status</h1>"
 
     // Sensor Data Section
-    html += "<div id='sensorData'>";
-    html += "<h2>Sensor Monitoring</h2>";
-    html += "<table>";
-    html += "<tr><th>Current Value</th><td><span id='currentValue'>0.00</span></td></tr>";
-    html += "<tr><th>Average Value</th><td><span id='avgValue'>0.00</span></td></tr>";
-    html += "<tr><th>Threshold Level</th><td><span id='threshold'>0.00</span></td></tr>";
-    html += "</table>";
-    html += "</div>";
+    "<div id='sensorData'>"
+    "<h2>Sensor Monitoring</h2>"
+    "<table>"
+    "<tr><th>Current Value</th><td><span id='currentValue'>0.00</span></td></tr>"
+    "<tr><th>Average Value</th><td><span id='avgValue'>0.00</span></td></tr>"
+    "<tr><th>Threshold Level</th><td><span id='threshold'>0.00</span></td></tr>"
+    "</table>"
+    "<canvas id='chart' width='600' height='150' style='width:100%;background:white'></canvas>"
+    "</div>"
 
     // Device Status Section
-    html += "<div class='status-card'>";
-    html += "<h2>Device Status</h2><table>";
+    "<div class='status-card'>"
+    "<h2>Device Status</h2><table>"
 
     // Time Status
-    if (rtcInitialized)
-    {
-        html += "<tr><th>Current Time</th><td><span id='time'>Loading...</span></td></tr>";
-    }
-    else
-    {
-        html += "<tr><th>Time</th><td>RTC Not Initialized</td></tr>";
-    }
+    "{{timeRow}}"
 
     // Temperature Status
-    if (bmpInitialized)
-    {
-        html += "<tr><th>Temperature</th><td><span id='temperature'>Loading...</span></td></tr>";
-    }
-    else
-    {
-        html += "<tr><th>Temperature</th><td>BMP Not Initialized</td></tr>";
-    }
+    "{{temperatureRow}}"
 
     // GPS Status
-    char gpsMsgWeb[100];
-    html += "<tr><th>GPS Status</th><td>";
-    if (gps.location.isValid())
-    {
-        html += html += "LAT: " + String(gps.location.lat(), 6) + "| LNG:" + String(gps.location.lng(), 6) + "| SAT:" + String(gps.satellites.value());
-    }
-    else
-    {
-        html += "No Valid GPS Data";
-    }
-    html += "</td></tr></table></div>";
+    "<tr><th>GPS Status</th><td id='gps'>"
+    "{{gpsStatus}}"
+    "</td></tr>"
+    "<tr><th>Motion</th><td id='motion'>{{motion}}</td></tr>"
+    "</table></div>"
 
-    html += "<div class='status-card'>";
-    html += "<h2>GPS Log Management</h2>";
-    html += "<p>Main Log: ";
-    html += "<a href='/download_gps_log'><button>Download</button></a> ";
-    html += "<a href='/delete_gps_log' onclick='return confirm(\"Delete main GPS log?\")'><button>Delete</button></a>";
-    html += "</p><p>Track Log: ";
-    html += "<a href='/download_gps_track'><button>Download</button></a> ";
-    html += "<a href='/delete_gps_track' onclick='return confirm(\"Delete GPS track log?\")'><button>Delete</button></a>";
-    html += "</p></div>";
+    "<div class='status-card'>"
+    "<h2>GPS Log Management</h2>"
+    "<p>Main Log: "
+    "<a href='/download_gps_log'><button>Download</button></a> "
+    "<a href='/delete_gps_log' onclick='return confirm(\"Delete main GPS log?\")'><button>Delete</button></a>"
+    "</p><p>Track Log: "
+    "<a href='/download_gps_track'><button>Download</button></a> "
+    "<a href='/delete_gps_track' onclick='return confirm(\"Delete GPS track log?\")'><button>Delete</button></a>"
+    "</p><p><a href='/map'><button>Map</button></a></p></div>"
 
     // Serial Monitor Section
-    html += "<div class='status-card'>";
-    html += "<h2>Serial Monitor</h2>";
-    html += "<div id='serialMonitor'></div>";
-    html += "</div>";
+    "<div class='status-card'>"
+    "<h2>Serial Monitor</h2>"
+    "<div id='serialMonitor'></div>"
+    "</div>"
 
     // SD Card Files Section
-    html += "<div class='status-card'>";
-    html += getFileList();
-    html += "</div>";
+    "<div class='status-card'>"
+    "{{fileList}}"
+    "</div>"
 
     // RTC Configuration Section
-    html += "<div class='status-card'>";
-    html += "<h2>RTC Configuration</h2>";
-    html += "<form method='POST' action='/datetime'>";
-    html += "<table><tr><th>Set Date & Time</th><td>";
-    html += "<input type='datetime-local' name='datetime' required></td></tr>";
-    html += "<tr><td colspan='2'><input type='submit' value='Update DateTime'></td></tr></table>";
-    html += "</form></div>";
+    "<div class='status-card'>"
+    "<h2>RTC Configuration</h2>"
+    "<form method='POST' action='/datetime'>"
+    "<table><tr><th>Set Date & Time</th><td>"
+    "<input type='datetime-local' name='datetime' required></td></tr>"
+    "<tr><td colspan='2'><input type='submit' value='Update DateTime'></td></tr></table>"
+    "</form></div>"
 
     // Device Configuration Section
-    html += "<div class='status-card'>";
-    html += "<h2>Device Configuration</h2>";
-    html += "<form method='POST' action='/config'><table>";
-    html += "<tr><th>Sensor Type</th><td><select name='sensorType'>";
-    html += "<option value='BMP'" + String(strcmp(currentConfig.currentSensor, "BMP") == 0 ? " selected" : "") + ">BMP Pressure Sensor</option>";
-    html += "<option value='YF401'" + String(strcmp(currentConfig.currentSensor, "YF401") == 0 ? " selected" : "") + ">YF-401 Flow Meter</option>";
-    html += "</select></td></tr>";
-    html += "<tr id='pressureRow' style='display:" + String(strcmp(currentConfig.currentSensor, "BMP") == 0 ? "table-row" : "none") + ";'>";
-    html += "<th>Pressure Threshold (%)</th><td><input type='number' step='0.1' name='pressureThreshold' value='" + String(currentConfig.pressureThreshold) + "'></td></tr>";
-    html += "<tr id='flowRow' style='display:" + String(strcmp(currentConfig.currentSensor, "YF401") == 0 ? "table-row" : "none") + ";'>";
-    html += "<th>Flow Threshold (%)</th><td><input type='number' step='0.1' name='flowThreshold' value='" + String(currentConfig.flowThreshold) + "'></td></tr>";
-    html += "<tr><th>SSID</th><td><input type='text' name='ssid' value='" + String(currentConfig.ssid) + "'></td></tr>";
-    html += "<tr><th>Password</th><td><input type='password' name='password' placeholder='Enter new password'></td></tr>";
-    html += "<tr><th>Device Name</th><td><input type='text' name='deviceName' value='" + String(currentConfig.deviceName) + "'></td></tr>";
-    html += "<tr><th>Track Log Interval (sec)</th><td><input type='number' name='trackLogInterval' value='" + String(currentConfig.trackLogInterval) + "'></td></tr>";
-    html += "<tr><td colspan='2'><input type='submit' value='Save Configuration'></td></tr></table>";
-    html += "</form></div>";
-
-    html += "</body></html>";
-
-    server.send(200, "text/html", html);
-}
+    "<div class='status-card'>"
+    "<h2>Device Configuration</h2>"
+    "<form method='POST' action='/config'><table>"
+    "<tr><th>Sensor Type</th><td><select name='sensorType'>"
+    "<option value='BMP'{{bmpSelected}}>BMP Pressure Sensor</option>"
+    "<option value='YF401'{{yf401Selected}}>YF-401 Flow Meter</option>"
+    "</select></td></tr>"
+    "<tr id='pressureRow' style='display:{{pressureRowDisplay}};'>"
+    "<th>Pressure Threshold (%)</th><td><input type='number' step='0.1' name='pressureThreshold' value='{{pressureThreshold}}'></td></tr>"
+    "<tr id='flowRow' style='display:{{flowRowDisplay}};'>"
+    "<th>Flow Threshold (%)</th><td><input type='number' step='0.1' name='flowThreshold' value='{{flowThreshold}}'></td></tr>"
+    "<tr><th>SSID</th><td><input type='text' name='ssid' value='{{ssid}}'></td></tr>"
+    "<tr><th>Password</th><td><input type='password' name='password' placeholder='Enter new password'></td></tr>"
+    "<tr><th>Device Name</th><td><input type='text' name='deviceName' value='{{deviceName}}'></td></tr>"
+    "<tr><th>Track Log Interval (sec)</th><td><input type='number' name='trackLogInterval' value='{{trackLogInterval}}'></td></tr>"
+    "<tr><th>Min Sample Interval (ms)</th><td><input type='number' name='sampleIntervalMin' value='{{sampleIntervalMin}}'></td></tr>"
+    "<tr><th>Max Sample Interval (ms)</th><td><input type='number' name='sampleIntervalMax' value='{{sampleIntervalMax}}'></td></tr>"
+    "<tr><th>Log Buffer Overflow</th><td><select name='logOverflowPolicy'>"
+    "{{overflowOptions}}"
+    "</select></td></tr>"
+    "<tr><th>Upload to Collector</th><td><input type='checkbox' name='uploadEnabled'{{uploadChecked}}></td></tr>"
+    "<tr><th>Station SSID</th><td><input type='text' name='staSsid' value='{{staSsid}}'></td></tr>"
+    "<tr><th>Station Password</th><td><input type='password' name='staPassword' placeholder='Enter new password'></td></tr>"
+    "<tr><th>Collector URL</th><td><input type='text' name='collectorUrl' value='{{collectorUrl}}'></td></tr>"
+    "<tr><th>Upload Interval (sec)</th><td><input type='number' name='uploadInterval' value='{{uploadInterval}}'></td></tr>"
+    "<tr><th>MQTT Telemetry</th><td><input type='checkbox' name='mqttEnabled'{{mqttChecked}}></td></tr>"
+    "<tr><th>MQTT Broker URI</th><td><input type='text' name='mqttUri' value='{{mqttUri}}'></td></tr>"
+    "<tr><th>MQTT Batch Window (sec)</th><td><input type='number' name='mqttBatchWindow' value='{{mqttBatchWindow}}'></td></tr>"
+    "<tr><th>MQTT QoS</th><td><select name='mqttQos'>"
+    "<option value='0'{{mqttQos0Selected}}>0 (at most once)</option>"
+    "<option value='1'{{mqttQos1Selected}}>1 (at least once)</option>"
+    "</select></td></tr>"
+    "<tr><td colspan='2'><input type='submit' value='Save Configuration'></td></tr></table>"
+    "</form></div>"
 
-void logGPSData(float pressure)
+    "</body></html>";
+
+enum RootPageSlot
 {
-    if (!sdCardAvailable || !gps.location.isValid())
-        return;
+    ROOT_TIME_ROW,
+    ROOT_TEMPERATURE_ROW,
+    ROOT_GPS_STATUS,
+    ROOT_MOTION,
+    ROOT_FILE_LIST,
+    ROOT_BMP_SELECTED,
+    ROOT_YF401_SELECTED,
+    ROOT_PRESSURE_ROW_DISPLAY,
+    ROOT_PRESSURE_THRESHOLD,
+    ROOT_FLOW_ROW_DISPLAY,
+    ROOT_FLOW_THRESHOLD,
+    ROOT_SSID,
+    ROOT_DEVICE_NAME,
+    ROOT_TRACK_LOG_INTERVAL,
+    ROOT_SAMPLE_INTERVAL_MIN,
+    ROOT_SAMPLE_INTERVAL_MAX,
+    ROOT_OVERFLOW_OPTIONS,
+    ROOT_UPLOAD_CHECKED,
+    ROOT_STA_SSID,
+    ROOT_COLLECTOR_URL,
+    ROOT_UPLOAD_INTERVAL,
+    ROOT_MQTT_CHECKED,
+    ROOT_MQTT_URI,
+    ROOT_MQTT_BATCH_WINDOW,
+    ROOT_MQTT_QOS0_SELECTED,
+    ROOT_MQTT_QOS1_SELECTED,
+    ROOT_SLOT_COUNT
+};
 
-    DateTime now = rtc.now();
+constexpr const char *rootPageSlots[] = {
+    "timeRow", "temperatureRow", "gpsStatus", "motion", "fileList", "bmpSelected", "yf401Selected",
+    "pressureRowDisplay", "pressureThreshold", "flowRowDisplay", "flowThreshold", "ssid", "deviceName",
+    "trackLogInterval", "sampleIntervalMin", "sampleIntervalMax", "overflowOptions", "uploadChecked", "staSsid",
+    "collectorUrl", "uploadInterval", "mqttChecked", "mqttUri", "mqttBatchWindow", "mqttQos0Selected",
+    "mqttQos1Selected"};
+static_assert(sizeof(rootPageSlots) / sizeof(rootPageSlots[0]) == ROOT_SLOT_COUNT,
+              "rootPageSlots must name every RootPageSlot");
 
-    bool newFile = !SD.exists("/flow_log.csv");
-    File logFile = SD.open("/flow_log.csv", FILE_APPEND);
-    if (logFile) {
-        if (newFile) {
-            logFile.println("DateTime,Latitude,Longitude,Pressure");
-        }
-        char logEntry[100];
-        snprintf(logEntry, sizeof(logEntry), "%02d/%02d/%04d %02d:%02d:%02d,%.6f,%.6f,%.2f\n",
-                 now.day(), now.month(), now.year(),
-                 now.hour(), now.minute(), now.second(),
-                 gps.location.lat(), gps.location.lng(),
-                 pressure);
-        logFile.print(logEntry);
-        logFile.close();
+constexpr auto rootPage = PAGE_TEMPLATE(rootPageText, rootPageSlots);
 
-        char message[50];
-        snprintf(message, sizeof(message), "Logged data: %.2f hPa", pressure);
-        serialPrintln(message);
-    }
-    else
+void fillRootPage(int slot, PageWriter &out)
+{
+    bool bmp = strcmp(currentConfig.currentSensor, "BMP") == 0;
+    bool yf401 = strcmp(currentConfig.currentSensor, "YF401") == 0;
+
+    switch (slot)
     {
-        serialPrintln("Failed to open log file");
+    case ROOT_TIME_ROW:
+        out.print(rtcInitialized ? "<tr><th>Current Time</th><td><span id='time'>Loading...</span></td></tr>"
+                                 : "<tr><th>Time</th><td>RTC Not Initialized</td></tr>");
+        break;
+    case ROOT_TEMPERATURE_ROW:
+        out.print(bmpInitialized ? "<tr><th>Temperature</th><td><span id='temperature'>Loading...</span></td></tr>"
+                                 : "<tr><th>Temperature</th><td>BMP Not Initialized</td></tr>");
+        break;
+    case ROOT_GPS_STATUS:
+        if (gpsFix.valid)
+            out.printf("LAT: %.6f| LNG:%.6f| SAT:%u", gpsFix.lat, gpsFix.lng, gpsFix.satellites);
+        else
+            out.print("No Valid GPS Data");
+        break;
+    case ROOT_MOTION:
+        out.print(motionStateName(motion.state));
+        break;
+    case ROOT_FILE_LIST:
+        writeFileList(out);
+        break;
+    case ROOT_BMP_SELECTED:
+        out.print(bmp ? " selected" : "");
+        break;
+    case ROOT_YF401_SELECTED:
+        out.print(yf401 ? " selected" : "");
+        break;
+    case ROOT_PRESSURE_ROW_DISPLAY:
+        out.print(bmp ? "table-row" : "none");
+        break;
+    case ROOT_PRESSURE_THRESHOLD:
+        out.printf("%.2f", currentConfig.pressureThreshold);
+        break;
+    case ROOT_FLOW_ROW_DISPLAY:
+        out.print(yf401 ? "table-row" : "none");
+        break;
+    case ROOT_FLOW_THRESHOLD:
+        out.printf("%.2f", currentConfig.flowThreshold);
+        break;
+    case ROOT_SSID:
+        out.printEscaped(currentConfig.ssid);
+        break;
+    case ROOT_DEVICE_NAME:
+        out.printEscaped(currentConfig.deviceName);
+        break;
+    case ROOT_TRACK_LOG_INTERVAL:
+        out.printf("%u", (unsigned)currentConfig.trackLogInterval);
+        break;
+    case ROOT_SAMPLE_INTERVAL_MIN:
+        out.printf("%u", (unsigned)currentConfig.sampleIntervalMin);
+        break;
+    case ROOT_SAMPLE_INTERVAL_MAX:
+        out.printf("%u", (unsigned)currentConfig.sampleIntervalMax);
+        break;
+    case ROOT_OVERFLOW_OPTIONS:
+        for (int i = 0; i < LOG_OVERFLOW_POLICY_COUNT; i++)
+        {
+            out.printf("<option value='%d'%s>%s</option>", i, currentConfig.logOverflowPolicy == i ? " selected" : "",
+                       logOverflowPolicyName(i));
+        }
+        break;
+    case ROOT_UPLOAD_CHECKED:
+        out.print(currentConfig.uploadEnabled ? " checked" : "");
+        break;
+    case ROOT_STA_SSID:
+        out.printEscaped(currentConfig.staSsid);
+        break;
+    case ROOT_COLLECTOR_URL:
+        out.printEscaped(currentConfig.collectorUrl);
+        break;
+    case ROOT_UPLOAD_INTERVAL:
+        out.printf("%u", (unsigned)currentConfig.uploadInterval);
+        break;
+    case ROOT_MQTT_CHECKED:
+        out.print(currentConfig.mqttEnabled ? " checked" : "");
+        break;
+    case ROOT_MQTT_URI:
+        out.printEscaped(currentConfig.mqttUri);
+        break;
+    case ROOT_MQTT_BATCH_WINDOW:
+        out.printf("%u", (unsigned)currentConfig.mqttBatchWindow);
+        break;
+    case ROOT_MQTT_QOS0_SELECTED:
+        out.print(currentConfig.mqttQos == 0 ? " selected" : "");
+        break;
+    case ROOT_MQTT_QOS1_SELECTED:
+        out.print(currentConfig.mqttQos == 1 ? " selected" : "");
+        break;
     }
 }
 
-void processGPS()
+void sendPageChunk(const char *data, size_t length)
 {
-    static unsigned long lastBuzzerToggle = 0;
-    static bool buzzerState = false;
-    static bool gpsWasLocked = false;
-    
-    while (neo6m.available() > 0)
+    server.sendContent(data, length);
+}
+
+// Streamed straight from the template: nothing is built on the heap or in
+// the request arena
+void handleRoot()
+{
+    char buffer[PAGE_WRITE_BUFFER];
+    PageWriter out(buffer, sizeof(buffer), sendPageChunk);
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/html", "");
+    renderPage(rootPage, out, fillRootPage);
+    server.sendContent("");
+}
+
+// Map of the last day's track and sensor events over tiles from the SD
+// card (handleTile), drawn on a canvas so it needs nothing from the
+// internet. Drag to pan, wheel or +/- to zoom, click an event for details.
+constexpr char mapPageText[] =
+    "<!DOCTYPE html><html><head>"
+    "<meta charset='utf-8'>"
+    "<meta name='viewport' content='width=device-width'>"
+    "<title>Aspol Tracker Map</title>"
+    "<style>"
+    "body { font-family: Arial, sans-serif; margin: 0; background-color: #f5f5f5; }"
+    "#bar { padding: 8px; display: flex; gap: 8px; align-items: center; flex-wrap: wrap; }"
+    "#map { width: 100%; height: calc(100vh - 90px); display: block; background: #ddd; touch-action: none; cursor: grab; }"
+    ".key { display: inline-block; width: 10px; height: 10px; border-radius: 5px; }"
+    "#info { padding: 4px 8px; font-family: monospace; }"
+    "</style>"
+    "</head><body>"
+    "<div id='bar'>"
+    "<a href='/'>Dashboard</a>"
+    "<button onclick='zoomBy(1)'>+</button><button onclick='zoomBy(-1)'>-</button><button onclick='fitAll()'>Fit</button>"
+    "<span style='color:#1565c0'>&#9644; Track</span>"
+    "<span><span class='key' style='background:#d32f2f'></span> Pressure event</span>"
+    "<span><span class='key' style='background:#2e7d32'></span> Flow event</span>"
+    "<span id='archive'></span>"
+    "</div>"
+    "<canvas id='map'></canvas>"
+    "<div id='info'>Click an event for details</div>"
+    "<script>"
+    "const canvas = document.getElementById('map');"
+    "const context = canvas.getContext('2d');"
+    "const tiles = new Map();"
+    "let archive = null, zoom = 2, centerX = 512, centerY = 512;"
+    "let track = [], events = [], position = null, drag = null;"
+    "function worldX(lng, z) { return (lng + 180) / 360 * 256 * Math.pow(2, z); }"
+    "function worldY(lat, z) {"
+    "    const s = Math.sin(lat * Math.PI / 180);"
+    "    return (0.5 - Math.log((1 + s) / (1 - s)) / (4 * Math.PI)) * 256 * Math.pow(2, z);"
+    "}"
+    "function screen(point) {"
+    "    return [worldX(point.lng, zoom) - centerX + canvas.width / 2, worldY(point.lat, zoom) - centerY + canvas.height / 2];"
+    "}"
+    "function tile(z, x, y) {"
+    "    const key = z + '/' + x + '/' + y;"
+    "    let image = tiles.get(key);"
+    "    if (!image) {"
+    "        image = new Image();"
+    "        image.onload = draw;"
+    "        image.src = '/tile?z=' + z + '&x=' + x + '&y=' + y + '&v=' + archive.created;"
+    "        tiles.set(key, image);"
+    "        if (tiles.size > 200) tiles.delete(tiles.keys().next().value);"
+    "    }"
+    "    return image;"
+    "}"
+    "function draw() {"
+    "    canvas.width = canvas.clientWidth;"
+    "    canvas.height = canvas.clientHeight;"
+    "    const left = Math.round(centerX - canvas.width / 2), top = Math.round(centerY - canvas.height / 2);"
+    "    if (archive && zoom >= archive.minZoom && zoom <= archive.maxZoom) {"
+    "        const n = Math.pow(2, zoom);"
+    "        for (let x = Math.floor(left / 256); x * 256 < left + canvas.width; x++) {"
+    "            for (let y = Math.max(0, Math.floor(top / 256)); y < n && y * 256 < top + canvas.height; y++) {"
+    "                const image = tile(zoom, (x % n + n) % n, y);"
+    "                if (image.complete && image.naturalWidth) context.drawImage(image, x * 256 - left, y * 256 - top);"
+    "            }"
+    "        }"
+    "    }"
+    "    context.beginPath();"
+    "    track.forEach((point, i) => {"
+    "        const s = screen(point);"
+    "        if (i) context.lineTo(s[0], s[1]); else context.moveTo(s[0], s[1]);"
+    "    });"
+    "    context.strokeStyle = '#1565c0';"
+    "    context.lineWidth = 3;"
+    "    context.stroke();"
+    "    events.forEach(event => {"
+    "        const s = screen(event);"
+    "        context.beginPath();"
+    "        context.arc(s[0], s[1], 5, 0, 2 * Math.PI);"
+    "        context.fillStyle = event.series == 'pressure' ? '#d32f2f' : '#2e7d32';"
+    "        context.fill();"
+    "    });"
+    "    if (position) {"
+    "        const s = screen(position);"
+    "        context.beginPath();"
+    "        context.arc(s[0], s[1], 8, 0, 2 * Math.PI);"
+    "        context.lineWidth = 3;"
+    "        context.strokeStyle = 'black';"
+    "        context.stroke();"
+    "    }"
+    "}"
+    "function minZoom() { return archive ? archive.minZoom : 1; }"
+    "function maxZoom() { return archive ? archive.maxZoom : 19; }"
+    "function zoomTo(z, px, py) {"
+    "    z = Math.max(minZoom(), Math.min(maxZoom(), z));"
+    "    const scale = Math.pow(2, z - zoom);"
+    "    centerX = (centerX + px - canvas.width / 2) * scale - px + canvas.width / 2;"
+    "    centerY = (centerY + py - canvas.height / 2) * scale - py + canvas.height / 2;"
+    "    zoom = z;"
+    "    draw();"
+    "}"
+    "function zoomBy(step) { zoomTo(zoom + step, canvas.width / 2, canvas.height / 2); }"
+    "function fit(south, west, north, east) {"
+    "    for (zoom = maxZoom(); zoom > minZoom(); zoom--) {"
+    "        if (worldX(east, zoom) - worldX(west, zoom) < canvas.width - 40 &&"
+    "            worldY(south, zoom) - worldY(north, zoom) < canvas.height - 40) break;"
+    "    }"
+    "    centerX = (worldX(west, zoom) + worldX(east, zoom)) / 2;"
+    "    centerY = (worldY(north, zoom) + worldY(south, zoom)) / 2;"
+    "    draw();"
+    "}"
+    "function fitAll() {"
+    "    const points = track.concat(events, position ? [position] : []);"
+    "    if (points.length) {"
+    "        const lat = points.map(point => point.lat), lng = points.map(point => point.lng);"
+    "        fit(lat.reduce((a, b) => Math.min(a, b)), lng.reduce((a, b) => Math.min(a, b)),"
+    "            lat.reduce((a, b) => Math.max(a, b)), lng.reduce((a, b) => Math.max(a, b)));"
+    "    } else if (archive) {"
+    "        fit(archive.south, archive.west, archive.north, archive.east);"
+    "    } else {"
+    "        draw();"
+    "    }"
+    "}"
+    "canvas.addEventListener('pointerdown', event => {"
+    "    drag = { x: event.clientX, y: event.clientY, moved: false };"
+    "    canvas.setPointerCapture(event.pointerId);"
+    "});"
+    "canvas.addEventListener('pointermove', event => {"
+    "    if (!drag) return;"
+    "    centerX -= event.clientX - drag.x;"
+    "    centerY -= event.clientY - drag.y;"
+    "    drag.moved = drag.moved || Math.abs(event.clientX - drag.x) + Math.abs(event.clientY - drag.y) > 2;"
+    "    drag.x = event.clientX;"
+    "    drag.y = event.clientY;"
+    "    draw();"
+    "});"
+    "canvas.addEventListener('pointerup', event => {"
+    "    if (drag && !drag.moved) showEvent(event.offsetX, event.offsetY);"
+    "    drag = null;"
+    "});"
+    "canvas.addEventListener('wheel', event => {"
+    "    event.preventDefault();"
+    "    zoomTo(zoom + (event.deltaY < 0 ? 1 : -1), event.offsetX, event.offsetY);"
+    "});"
+    "function showEvent(px, py) {"
+    "    let nearest = null, best = 100;"
+    "    events.forEach(event => {"
+    "        const s = screen(event), d = (s[0] - px) * (s[0] - px) + (s[1] - py) * (s[1] - py);"
+    "        if (d < best) { best = d; nearest = event; }"
+    "    });"
+    "    document.getElementById('info').textContent = nearest ?"
+    "        new Date(nearest.t * 1000).toISOString().slice(0, 19).replace('T', ' ') + '  ' + nearest.lat.toFixed(6) + ', ' +"
+    "        nearest.lng.toFixed(6) + '  ' + nearest.v + (nearest.series == 'pressure' ? ' hPa' : ' L/min') :"
+    "        'Click an event for details';"
+    "}"
+    "function series(name, from) {"
+    "    return fetch('/query?series=' + name + '&limit=5000' + from)"
+    "        .then(response => response.json())"
+    "        .then(rows => rows.map(row => Object.assign(row, { series: name })));"
+    "}"
+    "function updatePosition() {"
+    "    return fetch('/api/status').then(response => response.json()).then(status => {"
+    "        position = status.gps;"
+    "        draw();"
+    "        return status;"
+    "    });"
+    "}"
+    "window.addEventListener('resize', draw);"
+    "fetch('/api/tiles').then(response => response.json()).then(info => {"
+    "    archive = info.tiles ? info : null;"
+    "    document.getElementById('archive').textContent = archive ?"
+    "        archive.tiles + ' tiles, zoom ' + archive.minZoom + '-' + archive.maxZoom : 'No tiles.pak on the SD card';"
+    "    return updatePosition();"
+    "}).then(status => {"
+    "    const from = status.now ? '&from=' + (status.now - 86400) : '';"
+    "    return Promise.all([series('track', from), series('pressure', from), series('flow', from)]);"
+    "}).then(results => {"
+    "    track = results[0];"
+    "    events = results[1].concat(results[2]);"
+    "    fitAll();"
+    "    setInterval(updatePosition, 5000);"
+    "});"
+    "</script>"
+    "</body></html>";
+
+void handleMap()
+{
+    server.send_P(200, "text/html", mapPageText, sizeof(mapPageText) - 1);
+}
+
+// Geofences from GEOFENCE_FILE: a "zone,<name>,<log>,<alert>" line starts
+// a polygon and every "<lat>,<lng>" line after it adds a vertex. With <log>
+// 0 sensor events inside the zone are not logged; with <alert> 1 entering
+// and leaving it beeps. Empty lines and lines starting with # are skipped.
+//
+//   # Name, log, alert
+//   zone,North field,1,1
+//   -7.250120,112.749870
+//   -7.250120,112.752310
+//   -7.252480,112.752310
+#define GEOFENCE_FILE "/geofences.txt"
+#define GEOFENCE_EVENT_FILE "/geofence_events.csv"
+#define GEOFENCE_LINE_SIZE 80
+#define GEOFENCE_BEEP_MS 200
+
+Geofences geofences;
+
+// Crossings wait here for the logger task, which appends them to
+// GEOFENCE_EVENT_FILE, so the loop never waits on the card for them
+struct GeofenceEvent
+{
+    uint32_t unixTime;
+    double lat;
+    double lng;
+    char zone[GEOFENCE_NAME_SIZE];
+    bool entered;
+};
+SpscQueue<GeofenceEvent, 8> geofenceEventQueue;
+
+static uint32_t geofenceNameHash(const char *name)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (; *name; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash;
+}
+
+// Zones the vehicle is in stay entered across a reload when a zone of the
+// same name is loaded again, so a reload alone reports no crossings
+void loadGeofences()
+{
+    static uint32_t insideNames[GEOFENCE_MAX_ZONES];
+    size_t insideCount = 0;
+    for (size_t i = 0; i < geofences.zoneCount(); i++)
+    {
+        if (geofences.inside(i))
+            insideNames[insideCount++] = geofenceNameHash(geofences.zone(i).name);
+    }
+
+    geofences.clear();
+    if (!SD.exists(GEOFENCE_FILE))
+        return;
+
+    File file = SD.open(GEOFENCE_FILE, FILE_READ);
+    if (!file)
+    {
+        serialPrintln("Failed to open geofence file");
+        return;
+    }
+
+    char line[GEOFENCE_LINE_SIZE];
+    bool open = false;
+    unsigned skipped = 0;
+    while (file.available())
     {
-        if (gps.encode(neo6m.read()))
+        size_t length = file.readBytesUntil('\n', line, sizeof(line) - 1);
+        while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
+            length--;
+        line[length] = '\0';
+        if (length == 0 || line[0] == '#')
+            continue;
+
+        if (strncmp(line, "zone,", 5) == 0)
         {
-            if (gps.location.isUpdated())
+            if (open && !geofences.endZone())
+                skipped++;
+
+            char *name = line + 5;
+            long log = 1;
+            long alert = 0;
+            char *field = strchr(name, ',');
+            if (field)
+            {
+                *field = '\0';
+                log = strtol(field + 1, &field, 10);
+                if (*field == ',')
+                    alert = strtol(field + 1, nullptr, 10);
+            }
+            // Names go into JSON and CSV as they are
+            for (char *c = name; *c; c++)
             {
-                // char message[80];
-                // snprintf(message, sizeof(message), "GPS Updated - Satellites: %d", gps.satellites.value());
-                // serialPrintln(message);
+                if (*c == '"' || *c == '\\' || *c == ',' || (uint8_t)*c < ' ')
+                    *c = '_';
             }
+            open = geofences.beginZone(name, (log ? GEOFENCE_LOG : 0) | (alert ? GEOFENCE_ALERT : 0));
+            if (!open)
+                skipped++;
         }
-    }
-    
-    // Check GPS lock status
-    bool gpsCurrentlyLocked = gps.location.isValid() && gps.satellites.value() >= 3;
-    
-    // If GPS status changed from locked to not locked, log it
-    if (gpsWasLocked && !gpsCurrentlyLocked) {
-        serialPrintln("GPS lock lost");
-    } else if (!gpsWasLocked && gpsCurrentlyLocked) {
-        serialPrintln("GPS lock acquired");
-        digitalWrite(BUZZER_PIN, LOW); // Turn off buzzer when lock is acquired
-    }
-    
-    // Update previous GPS status
-    gpsWasLocked = gpsCurrentlyLocked;
-    
-    // Beep the buzzer if no GPS lock or not enough satellites
-    if (!gpsCurrentlyLocked) {
-        // Toggle buzzer every 1 second for alert pattern
-        if (millis() - lastBuzzerToggle >= 1000) {
-            buzzerState = !buzzerState;
-            digitalWrite(BUZZER_PIN, buzzerState);
-            lastBuzzerToggle = millis();
+        else if (open)
+        {
+            char *end;
+            double lat = strtod(line, &end);
+            double lng = *end == ',' ? strtod(end + 1, &end) : NAN;
+            if (isnan(lng) || !geofences.addVertex(lround(lat * TS_COORD_SCALE), lround(lng * TS_COORD_SCALE)))
+            {
+                geofences.dropZone();
+                open = false;
+                skipped++;
+            }
         }
     }
+    if (open && !geofences.endZone())
+        skipped++;
+    file.close();
 
-    if (millis() > 5000 && gps.charsProcessed() < 10)
+    geofences.index();
+    for (size_t i = 0; i < geofences.zoneCount() && insideCount > 0; i++)
     {
-        serialPrintln("No GPS detected");
-        // Continuous buzz for no GPS module detected (different pattern)
-        if (millis() - lastBuzzerToggle >= 500) {
-            buzzerState = !buzzerState;
-            digitalWrite(BUZZER_PIN, buzzerState);
-            lastBuzzerToggle = millis();
+        uint32_t hash = geofenceNameHash(geofences.zone(i).name);
+        for (size_t j = 0; j < insideCount; j++)
+        {
+            if (insideNames[j] == hash)
+                geofences.setInside(i);
         }
     }
-}
-
-void addFlowReading(float flow)
-{
-    flowHistory.readings[flowHistory.index] = flow;
-    flowHistory.index = (flowHistory.index + 1) % PRESSURE_HISTORY_SIZE;
-    if (flowHistory.count < PRESSURE_HISTORY_SIZE)
-        flowHistory.count++;
-    flowC = flowB;
-    flowB = flowA;
-    flowA = flow;
-}
 
-float calculateAverageFlow()
-{
-    if (flowHistory.count == 0)
-        return 0;
-    float sum = 0;
-    for (int i = 0; i < flowHistory.count; i++)
-        sum += flowHistory.readings[i];
-    return sum / flowHistory.count;
+    char message[80];
+    snprintf(message, sizeof(message), "Geofences loaded: %u zones, %u vertices, %ux%u grid, %u skipped",
+             (unsigned)geofences.zoneCount(), (unsigned)geofences.vertexCount(), (unsigned)geofences.gridSize(),
+             (unsigned)geofences.gridSize(), skipped);
+    serialPrintln(message);
 }
 
-void checkFlowAndLog()
+// Crossings are rare next to sensor events, so the logger task keeps them
+// in a CSV on the card instead of in the log store
+void geofenceChanged(size_t index, bool entered)
 {
-    static unsigned long lastCheckTime = 0;
-    unsigned long currentTime = millis();
-    unsigned long timeDiff = currentTime - lastCheckTime;
-    unsigned long test1 = 100;
+    const GeofenceZone &zone = geofences.zone(index);
+    char message[60];
+    snprintf(message, sizeof(message), "%s geofence %s", entered ? "Entered" : "Left", zone.name);
+    serialPrintln(message);
 
-    // Add guard clause for time difference
-    if (timeDiff == 0)
-        return;
-
-    if (timeDiff >= 1000)
+    if (zone.flags & GEOFENCE_ALERT)
     {
-        detachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN));
-        flowRate = (pulseCount / calibrationFactor) * (1000.0 / max(timeDiff, test1));
-        pulseCount = 0;
-        lastCheckTime = currentTime;
-        attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), pulseCounter, FALLING);
-
-        addFlowReading(flowRate);
+        digitalWrite(BUZZER_PIN, HIGH);
+        schedulerArm(jobBuzzerOff, MS_TO_US(GEOFENCE_BEEP_MS));
     }
-    float averageFlow = calculateAverageFlow();
-    float threshold = averageFlow * (1.0 + (currentConfig.flowThreshold / 100.0));
 
-    if (flowRate > 12 && millis() - lastLogTime > 1500 && flowA <= flowB && flowB >= flowC)
+    if (!sdCardAvailable)
+        return;
+    GeofenceEvent event;
+    event.unixTime = rtc.now().unixtime();
+    event.lat = gpsFix.lat;
+    event.lng = gpsFix.lng;
+    memcpy(event.zone, zone.name, sizeof(event.zone));
+    event.entered = entered;
+    if (!geofenceEventQueue.push(event))
     {
-        lastLogTime = millis();
-        char msg[100];
-        snprintf(msg, sizeof(msg), "Flow rate: %.2f L/min (Avg: %.2f/T: %.2f)", flowRate, averageFlow, threshold);
-        serialPrintln(msg);
-        logGPSDataFlow(flowRate);
+        serialPrintln("Geofence event queue full, crossing not logged");
+        return;
     }
+    xTaskNotifyGive(loggerTaskHandle);
 }
 
-void logGPSDataFlow(float flow)
+// Runs in the logger task
+void logGeofenceEvents()
 {
-    if (!sdCardAvailable || !gps.location.isValid())
+    GeofenceEvent event;
+    if (!geofenceEventQueue.peek(event))
         return;
-    DateTime now = rtc.now();
-    File file = SD.open("/flow_log.csv", FILE_APPEND);
-    if (file)
+    File file = SD.open(GEOFENCE_EVENT_FILE, FILE_APPEND);
+    if (!file)
     {
-        file.printf("%02d/%02d/%04d,%02d:%02d:%02d,%.6f,%.6f,%.2f\n",
-                    now.day(), now.month(), now.year(),
-                    now.hour(), now.minute(), now.second(),
-                    gps.location.lat(), gps.location.lng(), flow);
-        file.close();
+        while (geofenceEventQueue.pop(event))
+            ;
+        return;
+    }
+    if (file.size() == 0)
+        file.println("DateTime,Zone,Event,Latitude,Longitude");
+    while (geofenceEventQueue.pop(event))
+    {
+        DateTime time(event.unixTime);
+        file.printf("%02d/%02d/%04d %02d:%02d:%02d,%s,%s,%.6f,%.6f\n",
+                    time.day(), time.month(), time.year(), time.hour(), time.minute(), time.second(),
+                    event.zone, event.entered ? "Enter" : "Exit", event.lat, event.lng);
     }
+    file.close();
 }
 
-void setup()
+// Called for every new GPS fix
+void updateGeofences()
 {
-    Serial.begin(115200);
-    delay(2000);
-    serialPrintln("System starting...");
-
-    neo6m.begin(9600, SERIAL_8N1, RXD2, TXD2);
-    serialPrintln("GPS serial initialized");
-
-    initRTC();
-    initBMP();
-    initSDCard();
+    if (geofences.zoneCount() == 0 || !gpsFix.valid || gpsFix.hdop > MOTION_MAX_HDOP)
+        return;
+    geofences.update(lround(gpsFix.lat * TS_COORD_SCALE), lround(gpsFix.lng * TS_COORD_SCALE), geofenceChanged);
+}
 
-    pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP);
-    attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), pulseCounter, FALLING);
+// Sensor events are not logged inside a zone that has logging off
+bool geofenceAllowsLogging()
+{
+    return geofences.insideFlags() & GEOFENCE_LOG;
+}
 
-    setupWiFi();
-    server.on("/", handleRoot);
-    server.on("/config", handleConfig);
-    server.on("/datetime", handleDateTime);
-    server.on("/serial", handleSerial);
-    server.on("/pressure", handlePressure); // Add new endpoint
-    server.on("/download", handleDownload);
-    server.on("/delete", handleDelete);
-    server.on("/timeTemp", handleTimeTemp);
-    server.on("/download_gps_log", handleDownloadGPSLog);
-    server.on("/delete_gps_log", handleDeleteGPSLog);
-    server.on("/download_gps_track", handleDownloadGPSTrack);
-    server.on("/delete_gps_track", handleDeleteGPSTrack);
-    server.begin();
-    serialPrintln("Web server started");
+void runBuzzerOffJob()
+{
+    digitalWrite(BUZZER_PIN, LOW);
+}
 
-    pinMode(POWER_LED_PIN, OUTPUT);
-    digitalWrite(POWER_LED_PIN, HIGH);  // Turn on power indicator
+// /api/geofences: the zones and which the vehicle is in; ?reload=1 reads
+// GEOFENCE_FILE again, keeping the zones the vehicle is in entered
+void handleApiGeofences()
+{
+    if (server.arg("reload") == "1")
+        loadGeofences();
 
-    pinMode(BUZZER_PIN, OUTPUT);
-    digitalWrite(BUZZER_PIN, LOW);  // Initialize buzzer as off
+    ArenaString json(requestArena, 256 + geofences.zoneCount() * 64);
+    json.appendf("{\"zones\":%u,\"vertices\":%u,\"grid\":%u,\"cellEntries\":%u,\"tested\":%u,\"list\":[",
+                 (unsigned)geofences.zoneCount(), (unsigned)geofences.vertexCount(), (unsigned)geofences.gridSize(),
+                 (unsigned)geofences.cellEntries(), (unsigned)geofences.lastTests());
+    for (size_t i = 0; i < geofences.zoneCount(); i++)
+    {
+        const GeofenceZone &zone = geofences.zone(i);
+        json.appendf("%s{\"name\":\"%s\",\"log\":%s,\"alert\":%s,\"inside\":%s}", i ? "," : "", zone.name,
+                     zone.flags & GEOFENCE_LOG ? "true" : "false", zone.flags & GEOFENCE_ALERT ? "true" : "false",
+                     geofences.inside(i) ? "true" : "false");
+    }
+    json += "]}";
+    sendArena(200, "application/json", json);
 }
 
-// Add new handler for real-time pressure data
-void handlePressure()
+void logGPSData(float pressure)
 {
-    String json;
-    if (strcmp(currentConfig.currentSensor, "BMP") == 0)
+    if (!sdCardAvailable || !gpsFix.valid)
+        return;
+    if (motion.state == MOTION_STATIONARY)
     {
-        if (!bmpInitialized)
-        {
-            server.send(500, "application/json", "{\"error\":\"BMP sensor not initialized\"}");
-            return;
-        }
-        // BMP pressure handling
+        serialPrintln("Stationary, pressure event not logged");
+        return;
     }
-    else
+    if (!geofenceAllowsLogging())
     {
-        // Flow sensor handling
-        if (flowRate == INFINITY)
-        { // Handle potential invalid values
-            server.send(500, "application/json", "{\"error\":\"Invalid flow reading\"}");
-            return;
-        }
-    }
-    server.send(200, "application/json", json);
-}
-// Add these handlers in your code
-void handleDownloadGPSLog() {
-    if (SD.exists("/flow_log.csv")) {
-        File file = SD.open("/flow_log.csv", FILE_READ);
-        if (file) {
-            server.sendHeader("Content-Type", "text/csv");
-            server.sendHeader("Content-Disposition", "attachment; filename=gps_log.csv");
-            server.streamFile(file, "text/csv");
-            file.close();
-        } else {
-            server.send(500, "text/plain", "Error reading GPS log");
-        }
-    } else {
-        server.send(404, "text/plain", "GPS log not found");
+        serialPrintln("In a no-log geofence, pressure event not logged");
+        return;
     }
-}
 
-void handleDeleteGPSLog() {
-    if (SD.remove("/flow_log.csv")) {
-        File file = SD.open("/flow_log.csv", FILE_WRITE);
-        if (file) {
-            file.println("DateTime,Latitude,Longitude,Pressure");
-            file.close();
-            server.send(200, "text/plain", "GPS log reset successfully");
-        } else {
-            server.send(500, "text/plain", "Error creating new GPS log");
-        }
-    } else {
-        server.send(500, "text/plain", "Failed to delete GPS log");
-    }
+    queueLogRecord(LOG_PRESSURE_EVENT, pressure);
 }
 
-void handleDownloadGPSTrack() {
-    if (SD.exists("/gps_track.csv")) {
-        File file = SD.open("/gps_track.csv", FILE_READ);
-        if (file) {
-            server.sendHeader("Content-Type", "text/csv");
-            server.sendHeader("Content-Disposition", "attachment; filename=gps_track.csv");
-            server.streamFile(file, "text/csv");
-            file.close();
-        } else {
-            server.send(500, "text/plain", "Error reading track log");
-        }
-    } else {
-        server.send(404, "text/plain", "Track log not found");
-    }
+bool vehicleIsMoving()
+{
+    return motion.state == MOTION_MOVING;
 }
 
-void handleDeleteGPSTrack() {
-    if (SD.remove("/gps_track.csv")) {
-        File file = SD.open("/gps_track.csv", FILE_WRITE);
-        if (file) {
-            file.println("Date,Time,Latitude,Longitude,Satellites");
-            file.close();
-            server.send(200, "text/plain", "Track log reset successfully");
-        } else {
-            server.send(500, "text/plain", "Error creating new track log");
-        }
-    } else {
-        server.send(500, "text/plain", "Failed to delete track log");
+const char *motionStateName(MotionState state)
+{
+    switch (state)
+    {
+    case MOTION_STATIONARY:
+        return "Stationary";
+    case MOTION_MOVING:
+        return "Moving";
+    default:
+        return "Unknown";
     }
 }
 
-void checkPressureAndLog()
+// RMS distance in meters of the windowed fixes around their centroid
+float calculatePositionSpread()
 {
-    if (!bmpInitialized)
+    if (motion.count < 2)
+        return 0;
+
+    double latSum = 0, lngSum = 0;
+    for (int i = 0; i < motion.count; i++)
     {
-        serialPrintln("BMP sensor not initialized");
-        return;
+        latSum += motion.lat[i];
+        lngSum += motion.lng[i];
     }
+    double latMean = latSum / motion.count;
+    double lngMean = lngSum / motion.count;
 
-    float rawPressure = bmp.readPressure();
+    // Equirectangular approximation is plenty at these distances
+    const double metersPerDegree = 111320.0;
+    double lngScale = cos(latMean * M_PI / 180.0);
+    double sq = 0;
+    for (int i = 0; i < motion.count; i++)
+    {
+        double dy = (motion.lat[i] - latMean) * metersPerDegree;
+        double dx = (motion.lng[i] - lngMean) * metersPerDegree * lngScale;
+        sq += dx * dx + dy * dy;
+    }
+    return sqrt(sq / motion.count);
+}
+
+void setMotionState(MotionState state)
+{
+    if (motion.state == state)
+        return;
+
+    motion.state = state;
+    motion.stateSince = nowUs();
+    motion.trackPointLogged = false;
+    schedulerArm(jobGpsPower, 0);
+
+    char message[50];
+    snprintf(message, sizeof(message), "Motion state: %s", motionStateName(state));
+    serialPrintln(message);
+    liveStatusSetPosition();
+
+    if (state == MOTION_MOVING)
+    {
+        sampler.interval = currentConfig.sampleIntervalMin;
+        schedulerArm(jobSample, MS_TO_US(sampler.interval));
+        powerSetLowPower(false);
+    }
+}
+
+// Called for every new GPS fix
+void updateMotionState()
+{
+    if (!gpsFix.valid || gpsFix.hdop > MOTION_MAX_HDOP)
+        return;
+
+    motion.lat[motion.index] = gpsFix.lat;
+    motion.lng[motion.index] = gpsFix.lng;
+    motion.index = (motion.index + 1) % MOTION_WINDOW_SIZE;
+    if (motion.count < MOTION_WINDOW_SIZE)
+        motion.count++;
+
+    float speed = gpsFix.speedKmph;
+    float spreadLimit = MOTION_SPREAD_METERS * max(1.0f, gpsFix.hdop);
+    float spread = calculatePositionSpread();
+
+    bool movingFix = speed > MOTION_START_SPEED_KMPH || spread > spreadLimit;
+    bool stillFix = speed < MOTION_STOP_SPEED_KMPH && spread <= spreadLimit;
+
+    motion.movingFixes = movingFix ? motion.movingFixes + 1 : 0;
+    if (!stillFix)
+        motion.stillSince = 0;
+    else if (motion.stillSince == 0)
+        motion.stillSince = nowUs();
+
+    if (motion.state != MOTION_MOVING && motion.movingFixes >= MOTION_START_FIXES)
+    {
+        setMotionState(MOTION_MOVING);
+    }
+    else if (motion.state != MOTION_STATIONARY && motion.stillSince != 0 &&
+             nowUs() - motion.stillSince >= MS_TO_US(MOTION_STOP_TIME))
+    {
+        setMotionState(MOTION_STATIONARY);
+    }
+
+    if (motion.state == MOTION_STATIONARY && nowUs() - motion.stateSince >= MS_TO_US(LOW_POWER_IDLE_TIME))
+        powerSetLowPower(true);
+}
+
+// GPS power management: the NEO-6M runs at full power only while moving.
+// Parked it drops to UBX power save (cyclic tracking / ON-OFF), and after the
+// low-power idle time it sleeps in backup mode between track slots, waking
+// early enough for a hot start before the next track point is due. Backup
+// sleeps are capped so driving off is noticed within a minute, and sensor
+// activity ends them at once.
+#define GPS_CYCLIC_PERIOD 10000  // ms between fixes in power-save mode
+#define GPS_HOT_START_MS 5000    // Wake this early before a fix is needed
+#define GPS_FIX_WINDOW_MS 15000  // Stay awake this long after a backup wakeup
+#define GPS_MIN_BACKUP_MS 20000  // Shorter sleeps are not worth the restart
+#define GPS_MAX_BACKUP_MS 60000  // Longest sleep without a fix to check for motion
+
+enum GpsPowerMode
+{
+    GPS_POWER_CONTINUOUS,
+    GPS_POWER_SAVE,
+    GPS_POWER_BACKUP,
+    GPS_POWER_MODE_COUNT
+};
+
+struct GpsPowerManager
+{
+    GpsPowerMode mode = GPS_POWER_CONTINUOUS;
+    GpsPowerMode awakeMode = GPS_POWER_CONTINUOUS; // Mode restored after backup
+    uint32_t cyclicPeriod = 0;
+    TimeUs awakeSince = 0;
+    TimeUs modeSince = 0;
+    uint64_t timeInMode[GPS_POWER_MODE_COUNT] = {};
+};
+GpsPowerManager gpsPower;
+
+const char *gpsPowerModeName(GpsPowerMode mode)
+{
+    switch (mode)
+    {
+    case GPS_POWER_SAVE:
+        return "power save";
+    case GPS_POWER_BACKUP:
+        return "backup";
+    default:
+        return "continuous";
+    }
+}
+
+void ubxSend(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t length)
+{
+    uint8_t header[6] = {0xB5, 0x62, msgClass, msgId, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+    uint8_t ckA = 0, ckB = 0;
+    for (int i = 2; i < 6; i++)
+    {
+        ckA += header[i];
+        ckB += ckA;
+    }
+    for (uint16_t i = 0; i < length; i++)
+    {
+        ckA += payload[i];
+        ckB += ckA;
+    }
+    neo6m.write(header, sizeof(header));
+    if (length > 0)
+        neo6m.write(payload, length);
+    neo6m.write(ckA);
+    neo6m.write(ckB);
+}
+
+static void putU32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+}
+
+// Watch the NMEA stream for the ACK-ACK / ACK-NAK replies to our CFG messages
+// (called from the UART receive task)
+void ubxAckFeed(uint8_t c)
+{
+    static uint8_t frame[8];
+    static int length = 0;
+    static const uint8_t prefix[] = {0xB5, 0x62, 0x05};
+
+    if (length < 3 && c != prefix[length])
+    {
+        length = c == 0xB5 ? 1 : 0;
+        return;
+    }
+    frame[length++] = c;
+    if (length < (int)sizeof(frame))
+        return;
+    length = 0;
+
+    if (frame[4] != 2 || frame[5] != 0)
+        return;
+    UbxAck ack = {frame[6], frame[7], frame[3] == 1};
+    ubxAckQueue.push(ack);
+}
+
+void gpsPowerSetMode(GpsPowerMode mode)
+{
+    TimeUs now = nowUs();
+    gpsPower.timeInMode[gpsPower.mode] += now - gpsPower.modeSince;
+    gpsPower.modeSince = now;
+    if (gpsPower.mode == mode)
+        return;
+    gpsPower.mode = mode;
+
+    char message[50];
+    snprintf(message, sizeof(message), "GPS power mode: %s", gpsPowerModeName(mode));
+    serialPrintln(message);
+}
+
+void gpsSetMaxPerformance()
+{
+    const uint8_t rxm[2] = {8, 0}; // CFG-RXM lpMode 0: max performance
+    ubxSend(0x06, 0x11, rxm, sizeof(rxm));
+    gpsPower.awakeMode = GPS_POWER_CONTINUOUS;
+    gpsPowerSetMode(GPS_POWER_CONTINUOUS);
+}
+
+// u-blox 6 picks cyclic tracking for short update periods and ON/OFF
+// operation for long ones on its own
+void gpsSetPowerSave(uint32_t updatePeriod)
+{
+    uint8_t pm2[44] = {0};
+    pm2[0] = 1;                                          // version
+    putU32(&pm2[4], (1 << 12) | (1 << 11) | (1 << 10) | (1 << 8)); // updateEPH, updateRTC, waitTimeFix, limitPeakCurr
+    putU32(&pm2[8], updatePeriod);                       // updatePeriod (ms)
+    putU32(&pm2[12], updatePeriod * 2);                  // searchPeriod (ms)
+    ubxSend(0x06, 0x3B, pm2, sizeof(pm2));
+
+    const uint8_t rxm[2] = {8, 1}; // CFG-RXM lpMode 1: power save
+    ubxSend(0x06, 0x11, rxm, sizeof(rxm));
+
+    gpsPower.cyclicPeriod = updatePeriod;
+    gpsPower.awakeMode = GPS_POWER_SAVE;
+    gpsPowerSetMode(GPS_POWER_SAVE);
+}
+
+void gpsEnterBackup(uint32_t duration)
+{
+    uint8_t pmreq[8];
+    putU32(&pmreq[0], duration); // duration (ms), the receiver wakes itself
+    putU32(&pmreq[4], 1 << 1);   // flags: backup
+    ubxSend(0x02, 0x41, pmreq, sizeof(pmreq));
+    gpsPowerSetMode(GPS_POWER_BACKUP);
+}
+
+GpsPowerMode gpsPowerPolicy()
+{
+    // Sensor events and the track need live fixes while moving
+    if (motion.state != MOTION_STATIONARY)
+        return GPS_POWER_CONTINUOUS;
+    // Parked: fixes only have to notice when we drive off
+    if (!power.lowPower)
+        return GPS_POWER_SAVE;
+    return GPS_POWER_BACKUP;
+}
+
+void runGpsPowerJob()
+{
+    if (gpsPower.mode == GPS_POWER_BACKUP)
+        return; // The wakeup job re-evaluates
+
+    GpsPowerMode wanted = gpsPowerPolicy();
+    uint32_t cyclicPeriod = min((uint64_t)GPS_CYCLIC_PERIOD, (uint64_t)currentConfig.trackLogInterval * 1000);
+
+    if (wanted == GPS_POWER_CONTINUOUS)
+    {
+        if (gpsPower.mode != GPS_POWER_CONTINUOUS)
+            gpsSetMaxPerformance();
+        return;
+    }
+    if (wanted == GPS_POWER_SAVE || gpsPower.awakeMode == GPS_POWER_CONTINUOUS)
+    {
+        if (gpsPower.mode != GPS_POWER_SAVE || gpsPower.cyclicPeriod != cyclicPeriod)
+            gpsSetPowerSave(cyclicPeriod);
+        if (wanted == GPS_POWER_SAVE)
+            return;
+    }
+
+    // Backup: leave time for fresh fixes after each wakeup, then sleep until
+    // a hot start before the next track slot
+    TimeUs now = nowUs();
+    if (now - gpsPower.awakeSince < MS_TO_US(GPS_FIX_WINDOW_MS))
+    {
+        schedulerArm(jobGpsPower, MS_TO_US(GPS_FIX_WINDOW_MS) - (now - gpsPower.awakeSince));
+        return;
+    }
+    TimeUs trackDue = scheduler.jobs[jobTrackLog].deadline;
+    TimeUs untilTrack = trackDue > now ? trackDue - now : 0;
+    if (untilTrack < MS_TO_US(GPS_HOT_START_MS + GPS_MIN_BACKUP_MS))
+    {
+        schedulerArm(jobGpsPower, untilTrack + MS_TO_US(GPS_FIX_WINDOW_MS));
+        return;
+    }
+    TimeUs sleepTime = untilTrack - MS_TO_US(GPS_HOT_START_MS);
+    if (sleepTime > MS_TO_US(GPS_MAX_BACKUP_MS))
+        sleepTime = MS_TO_US(GPS_MAX_BACKUP_MS);
+    gpsEnterBackup(sleepTime / 1000);
+    schedulerArm(jobGpsWakeup, sleepTime);
+}
+
+void runGpsWakeupJob()
+{
+    // Any UART activity also wakes the receiver if its own timer lags
+    const uint8_t wake[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    neo6m.write(wake, sizeof(wake));
+    gpsPower.awakeSince = nowUs();
+    gpsPowerSetMode(gpsPower.awakeMode);
+    schedulerArm(jobGpsPower, MS_TO_US(GPS_FIX_WINDOW_MS));
+}
+
+// Flow or a pressure event while parked usually means work is starting and
+// the vehicle may move: wake the receiver now rather than at the next slot
+void gpsWakeForActivity()
+{
+    if (gpsPower.mode == GPS_POWER_BACKUP)
+        schedulerArm(jobGpsWakeup, 0);
+}
+
+// Runs in the UART event task whenever NMEA bytes arrive. Only this task
+// touches the TinyGPSPlus parser; results reach the loop through queues.
+void gpsReceive()
+{
+    uint32_t received = 0;
+    while (neo6m.available() > 0)
+    {
+        char c = neo6m.read();
+        received++;
+        ubxAckFeed(c);
+        GpsFix fix;
+        if (gpsIngestByte(gps, c, nowUs(), fix))
+            gpsFixQueue.push(fix);
+    }
+    if (received > 0)
+    {
+        gpsRxBytes += received;
+        schedulerTrigger(jobGps);
+    }
+}
+
+void processGPS()
+{
+    static TimeUs lastBuzzerToggle = 0;
+    static bool buzzerState = false;
+    static GpsLockMonitor lock;
+    static uint32_t lastRxBytes = 0;
+
+    uint32_t rxBytes = gpsRxBytes;
+    if (rxBytes != lastRxBytes)
+    {
+        lastRxBytes = rxBytes;
+        powerGpsData();
+    }
+
+    UbxAck ack;
+    while (ubxAckQueue.pop(ack))
+    {
+        char message[50];
+        snprintf(message, sizeof(message), "GPS %s for UBX %02X-%02X",
+                 ack.ack ? "ACK" : "NAK", ack.msgClass, ack.msgId);
+        serialPrintln(message);
+    }
+
+    GpsFix fix;
+    while (gpsFixQueue.pop(fix))
+    {
+        gpsFix = fix;
+        updateMotionState();
+        updateGeofences();
+    }
+    liveStatusSetPosition();
+
+    // Report lock changes
+    GpsLockEvent lockEvent = lock.update(gpsFix);
+    if (lockEvent != GPS_LOCK_UNCHANGED)
+        serialPrintln(gpsLockEventMessage(lockEvent));
+    if (lockEvent == GPS_LOCK_ACQUIRED)
+        digitalWrite(BUZZER_PIN, LOW); // Turn off buzzer when lock is acquired
+    
+    // Beep the buzzer if no GPS lock or not enough satellites
+    if (!lock.locked) {
+        // Toggle buzzer every 1 second for alert pattern
+        if (nowUs() - lastBuzzerToggle >= MS_TO_US(1000)) {
+            buzzerState = !buzzerState;
+            digitalWrite(BUZZER_PIN, buzzerState);
+            lastBuzzerToggle = nowUs();
+        }
+    }
+
+    if (nowUs() > MS_TO_US(5000) && rxBytes < 10)
+    {
+        serialPrintln("No GPS detected");
+        // Continuous buzz for no GPS module detected (different pattern)
+        if (nowUs() - lastBuzzerToggle >= MS_TO_US(500)) {
+            buzzerState = !buzzerState;
+            digitalWrite(BUZZER_PIN, buzzerState);
+            lastBuzzerToggle = nowUs();
+        }
+    }
+}
+
+void addFlowReading(float flow)
+{
+    flowHistory.readings[flowHistory.index] = flow;
+    flowHistory.index = (flowHistory.index + 1) % PRESSURE_HISTORY_SIZE;
+    if (flowHistory.count < PRESSURE_HISTORY_SIZE)
+        flowHistory.count++;
+    flowC = flowB;
+    flowB = flowA;
+    flowA = flow;
+}
+
+float calculateAverageFlow()
+{
+    if (flowHistory.count == 0)
+        return 0;
+    float sum = 0;
+    for (int i = 0; i < flowHistory.count; i++)
+        sum += flowHistory.readings[i];
+    return sum / flowHistory.count;
+}
+
+void checkFlowAndLog()
+{
+    static TimeUs lastCheckTime = 0;
+    TimeUs currentTime = nowUs();
+    TimeUs timeDiff = currentTime - lastCheckTime;
+    TimeUs test1 = MS_TO_US(100);
+
+    // Add guard clause for time difference
+    if (timeDiff == 0)
+        return;
+
+    if (timeDiff >= MS_TO_US(1000))
+    {
+        static uint32_t lastDropped = 0;
+
+        // Count the pulses stamped inside this window; pulses the ISR could
+        // not queue still count towards the rate
+        uint32_t pulses = 0;
+        TimeUs stamp;
+        while (pulseQueue.peek(stamp) && stamp <= currentTime)
+        {
+            pulseQueue.pop(stamp);
+            pulses++;
+        }
+        uint32_t dropped = pulseQueue.dropped();
+        pulses += dropped - lastDropped;
+        lastDropped = dropped;
+
+        flowRate = (pulses / calibrationFactor) * (1000000.0 / max(timeDiff, test1));
+        lastCheckTime = currentTime;
+        powerUpdateFlow(pulses > 0);
+        if (pulses > 0)
+            gpsWakeForActivity();
+
+        addFlowReading(flowRate);
+        sensorHistory.add(currentTime, flowRate);
+    }
+    float averageFlow = calculateAverageFlow();
+    float threshold = averageFlow * (1.0 + (currentConfig.flowThreshold / 100.0));
+    liveStatusSetReading(flowRate, averageFlow, threshold);
+    adaptSampleInterval(flowRate, averageFlow,
+                        calculateVariation(flowHistory.readings, flowHistory.count),
+                        currentConfig.flowThreshold);
+
+    if (flowRate > 12 && nowUs() - lastLogTime > MS_TO_US(1500) && flowA <= flowB && flowB >= flowC)
+    {
+        lastLogTime = nowUs();
+        char msg[100];
+        snprintf(msg, sizeof(msg), "Flow rate: %.2f L/min (Avg: %.2f/T: %.2f)", flowRate, averageFlow, threshold);
+        serialPrintln(msg);
+        logGPSDataFlow(flowRate);
+    }
+}
+
+void logGPSDataFlow(float flow)
+{
+    if (!sdCardAvailable || !gpsFix.valid)
+        return;
+    if (motion.state == MOTION_STATIONARY)
+    {
+        serialPrintln("Stationary, flow event not logged");
+        return;
+    }
+    if (!geofenceAllowsLogging())
+    {
+        serialPrintln("In a no-log geofence, flow event not logged");
+        return;
+    }
+
+    queueLogRecord(LOG_FLOW_EVENT, flow);
+}
+
+// Hand a record to the SD writer; producers never touch the card themselves
+void queueLogRecord(LogRecordType type, float value)
+{
+    LogRecord record;
+    record.type = type;
+    record.satellites = gpsFix.satellites;
+    record.unixTime = rtc.now().unixtime();
+    record.lat = gpsFix.lat;
+    record.lng = gpsFix.lng;
+    record.value = value;
+
+    if (!logQueue.push(record))
+    {
+        serialPrintln("Log queue full, record dropped");
+        return;
+    }
+    schedulerTrigger(jobLogger);
+}
+
+const char *logOverflowPolicyName(int policy)
+{
+    switch (policy)
+    {
+    case LOG_OVERFLOW_DROP_OLDEST:
+        return "Drop oldest";
+    case LOG_OVERFLOW_DROP_NEWEST:
+        return "Drop newest";
+    default:
+        return "Block";
+    }
+}
+
+// Logger task: writes every buffer handed over by the loop, then frees it
+void loggerTask(void *parameter)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (int s = 0; s < LOG_STREAM_COUNT; s++)
+        {
+            LogStream &stream = logStreams[s];
+            for (int b = 0; b < 2; b++)
+            {
+                LogBuffer &buffer = stream.buffers[b];
+                if (!__atomic_load_n(&buffer.flushing, __ATOMIC_ACQUIRE))
+                    continue;
+
+                TimeUs start = nowUs();
+                bool ok = true;
+                for (size_t i = 0; i < buffer.count; i++)
+                    ok &= stream.series.append(buffer.records[i]);
+                ok &= stream.series.sync();
+                if (ok)
+                    stream.recordsWritten += buffer.count;
+                else
+                    stream.flushErrors++;
+
+                stream.flushes++;
+                stream.maxFlushUs = max(stream.maxFlushUs, (uint32_t)(nowUs() - start));
+                buffer.count = 0;
+                __atomic_store_n(&buffer.flushing, false, __ATOMIC_RELEASE);
+                xSemaphoreGive(logBufferFreed);
+            }
+        }
+        logGeofenceEvents();
+    }
+}
+
+// Note what the store had to repair after an unclean power-off
+void logRecoveryEvent(const TsSeries &series)
+{
+    const TsRecovery &recovery = series.recovery();
+    if (!recovery.repaired())
+        return;
+
+    char message[128]; // Longest series name and counts
+    snprintf(message, sizeof(message), "Recovered %s: %u torn blocks cut, %u index entries rebuilt%s",
+             series.name(), recovery.blocksTruncated, recovery.indexRebuilt,
+             recovery.truncateFailed ? " (truncate failed)" : "");
+    serialPrintln(message);
+
+    File file = SD.open(TS_STORE_DIR "/recovery.csv", FILE_APPEND);
+    if (!file)
+        return;
+    if (file.size() == 0)
+        file.println("DateTime,Series,BlocksChecked,BlocksTruncated,BytesTruncated,IndexRebuilt,TruncateFailed");
+    DateTime now = rtc.now();
+    file.printf("%02d/%02d/%04d %02d:%02d:%02d,%s,%u,%u,%u,%u,%d\n",
+                now.day(), now.month(), now.year(), now.hour(), now.minute(), now.second(),
+                series.name(), recovery.blocksChecked, recovery.blocksTruncated,
+                recovery.bytesTruncated, recovery.indexRebuilt, recovery.truncateFailed);
+    file.close();
+}
+
+void initLogger()
+{
+    logStreams[LOG_PRESSURE_EVENT].series.begin(SD, "pressure", TS_COLUMNS);
+    logStreams[LOG_FLOW_EVENT].series.begin(SD, "flow", TS_COLUMNS);
+    logStreams[LOG_TRACK_POINT].series.begin(SD, "track", TS_COLUMNS);
+
+    if (sdCardAvailable)
+    {
+        for (int s = 0; s < LOG_STREAM_COUNT; s++)
+            logRecoveryEvent(logStreams[s].series);
+    }
+
+    logBufferFreed = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(loggerTask, "logger", LOG_TASK_STACK, nullptr, 1, &loggerTaskHandle, 0);
+}
+
+// Hand the active buffer to the logger task. Fails if the other buffer is
+// still being written.
+bool logSwapBuffers(LogStream &stream)
+{
+    LogBuffer &active = stream.buffers[stream.active];
+    if (active.count == 0)
+        return true;
+    if (__atomic_load_n(&stream.buffers[stream.active ^ 1].flushing, __ATOMIC_ACQUIRE))
+        return false;
+
+    __atomic_store_n(&active.flushing, true, __ATOMIC_RELEASE);
+    stream.active ^= 1;
+    xTaskNotifyGive(loggerTaskHandle);
+    return true;
+}
+
+bool logAppend(LogRecordType type, const TsRecord &record)
+{
+    LogStream &stream = logStreams[type];
+
+    if (stream.buffers[stream.active].count == LOG_BUFFER_RECORDS && !logSwapBuffers(stream))
+    {
+        LogBuffer &full = stream.buffers[stream.active];
+        switch (currentConfig.logOverflowPolicy)
+        {
+        case LOG_OVERFLOW_DROP_NEWEST:
+            stream.recordsDropped++;
+            return false;
+        case LOG_OVERFLOW_DROP_OLDEST:
+            memmove(full.records, full.records + 1, (LOG_BUFFER_RECORDS - 1) * sizeof(TsRecord));
+            full.count--;
+            stream.recordsDropped++;
+            break;
+        default:
+            stream.blockedWaits++;
+            while (!logSwapBuffers(stream))
+                xSemaphoreTake(logBufferFreed, pdMS_TO_TICKS(100));
+            break;
+        }
+    }
+
+    LogBuffer &buffer = stream.buffers[stream.active];
+    if (buffer.count == 0)
+        schedulerArm(jobLogFlush, MS_TO_US(LOG_FLUSH_INTERVAL));
+    buffer.records[buffer.count++] = record;
+    return true;
+}
+
+// Push partly filled buffers out so data reaches the card within the flush interval
+void runLogFlushJob()
+{
+    bool pending = false;
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        if (!logSwapBuffers(logStreams[s]))
+            pending = true;
+    }
+    if (pending)
+        schedulerArm(jobLogFlush, MS_TO_US(LOG_FLUSH_INTERVAL));
+}
+
+// Convert queued records to store rows and buffer them
+void runLoggerJob()
+{
+    LogRecord record;
+    while (logQueue.pop(record))
+    {
+        TsRecord row = {};
+        row.time = record.unixTime;
+        row.values[TS_COL_LAT] = lround(record.lat * TS_COORD_SCALE);
+        row.values[TS_COL_LNG] = lround(record.lng * TS_COORD_SCALE);
+        if (record.type == LOG_TRACK_POINT)
+            row.values[TS_COL_VALUE] = record.satellites;
+        else
+            row.values[TS_COL_VALUE] = lroundf(record.value * TS_VALUE_SCALE);
+        logAppend(record.type, row);
+
+        if (record.type == LOG_PRESSURE_EVENT)
+        {
+            char message[50];
+            snprintf(message, sizeof(message), "Logged data: %.2f hPa", record.value);
+            serialPrintln(message);
+        }
+    }
+}
+
+// Format a stored row in the CSV layout the old log files used
+int formatLogRow(LogRecordType type, const TsRecord &row, char *line, size_t size)
+{
+    DateTime time(row.time);
+    double lat = row.values[TS_COL_LAT] / TS_COORD_SCALE;
+    double lng = row.values[TS_COL_LNG] / TS_COORD_SCALE;
+
+    switch (type)
+    {
+    case LOG_TRACK_POINT:
+        return snprintf(line, size, "%02d/%02d/%04d,%02d:%02d:%02d,%.6f,%.6f,%d\n",
+                        time.day(), time.month(), time.year(),
+                        time.hour(), time.minute(), time.second(),
+                        lat, lng, (int)row.values[TS_COL_VALUE]);
+    default:
+        // Pressure and flow events share gps_log.csv and its DateTime column
+        return snprintf(line, size, "%02d/%02d/%04d %02d:%02d:%02d,%.6f,%.6f,%.2f\n",
+                        time.day(), time.month(), time.year(),
+                        time.hour(), time.minute(), time.second(),
+                        lat, lng, row.values[TS_COL_VALUE] / (float)TS_VALUE_SCALE);
+    }
+}
+
+// Optional from/to query arguments (Unix seconds) bounding a range scan
+void logQueryRange(uint32_t &from, uint32_t &to)
+{
+    from = server.hasArg("from") ? strtoul(server.arg("from").c_str(), nullptr, 10) : 0;
+    to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), nullptr, 10) : UINT32_MAX;
+}
+
+// Stream a CSV built from one or two series, merged by time
+void sendLogCsv(const char *fileName, const char *header, LogRecordType first, int second)
+{
+    // Static so the block buffers stay off the loop task's stack
+    static TsIterator iterators[2];
+    uint32_t from, to;
+    logQueryRange(from, to);
+
+    LogRecordType types[2] = {first, (LogRecordType)(second < 0 ? first : second)};
+    int sources = second < 0 ? 1 : 2;
+    TsRecord rows[2];
+    bool have[2] = {false, false};
+    for (int i = 0; i < sources; i++)
+    {
+        iterators[i].reset(logStreams[types[i]].series, from, to);
+        have[i] = iterators[i].next(rows[i]);
+    }
+
+    server.sendHeader("Content-Disposition", String("attachment; filename=") + fileName);
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/csv", "");
+
+    char chunk[1024];
+    size_t used = snprintf(chunk, sizeof(chunk), "%s\n", header);
+    while (have[0] || have[1])
+    {
+        int pick = !have[0] || (have[1] && rows[1].time < rows[0].time) ? 1 : 0;
+        char line[100];
+        int length = formatLogRow(types[pick], rows[pick], line, sizeof(line));
+        if (used + length > sizeof(chunk))
+        {
+            server.sendContent(chunk, used);
+            used = 0;
+        }
+        memcpy(chunk + used, line, length);
+        used += length;
+        have[pick] = iterators[pick].next(rows[pick]);
+    }
+    if (used)
+        server.sendContent(chunk, used);
+    server.sendContent("");
+}
+
+// JSON range query: /query?series=pressure|flow|track&from=&to=&limit=
+// Stream index for a series name, or -1
+int logSeriesByName(const String &name)
+{
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        if (name == logStreams[s].series.name())
+            return s;
+    }
+    return -1;
+}
+
+void handleQuery()
+{
+    static TsIterator iterator;
+    int type = logSeriesByName(server.arg("series"));
+    if (type < 0)
+    {
+        server.send(400, "text/plain", "Unknown series");
+        return;
+    }
+
+    uint32_t from, to;
+    logQueryRange(from, to);
+    long limit = server.hasArg("limit") ? server.arg("limit").toInt() : 1000;
+    iterator.reset(logStreams[type].series, from, to);
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+    server.sendContent("[");
+
+    TsRecord row;
+    for (long n = 0; n < limit && iterator.next(row); n++)
+    {
+        char entry[100];
+        int length = snprintf(entry, sizeof(entry), "%s{\"t\":%u,\"lat\":%.6f,\"lng\":%.6f,\"v\":",
+                              n ? "," : "", (unsigned)row.time,
+                              row.values[TS_COL_LAT] / TS_COORD_SCALE, row.values[TS_COL_LNG] / TS_COORD_SCALE);
+        if (type == LOG_TRACK_POINT)
+            length += snprintf(entry + length, sizeof(entry) - length, "%d}", (int)row.values[TS_COL_VALUE]);
+        else
+            length += snprintf(entry + length, sizeof(entry) - length, "%.2f}", row.values[TS_COL_VALUE] / (float)TS_VALUE_SCALE);
+        server.sendContent(entry, length);
+    }
+    server.sendContent("]");
+    server.sendContent("");
+}
+
+void handleLoggerStats()
+{
+    ArenaString json(requestArena, 1024);
+    json.appendf("{\"policy\":\"%s\",\"queueDropped\":%u", logOverflowPolicyName(currentConfig.logOverflowPolicy),
+                 (unsigned)logQueue.dropped());
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        LogStream &stream = logStreams[s];
+        json.appendf(",\"%s\":{\"buffered\":%u,\"recordsWritten\":%u,\"recordsDropped\":%u,\"blockedWaits\":%u,"
+                     "\"flushes\":%u,\"flushErrors\":%u,\"maxFlushUs\":%u,\"blocks\":%u,\"records\":%u,"
+                     "\"recoveredBlocks\":%u}",
+                     stream.series.name(), (unsigned)stream.buffers[stream.active].count,
+                     (unsigned)stream.recordsWritten, (unsigned)stream.recordsDropped, (unsigned)stream.blockedWaits,
+                     (unsigned)stream.flushes, (unsigned)stream.flushErrors, (unsigned)stream.maxFlushUs,
+                     (unsigned)stream.series.blockCount(), (unsigned)stream.series.recordCount(),
+                     (unsigned)stream.series.recovery().blocksTruncated);
+    }
+    json += "}";
+    sendArena(200, "application/json", json);
+}
+
+// Store-and-forward upload. Whenever the station link is up, new records of
+// each series are packed into store blocks (already delta/varint
+// compressed) and POSTed to the collector in batches. The collector answers
+// with the number of records of that series it now holds, which becomes the
+// acknowledged offset; the next batch resumes from there, so an interrupted
+// upload is simply retried.
+#define UPLOAD_BATCH_RECORDS 256
+#define UPLOAD_BATCH_BLOCKS 8      // Body limit per POST, in store blocks
+#define UPLOAD_TASK_STACK 8192
+#define UPLOAD_HTTP_TIMEOUT 10000  // ms
+#define UPLOAD_MAX_BACKOFF 32      // Upload intervals skipped after repeated failures
+
+struct UploadState
+{
+    uint32_t acked[LOG_STREAM_COUNT];      // Records the collector has confirmed
+    uint32_t generation[LOG_STREAM_COUNT]; // Bumped when a series is cleared
+    uint32_t batches = 0;
+    uint32_t failures = 0;
+    uint32_t bytesSent = 0;
+    int lastStatus = 0;     // HTTP status or HTTPClient error of the last POST
+    uint32_t backoff = 0;   // Intervals to wait after the last failure
+    uint32_t skipped = 0;   // Intervals waited so far
+};
+
+UploadState upload;
+TaskHandle_t uploadTaskHandle = nullptr;
+
+bool uploadConfigured()
+{
+    return currentConfig.uploadEnabled && currentConfig.staSsid[0] && currentConfig.collectorUrl[0];
+}
+
+// Acknowledged offsets live next to the store as "<generation> <offset>"
+void uploadSaveAck(int type)
+{
+    char path[40];
+    snprintf(path, sizeof(path), TS_STORE_DIR "/%s.ack", logStreams[type].series.name());
+    File file = SD.open(path, FILE_WRITE);
+    if (!file)
+        return;
+    file.printf("%u %u\n", (unsigned)upload.generation[type], (unsigned)upload.acked[type]);
+    file.close();
+}
+
+void uploadResetSeries(int type)
+{
+    upload.generation[type]++;
+    upload.acked[type] = 0;
+    uploadSaveAck(type);
+}
+
+// Send records from the acknowledged offset on until the collector has them
+// all. Returns false if the collector could not be reached or refused.
+bool uploadSeries(int type)
+{
+    // Static: only the upload task runs this
+    static TsIterator iterator;
+    static TsRecord rows[UPLOAD_BATCH_RECORDS];
+    static uint8_t body[UPLOAD_BATCH_BLOCKS * TS_BLOCK_SIZE];
+
+    TsSeries &series = logStreams[type].series;
+    uint32_t generation = upload.generation[type];
+    uint32_t total = series.recordCount();
+    if (upload.acked[type] > total)
+        upload.acked[type] = total; // Store was cut back by crash recovery
+
+    while (upload.acked[type] < total && WiFi.status() == WL_CONNECTED)
+    {
+        // Gather a run of consecutive ordinals. An unreadable block leaves a
+        // gap, which ends the batch; the next one starts past it.
+        iterator.resetAtRecord(series, upload.acked[type]);
+        uint32_t first = 0;
+        int count = 0;
+        TsRecord row;
+        while (count < UPLOAD_BATCH_RECORDS && iterator.next(row))
+        {
+            if (count == 0)
+                first = iterator.ordinal();
+            else if (iterator.ordinal() != first + count)
+                break;
+            rows[count++] = row;
+        }
+        if (count == 0)
+            return true;
+
+        size_t length = 0;
+        int packed = 0;
+        while (packed < count && length + TS_BLOCK_SIZE <= sizeof(body))
+        {
+            packed += series.packBlock(rows + packed, count - packed, first + packed, body + length);
+            length += TsSeries::blockLength(body + length);
+        }
+
+        char url[sizeof(currentConfig.collectorUrl) + 80];
+        snprintf(url, sizeof(url), "%s?series=%s&generation=%u&offset=%u&count=%d",
+                 currentConfig.collectorUrl, series.name(), (unsigned)generation, (unsigned)first, packed);
+
+        HTTPClient http;
+        http.setTimeout(UPLOAD_HTTP_TIMEOUT);
+        if (!http.begin(url))
+            return false;
+        http.addHeader("Content-Type", "application/x-aspol-ts");
+        http.addHeader("X-Device", currentConfig.deviceName);
+        int status = http.POST(body, length);
+        String reply = status == HTTP_CODE_OK ? http.getString() : String();
+        http.end();
+
+        upload.lastStatus = status;
+        if (status != HTTP_CODE_OK)
+            return false;
+        if (upload.generation[type] != generation)
+            return true; // Series was cleared while the batch was in flight
+
+        // The collector is authoritative: a lower offset means it lost data
+        // and we resend from there next round
+        uint32_t acked = min((uint32_t)strtoul(reply.c_str(), nullptr, 10), first + packed);
+        bool progressed = acked > upload.acked[type];
+        upload.acked[type] = acked;
+        uploadSaveAck(type);
+        upload.batches++;
+        upload.bytesSent += length;
+        if (!progressed)
+            return false;
+
+        total = series.recordCount();
+    }
+    return true;
+}
+
+void uploadTask(void *parameter)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!uploadConfigured() || WiFi.status() != WL_CONNECTED)
+            continue;
+
+        bool ok = true;
+        for (int s = 0; s < LOG_STREAM_COUNT && ok; s++)
+            ok = uploadSeries(s);
+
+        if (ok)
+        {
+            upload.backoff = 0;
+        }
+        else
+        {
+            upload.failures++;
+            upload.backoff = min(max(upload.backoff * 2, (uint32_t)1), (uint32_t)UPLOAD_MAX_BACKOFF);
+            upload.skipped = 0;
+        }
+    }
+}
+
+void initUploader()
+{
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        char path[40];
+        snprintf(path, sizeof(path), TS_STORE_DIR "/%s.ack", logStreams[s].series.name());
+        File file = SD.open(path, FILE_READ);
+        if (!file)
+            continue;
+        upload.generation[s] = file.parseInt();
+        upload.acked[s] = file.parseInt();
+        file.close();
+    }
+
+    xTaskCreatePinnedToCore(uploadTask, "upload", UPLOAD_TASK_STACK, nullptr, 1, &uploadTaskHandle, 0);
+}
+
+// Hand a round to the upload task, backing off while the collector fails
+void runUploadJob()
+{
+    if (!uploadConfigured() || WiFi.status() != WL_CONNECTED)
+        return;
+    if (upload.skipped < upload.backoff)
+    {
+        upload.skipped++;
+        return;
+    }
+    xTaskNotifyGive(uploadTaskHandle);
+}
+
+void handleUploadStatus()
+{
+    ArenaString json(requestArena, 512);
+    json.appendf("{\"enabled\":%s,\"connected\":%s,\"batches\":%u,\"failures\":%u,\"bytesSent\":%u,"
+                 "\"lastStatus\":%d,\"backoff\":%u",
+                 uploadConfigured() ? "true" : "false", WiFi.status() == WL_CONNECTED ? "true" : "false",
+                 (unsigned)upload.batches, (unsigned)upload.failures, (unsigned)upload.bytesSent,
+                 (int)upload.lastStatus, (unsigned)upload.backoff);
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        TsSeries &series = logStreams[s].series;
+        json.appendf(",\"%s\":{\"acked\":%u,\"pending\":%u}", series.name(), (unsigned)upload.acked[s],
+                     (unsigned)(series.recordCount() - min(upload.acked[s], series.recordCount())));
+    }
+    json += "}";
+    sendArena(200, "application/json", json);
+}
+
+// MQTT telemetry. Each series is published as CBOR batches to
+// aspol/<device>/<series>, one batch per window, from a per-series
+// published offset. The store itself is the offline queue: nothing is
+// copied aside while the broker is unreachable, the offset just stops
+// moving, and on reconnect publishing resumes from it. With QoS 1 the
+// offset only advances on PUBACK. Until then the client's outbox holds the
+// batch and resends it after a reconnect; only once the outbox gives up on
+// a batch (MQTT_EVENT_DELETED) and holds nothing else of that series is the
+// series replayed from the store. At QoS 0 the offset advances as soon as
+// the batch is handed to the client. RAM use is bounded by
+// MQTT_MAX_INFLIGHT batches per series, each held once, in the outbox.
+// Replays can repeat rows, so subscribers dedupe on gen/off.
+//
+// Batch payload, a CBOR map:
+//   dev  device name        ser  series name
+//   gen  series generation  off  ordinal of the first row
+//   t0   time of the first row (Unix s)
+//   rows [[t - t0, lat µdeg, lng µdeg, value], ...]
+// value is hundredths of hPa or L/min, or the satellite count for track.
+#define MQTT_TOPIC_ROOT "aspol"
+#define MQTT_BATCH_RECORDS 32
+#define MQTT_MAX_INFLIGHT 4      // Unacknowledged batches per series
+#define MQTT_PAYLOAD_SIZE 1024   // Worst case 32 rows is about 700 bytes
+#define MQTT_ROW_MAX_BYTES 24    // Largest encoding of one row
+
+struct MqttInflight
+{
+    int msgId; // 0 once acknowledged, -1 once dropped from the outbox
+    uint32_t end;
+};
+
+struct MqttSeriesState
+{
+    uint32_t acked; // Records confirmed by the broker
+    uint32_t sent;  // Records handed to the client
+    MqttInflight inflight[MQTT_MAX_INFLIGHT];
+    uint8_t inflightCount;
+    bool dirty; // acked changed since it was last saved
+};
+
+struct MqttState
+{
+    esp_mqtt_client_handle_t client = nullptr;
+    volatile bool connected = false;
+    MqttSeriesState series[LOG_STREAM_COUNT];
+    char device[32];  // deviceName made safe for topics
+    char statusTopic[64];
+    uint32_t batches = 0;
+    uint32_t acks = 0;
+    uint32_t connects = 0;
+    uint32_t enqueueFailures = 0;
+    uint32_t expired = 0; // Series replayed after the outbox dropped a batch
+};
+
+MqttState mqtt;
+portMUX_TYPE mqttMux = portMUX_INITIALIZER_UNLOCKED; // Guards series state shared with the MQTT task
+
+bool mqttConfigured()
+{
+    return currentConfig.mqttEnabled && currentConfig.mqttUri[0] && currentConfig.staSsid[0];
+}
+
+void mqttSaveAck(int type)
+{
+    char path[40];
+    snprintf(path, sizeof(path), TS_STORE_DIR "/%s.mqt", logStreams[type].series.name());
+    File file = SD.open(path, FILE_WRITE);
+    if (!file)
+        return;
+    file.printf("%u %u\n", (unsigned)upload.generation[type], (unsigned)mqtt.series[type].acked);
+    file.close();
+}
+
+// Called after uploadResetSeries(), which owns the series generation
+void mqttResetSeries(int type)
+{
+    portENTER_CRITICAL(&mqttMux);
+    MqttSeriesState &state = mqtt.series[type];
+    state.acked = 0;
+    state.sent = 0;
+    state.inflightCount = 0;
+    state.dirty = false;
+    portEXIT_CRITICAL(&mqttMux);
+    mqttSaveAck(type);
+}
+
+// A batch the outbox dropped is published again from the acknowledged
+// offset, but only once no batch of its series is left in the outbox, so
+// nothing still queued there is sent twice. Call with mqttMux held.
+void mqttReplayDropped(MqttSeriesState &state)
+{
+    bool queued = false;
+    bool dropped = false;
+    for (int i = 0; i < state.inflightCount; i++)
+    {
+        queued |= state.inflight[i].msgId > 0;
+        dropped |= state.inflight[i].msgId < 0;
+    }
+    if (!dropped || queued)
+        return;
+    state.sent = state.acked;
+    state.inflightCount = 0;
+    mqtt.expired++;
+}
+
+// Runs in the MQTT client task
+void mqttEventHandler(void *args, esp_event_base_t base, int32_t eventId, void *eventData)
+{
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)eventData;
+    switch ((esp_mqtt_event_id_t)eventId)
+    {
+    case MQTT_EVENT_CONNECTED:
+        mqtt.connected = true;
+        mqtt.connects++;
+        esp_mqtt_client_enqueue(mqtt.client, mqtt.statusTopic, "online", 0, 1, 1, true);
+        schedulerTrigger(jobMqtt);
+        break;
+
+    case MQTT_EVENT_DISCONNECTED:
+        // Batches in flight stay in the outbox, which resends them
+        mqtt.connected = false;
+        break;
+
+    case MQTT_EVENT_DELETED:
+        // The outbox expired a batch without a PUBACK
+        portENTER_CRITICAL(&mqttMux);
+        for (int s = 0; s < LOG_STREAM_COUNT; s++)
+        {
+            MqttSeriesState &state = mqtt.series[s];
+            for (int i = 0; i < state.inflightCount; i++)
+            {
+                if (state.inflight[i].msgId == event->msg_id)
+                    state.inflight[i].msgId = -1;
+            }
+            mqttReplayDropped(state);
+        }
+        portEXIT_CRITICAL(&mqttMux);
+        break;
+
+    case MQTT_EVENT_PUBLISHED:
+        portENTER_CRITICAL(&mqttMux);
+        for (int s = 0; s < LOG_STREAM_COUNT; s++)
+        {
+            MqttSeriesState &state = mqtt.series[s];
+            for (int i = 0; i < state.inflightCount; i++)
+            {
+                if (state.inflight[i].msgId == event->msg_id)
+                    state.inflight[i].msgId = 0;
+            }
+
+            // The offset only moves over a contiguous run of acknowledged batches
+            int done = 0;
+            while (done < state.inflightCount && state.inflight[done].msgId == 0)
+                state.acked = state.inflight[done++].end;
+            if (done)
+            {
+                memmove(state.inflight, state.inflight + done, (state.inflightCount - done) * sizeof(MqttInflight));
+                state.inflightCount -= done;
+                state.dirty = true;
+                mqtt.acks++;
+            }
+            mqttReplayDropped(state);
+        }
+        portEXIT_CRITICAL(&mqttMux);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void mqttApplyConfig()
+{
+    if (mqtt.client)
+    {
+        esp_mqtt_client_stop(mqtt.client);
+        esp_mqtt_client_destroy(mqtt.client);
+        mqtt.client = nullptr;
+        mqtt.connected = false;
+    }
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        mqtt.series[s].sent = mqtt.series[s].acked;
+        mqtt.series[s].inflightCount = 0;
+    }
+    if (!mqttConfigured())
+        return;
+
+    size_t i = 0;
+    for (; currentConfig.deviceName[i] && i < sizeof(mqtt.device) - 1; i++)
+        mqtt.device[i] = isalnum((unsigned char)currentConfig.deviceName[i]) ? currentConfig.deviceName[i] : '_';
+    mqtt.device[i] = '\0';
+    snprintf(mqtt.statusTopic, sizeof(mqtt.statusTopic), MQTT_TOPIC_ROOT "/%s/status", mqtt.device);
+
+    esp_mqtt_client_config_t config = {};
+    config.uri = currentConfig.mqttUri;
+    config.client_id = mqtt.device;
+    config.lwt_topic = mqtt.statusTopic;
+    config.lwt_msg = "offline";
+    config.lwt_qos = 1;
+    config.lwt_retain = 1;
+    config.buffer_size = MQTT_PAYLOAD_SIZE + 128;
+
+    mqtt.client = esp_mqtt_client_init(&config);
+    if (!mqtt.client)
+    {
+        serialPrintln("MQTT client init failed");
+        return;
+    }
+    esp_mqtt_client_register_event(mqtt.client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, mqttEventHandler, nullptr);
+    esp_mqtt_client_start(mqtt.client);
+}
+
+void initMqtt()
+{
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        char path[40];
+        snprintf(path, sizeof(path), TS_STORE_DIR "/%s.mqt", logStreams[s].series.name());
+        File file = SD.open(path, FILE_READ);
+        if (!file)
+            continue;
+        uint32_t generation = file.parseInt();
+        uint32_t acked = file.parseInt();
+        file.close();
+
+        // An offset from before the series was last cleared is meaningless
+        if (generation == upload.generation[s])
+            mqtt.series[s].acked = acked;
+    }
+    mqttApplyConfig();
+}
+
+// Encode and enqueue the next batch of a series. Returns false when there
+// is nothing to send or the client would not take it.
+bool mqttPublishBatch(int type)
+{
+    static TsIterator iterator;
+    static TsRecord rows[MQTT_BATCH_RECORDS];
+    static uint8_t payload[MQTT_PAYLOAD_SIZE];
+
+    MqttSeriesState &state = mqtt.series[type];
+    TsSeries &series = logStreams[type].series;
+
+    portENTER_CRITICAL(&mqttMux);
+    uint32_t first = state.sent;
+    bool full = state.inflightCount >= MQTT_MAX_INFLIGHT;
+    portEXIT_CRITICAL(&mqttMux);
+    if (full || first >= series.recordCount())
+        return false;
+
+    // Consecutive ordinals only; a gap from an unreadable block starts the next batch
+    iterator.resetAtRecord(series, first);
+    int count = 0;
+    TsRecord row;
+    while (count < MQTT_BATCH_RECORDS && iterator.next(row))
+    {
+        if (count == 0)
+            first = iterator.ordinal();
+        else if (iterator.ordinal() != first + count)
+            break;
+        rows[count++] = row;
+    }
+    if (count == 0)
+        return false;
+
+    CborWriter cbor(payload, sizeof(payload));
+    cbor.map(6);
+    cbor.text("dev");
+    cbor.text(currentConfig.deviceName);
+    cbor.text("ser");
+    cbor.text(series.name());
+    cbor.text("gen");
+    cbor.uint(upload.generation[type]);
+    cbor.text("off");
+    cbor.uint(first);
+    cbor.text("t0");
+    cbor.uint(rows[0].time);
+    cbor.text("rows");
+    cbor.array(count);
+    for (int i = 0; i < count; i++)
+    {
+        cbor.array(4);
+        cbor.integer((int64_t)rows[i].time - rows[0].time);
+        cbor.integer(rows[i].values[TS_COL_LAT]);
+        cbor.integer(rows[i].values[TS_COL_LNG]);
+        cbor.integer(rows[i].values[TS_COL_VALUE]);
+    }
+    if (!cbor.ok())
+        return false;
+
+    char topic[80];  // Root, device[32] and the series name (15 chars at most)
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_ROOT "/%s/%.15s", mqtt.device, series.name());
+    int msgId = esp_mqtt_client_enqueue(mqtt.client, topic, (const char *)payload, cbor.length(),
+                                        currentConfig.mqttQos, 0, true);
+    if (msgId < 0)
+    {
+        mqtt.enqueueFailures++;
+        return false;
+    }
+
+    portENTER_CRITICAL(&mqttMux);
+    state.sent = first + count;
+    if (currentConfig.mqttQos == 0)
+    {
+        state.acked = state.sent;
+        state.dirty = true;
+    }
+    else
+    {
+        state.inflight[state.inflightCount++] = {msgId, state.sent};
+    }
+    portEXIT_CRITICAL(&mqttMux);
+    mqtt.batches++;
+    return true;
+}
+
+// Once per batch window: publish what has accumulated, continuing from
+// where the last batch handed to the client ended, and persist the offsets
+void runMqttJob()
+{
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        if (mqtt.client && mqtt.connected)
+        {
+            while (mqttPublishBatch(s))
+                ;
+        }
+
+        portENTER_CRITICAL(&mqttMux);
+        bool dirty = mqtt.series[s].dirty;
+        mqtt.series[s].dirty = false;
+        portEXIT_CRITICAL(&mqttMux);
+        if (dirty)
+            mqttSaveAck(s);
+    }
+}
+
+void handleMqttStatus()
+{
+    ArenaString json(requestArena, 512);
+    json.appendf("{\"enabled\":%s,\"connected\":%s,\"connects\":%u,\"batches\":%u,\"acks\":%u,\"enqueueFailures\":%u,"
+                 "\"expired\":%u",
+                 mqttConfigured() ? "true" : "false", mqtt.connected ? "true" : "false", (unsigned)mqtt.connects,
+                 (unsigned)mqtt.batches, (unsigned)mqtt.acks, (unsigned)mqtt.enqueueFailures, (unsigned)mqtt.expired);
+    for (int s = 0; s < LOG_STREAM_COUNT; s++)
+    {
+        TsSeries &series = logStreams[s].series;
+        uint32_t records = series.recordCount();
+        json.appendf(",\"%s\":{\"acked\":%u,\"inflight\":%u,\"queued\":%u}", series.name(),
+                     (unsigned)mqtt.series[s].acked, (unsigned)mqtt.series[s].inflightCount,
+                     (unsigned)(records - min(mqtt.series[s].acked, records)));
+    }
+    json += "}";
+    sendArena(200, "application/json", json);
+}
+
+// Incremental sync: /sync?series=<name>&cursor=<generation>:<ordinal>
+//                       [&client=<id>][&limit=<records>]
+// Returns the CSV rows after the cursor, in the download layout, with
+// the CSV header only when starting from the beginning. Response headers
+// carry the cursor to send next time, whether more rows remain, and a
+// CRC32 of the body. A cursor from an older generation (the series was
+// cleared since) restarts at 0 and sets X-Sync-Reset. Clients that pass
+// an id have their cursor remembered: one that omits it resumes where its
+// last reply ended, so it must send the cursor again to retry a lost batch.
+#define SYNC_MAX_CLIENTS 8
+#define SYNC_DEFAULT_LIMIT 5000
+
+struct SyncClient
+{
+    char id[16];
+    uint32_t generation[LOG_STREAM_COUNT];
+    uint32_t cursor[LOG_STREAM_COUNT];
+};
+
+SyncClient syncClients[SYNC_MAX_CLIENTS];
+int syncClientCount = 0;
+
+void initSync()
+{
+    File file = SD.open(TS_STORE_DIR "/sync.dat", FILE_READ);
+    if (!file)
+        return;
+    while (syncClientCount < SYNC_MAX_CLIENTS &&
+           file.read((uint8_t *)&syncClients[syncClientCount], sizeof(SyncClient)) == sizeof(SyncClient))
+        syncClientCount++;
+    file.close();
+}
+
+void syncSaveClients()
+{
+    File file = SD.open(TS_STORE_DIR "/sync.dat", FILE_WRITE);
+    if (!file)
+        return;
+    file.write((const uint8_t *)syncClients, syncClientCount * sizeof(SyncClient));
+    file.close();
+}
+
+// Find a client by id, taking over the oldest slot when the table is full
+SyncClient &syncClient(const String &id)
+{
+    for (int i = 0; i < syncClientCount; i++)
+    {
+        if (id == syncClients[i].id)
+            return syncClients[i];
+    }
+    if (syncClientCount == SYNC_MAX_CLIENTS)
+    {
+        memmove(syncClients, syncClients + 1, (SYNC_MAX_CLIENTS - 1) * sizeof(SyncClient));
+        syncClientCount--;
+    }
+    SyncClient &client = syncClients[syncClientCount++];
+    memset(&client, 0, sizeof(client));
+    strncpy(client.id, id.c_str(), sizeof(client.id) - 1);
+    return client;
+}
+
+void handleSync()
+{
+    static TsIterator iterator;
+    static const char *headers[LOG_STREAM_COUNT] = {
+        "DateTime,Latitude,Longitude,Pressure",
+        "DateTime,Latitude,Longitude,Flow",
+        "Date,Time,Latitude,Longitude,Satellites"};
+
+    int type = logSeriesByName(server.arg("series"));
+    if (type < 0)
+    {
+        server.send(400, "text/plain", "Unknown series");
+        return;
+    }
+    TsSeries &series = logStreams[type].series;
+    uint32_t generation = upload.generation[type];
+
+    unsigned cursorGeneration = generation, start = 0;
+    bool haveCursor = server.hasArg("cursor") &&
+                      sscanf(server.arg("cursor").c_str(), "%u:%u", &cursorGeneration, &start) == 2;
+    SyncClient *client = server.hasArg("client") ? &syncClient(server.arg("client")) : nullptr;
+    if (client && haveCursor)
+    {
+        // The cursor a client sends confirms everything before it
+        client->generation[type] = cursorGeneration;
+        client->cursor[type] = start;
+        syncSaveClients();
+    }
+    else if (client)
+    {
+        cursorGeneration = client->generation[type];
+        start = client->cursor[type];
+    }
+    bool reset = cursorGeneration != generation;
+    if (reset)
+        start = 0;
+    long limit = server.hasArg("limit") ? server.arg("limit").toInt() : SYNC_DEFAULT_LIMIT;
+    if (limit <= 0)
+        limit = SYNC_DEFAULT_LIMIT;
+
+    // First pass sizes the reply and hashes it so the headers can carry
+    // the CRC; the second streams the same rows. Appends in between land
+    // after the counted rows and are left for the next sync.
+    char line[100];
+    uint32_t crc = 0;
+    if (start == 0)
+    {
+        int length = snprintf(line, sizeof(line), "%s\n", headers[type]);
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)line, length);
+    }
+    long count = 0;
+    uint32_t next = start;
+    TsRecord row;
+    iterator.resetAtRecord(series, start);
+    while (count < limit && iterator.next(row))
+    {
+        int length = formatLogRow((LogRecordType)type, row, line, sizeof(line));
+        crc = esp_rom_crc32_le(crc, (const uint8_t *)line, length);
+        next = iterator.ordinal() + 1;
+        count++;
+    }
+    bool more = count == limit && iterator.next(row);
+
+    // Without a cursor of its own the client relies on the remembered one,
+    // so move it past this reply or the next sync repeats the same rows
+    if (client && !haveCursor)
+    {
+        client->generation[type] = generation;
+        client->cursor[type] = next;
+        syncSaveClients();
+    }
+
+    char value[24];
+    snprintf(value, sizeof(value), "%u:%u", (unsigned)generation, (unsigned)next);
+    server.sendHeader("X-Sync-Cursor", value);
+    server.sendHeader("X-Sync-Records", String(count));
+    server.sendHeader("X-Sync-More", more ? "1" : "0");
+    if (reset)
+        server.sendHeader("X-Sync-Reset", "1");
+    if (count == 0)
+    {
+        server.send(204);
+        return;
+    }
+    snprintf(value, sizeof(value), "%08x", (unsigned)crc);
+    server.sendHeader("X-Content-CRC32", value);
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/csv", "");
+
+    char chunk[1024];
+    size_t used = start == 0 ? snprintf(chunk, sizeof(chunk), "%s\n", headers[type]) : 0;
+    iterator.resetAtRecord(series, start);
+    for (long sent = 0; sent < count && iterator.next(row); sent++)
+    {
+        int length = formatLogRow((LogRecordType)type, row, line, sizeof(line));
+        if (used + length > sizeof(chunk))
+        {
+            server.sendContent(chunk, used);
+            used = 0;
+        }
+        memcpy(chunk + used, line, length);
+        used += length;
+    }
+    if (used)
+        server.sendContent(chunk, used);
+    server.sendContent("");
+}
+
+// Heap monitor. Replies are built in requestArena and pages rendered in
+// place, but the web server's request and argument Strings, SD file
+// buffers, MQTT and the Wi-Fi/lwIP stack still allocate and free on the
+// heap, and weeks of that can fragment it well before it runs out: plenty
+// free, but no block big enough for the next page. A sample
+// every HEAP_SAMPLE_INTERVAL keeps the last HEAP_HISTORY_SIZE readings of
+// free bytes and largest free block, every request is traced with what it
+// left behind, and the heavy pages are refused with 503 while the largest
+// free block is too small to serve them. All of it is on /metrics.
+#define HEAP_SAMPLE_INTERVAL 60 // s
+#define HEAP_HISTORY_SIZE 60
+#define HEAP_TRACE_SIZE 16
+#define HEAP_NEED_PAGE 4096    // Largest free block the server needs around a page
+#define HEAP_RETRY_AFTER "5"   // s, sent with a shed request
+
+struct HeapSample
+{
+    uint32_t time; // s since boot
+    uint32_t freeBytes;
+    uint32_t largestBlock;
+};
+
+struct RequestTrace
+{
+    TimeUs start;
+    uint32_t durationUs;
+    char uri[24];
+    int32_t bytesLeft;     // Change in allocated bytes across the request
+    int32_t blocksLeft;    // Change in allocated blocks
+    uint32_t largestBlock; // After the request
+    uint32_t arenaBytes;   // Request arena used to build the reply
+    bool shed;
+};
+
+struct HeapMonitor
+{
+    HeapSample history[HEAP_HISTORY_SIZE];
+    int historyIndex = 0;
+    int historyCount = 0;
+    RequestTrace trace[HEAP_TRACE_SIZE];
+    int traceIndex = 0;
+    int traceCount = 0;
+    uint32_t requests = 0;
+    uint32_t shed = 0;
+    uint32_t minLargestBlock = UINT32_MAX;
+};
+HeapMonitor heapMonitor;
+int jobHeap = -1;
+
+// Share of the free heap that is not in the largest block: 0 is one
+// contiguous region, close to 1 is free space scattered in small holes
+float heapFragmentation(const multi_heap_info_t &info)
+{
+    if (info.total_free_bytes == 0)
+        return 0;
+    return 1.0f - (float)info.largest_free_block / info.total_free_bytes;
+}
+
+void runHeapSampleJob()
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+
+    HeapSample &sample = heapMonitor.history[heapMonitor.historyIndex];
+    sample.time = nowUs() / 1000000;
+    sample.freeBytes = info.total_free_bytes;
+    sample.largestBlock = info.largest_free_block;
+    heapMonitor.historyIndex = (heapMonitor.historyIndex + 1) % HEAP_HISTORY_SIZE;
+    if (heapMonitor.historyCount < HEAP_HISTORY_SIZE)
+        heapMonitor.historyCount++;
+    if (info.largest_free_block < heapMonitor.minLargestBlock)
+        heapMonitor.minLargestBlock = info.largest_free_block;
+}
+
+// Run one request through its handler, or shed it if the heap cannot hold
+// the reply, note what it cost and release the request arena
+void heapTracedRequest(const char *uri, const WebServer::THandlerFunction &handler, size_t needBytes)
+{
+    multi_heap_info_t before, after;
+    heap_caps_get_info(&before, MALLOC_CAP_DEFAULT);
+    TimeUs start = nowUs();
+
+    bool shed = needBytes > 0 && before.largest_free_block < needBytes;
+    if (shed)
+    {
+        heapMonitor.shed++;
+        server.sendHeader("Retry-After", HEAP_RETRY_AFTER);
+        server.send(503, "application/json", "{\"error\":\"low memory\"}");
+
+        char message[80];
+        snprintf(message, sizeof(message), "Low memory, shed %s (largest block %u)", uri,
+                 (unsigned)before.largest_free_block);
+        serialPrintln(message);
+    }
+    else
+    {
+        handler();
+    }
+    heapMonitor.requests++;
+
+    heap_caps_get_info(&after, MALLOC_CAP_DEFAULT);
+    RequestTrace &trace = heapMonitor.trace[heapMonitor.traceIndex];
+    trace.start = start;
+    trace.durationUs = nowUs() - start;
+    strncpy(trace.uri, uri, sizeof(trace.uri) - 1);
+    trace.uri[sizeof(trace.uri) - 1] = '\0';
+    trace.bytesLeft = (int32_t)after.total_allocated_bytes - (int32_t)before.total_allocated_bytes;
+    trace.blocksLeft = (int32_t)after.allocated_blocks - (int32_t)before.allocated_blocks;
+    trace.largestBlock = after.largest_free_block;
+    trace.arenaBytes = requestArena.used();
+    trace.shed = shed;
+    heapMonitor.traceIndex = (heapMonitor.traceIndex + 1) % HEAP_TRACE_SIZE;
+    if (heapMonitor.traceCount < HEAP_TRACE_SIZE)
+        heapMonitor.traceCount++;
+    if (after.largest_free_block < heapMonitor.minLargestBlock)
+        heapMonitor.minLargestBlock = after.largest_free_block;
+    requestArena.reset();
+}
+
+// server.on() with tracing; needBytes > 0 marks a page to shed on low memory
+void serveTraced(const char *uri, WebServer::THandlerFunction handler, size_t needBytes = 0)
+{
+    server.on(uri, [uri, handler, needBytes]() { heapTracedRequest(uri, handler, needBytes); });
+}
+
+// Streamed in pieces so the report does not need the heap it describes
+void handleMetrics()
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    size_t size = heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
+
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "application/json", "");
+
+    const HttpConnectionStats &http = server.connectionStats();
+    char chunk[400];
+    snprintf(chunk, sizeof(chunk),
+             "{\"heap\":{\"size\":%u,\"free\":%u,\"allocated\":%u,\"blocks\":%u,\"freeBlocks\":%u,"
+             "\"peak\":%u,\"largestFree\":%u,\"minLargestFree\":%u,\"fragmentation\":%.3f},"
+             "\"arena\":{\"size\":%u,\"peak\":%u,\"overflows\":%u},"
+             "\"http\":{\"clients\":%u,\"accepted\":%u,\"reused\":%u,\"evicted\":%u,\"timedOut\":%u},"
+             "\"requests\":%u,\"shed\":%u,\"history\":[",
+             (unsigned)size, (unsigned)info.total_free_bytes, (unsigned)info.total_allocated_bytes,
+             (unsigned)info.allocated_blocks, (unsigned)info.free_blocks,
+             (unsigned)(size - info.minimum_free_bytes), (unsigned)info.largest_free_block,
+             (unsigned)min((uint32_t)info.largest_free_block, heapMonitor.minLargestBlock),
+             heapFragmentation(info), (unsigned)requestArena.capacity(), (unsigned)requestArena.highWater(),
+             (unsigned)requestArena.failures(), (unsigned)server.openClients(), (unsigned)http.accepted,
+             (unsigned)http.reused, (unsigned)http.evicted, (unsigned)http.timedOut, (unsigned)heapMonitor.requests,
+             (unsigned)heapMonitor.shed);
+    server.sendContent(chunk);
+
+    // Oldest first: [s since boot, free, largest free block]
+    int first = (heapMonitor.historyIndex - heapMonitor.historyCount + HEAP_HISTORY_SIZE) % HEAP_HISTORY_SIZE;
+    for (int i = 0; i < heapMonitor.historyCount; i++)
+    {
+        const HeapSample &sample = heapMonitor.history[(first + i) % HEAP_HISTORY_SIZE];
+        snprintf(chunk, sizeof(chunk), "%s[%u,%u,%u]", i ? "," : "", (unsigned)sample.time,
+                 (unsigned)sample.freeBytes, (unsigned)sample.largestBlock);
+        server.sendContent(chunk);
+    }
+    server.sendContent("],\"trace\":[");
+
+    first = (heapMonitor.traceIndex - heapMonitor.traceCount + HEAP_TRACE_SIZE) % HEAP_TRACE_SIZE;
+    for (int i = 0; i < heapMonitor.traceCount; i++)
+    {
+        const RequestTrace &trace = heapMonitor.trace[(first + i) % HEAP_TRACE_SIZE];
+        snprintf(chunk, sizeof(chunk),
+                 "%s{\"ms\":%llu,\"uri\":\"%s\",\"us\":%u,\"bytes\":%d,\"blocks\":%d,\"largestFree\":%u,"
+                 "\"arena\":%u,\"shed\":%s}",
+                 i ? "," : "", (unsigned long long)(trace.start / 1000), trace.uri, (unsigned)trace.durationUs,
+                 (int)trace.bytesLeft, (int)trace.blocksLeft, (unsigned)trace.largestBlock,
+                 (unsigned)trace.arenaBytes, trace.shed ? "true" : "false");
+        server.sendContent(chunk);
+    }
+    server.sendContent("]}");
+    server.sendContent("");
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(2000);
+    serialPrintln("System starting...");
+
+    neo6m.begin(9600, SERIAL_8N1, RXD2, TXD2);
+    serialPrintln("GPS serial initialized");
+
+    initRTC();
+    initBMP();
+    initSDCard();
+    initLogger();
+    initUploader();
+    initSync();
+
+    pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), pulseCounter, FALLING);
+    pinMode(AP_WAKE_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(AP_WAKE_PIN), apWakeButton, FALLING);
+
+    setupWiFi();
+    initMqtt(); // The client needs the network stack setupWiFi() brings up
+    serveTraced("/", handleRoot, HEAP_NEED_PAGE);
+    serveTraced("/config", handleConfig);
+    serveTraced("/datetime", handleDateTime);
+    serveTraced("/serial", handleSerial, HEAP_NEED_PAGE);
+    serveTraced("/pressure", handlePressure); // Add new endpoint
+    serveTraced("/download", handleDownload);
+    serveTraced("/delete", handleDelete);
+    serveTraced("/timeTemp", handleTimeTemp);
+    serveTraced("/download_gps_log", handleDownloadGPSLog);
+    serveTraced("/delete_gps_log", handleDeleteGPSLog);
+    serveTraced("/download_gps_track", handleDownloadGPSTrack);
+    serveTraced("/delete_gps_track", handleDeleteGPSTrack);
+    serveTraced("/power", handlePower);
+    serveTraced("/logger", handleLoggerStats);
+    serveTraced("/query", handleQuery);
+    serveTraced("/upload", handleUploadStatus);
+    serveTraced("/mqtt", handleMqttStatus);
+    serveTraced("/sync", handleSync);
+    serveTraced("/metrics", handleMetrics);
+    serveTraced("/api/status", handleApiStatus);
+    serveTraced("/api/chart", handleApiChart);
+    serveTraced("/api/geofences", handleApiGeofences);
+    serveTraced("/map", handleMap);
+    serveTraced("/tile", handleTile);
+    serveTraced("/api/tiles", handleApiTiles);
+    static const char *requestHeaders[] = {"If-None-Match"};
+    server.collectHeaders(requestHeaders, 1);
+    server.begin();
+    serialPrintln("Web server started");
+
+    pinMode(POWER_LED_PIN, OUTPUT);
+    digitalWrite(POWER_LED_PIN, HIGH);  // Turn on power indicator
+
+    pinMode(BUZZER_PIN, OUTPUT);
+    digitalWrite(BUZZER_PIN, LOW);  // Initialize buzzer as off
+
+    setupScheduler();
+}
+
+void handlePower()
+{
+    // Close the current interval so the numbers include time up to now
+    powerEnterState(power.state);
+
+    uint64_t total = 0;
+    for (int i = 0; i < POWER_STATE_COUNT; i++)
+        total += power.timeInState[i];
+    if (total == 0)
+        total = 1;
+
+    gpsPowerSetMode(gpsPower.mode);
+
+    char json[384];
+    snprintf(json, sizeof(json),
+             "{\"pm\":%s,\"ap\":%s,\"lightSleepAllowed\":%s,\"lowPower\":%s,\"cpuMhz\":%u,"
+             "\"activeMs\":%llu,\"idleMs\":%llu,\"lightSleepMs\":%llu,"
+             "\"activePct\":%.1f,\"idlePct\":%.1f,\"lightSleepPct\":%.1f,"
+             "\"gpsMode\":\"%s\",\"gpsContinuousMs\":%llu,\"gpsPowerSaveMs\":%llu,\"gpsBackupMs\":%llu}",
+             power.pmSupported ? "true" : "false",
+             power.apUp ? "true" : "false",
+             power.lightSleepAllowed ? "true" : "false",
+             power.lowPower ? "true" : "false",
+             getCpuFrequencyMhz(),
+             (unsigned long long)(power.timeInState[POWER_ACTIVE] / 1000),
+             (unsigned long long)(power.timeInState[POWER_IDLE] / 1000),
+             (unsigned long long)(power.timeInState[POWER_LIGHT_SLEEP] / 1000),
+             power.timeInState[POWER_ACTIVE] * 100.0 / total,
+             power.timeInState[POWER_IDLE] * 100.0 / total,
+             power.timeInState[POWER_LIGHT_SLEEP] * 100.0 / total,
+             gpsPowerModeName(gpsPower.mode),
+             (unsigned long long)(gpsPower.timeInMode[GPS_POWER_CONTINUOUS] / 1000),
+             (unsigned long long)(gpsPower.timeInMode[GPS_POWER_SAVE] / 1000),
+             (unsigned long long)(gpsPower.timeInMode[GPS_POWER_BACKUP] / 1000));
+    server.send(200, "application/json", json);
+}
+
+// Add new handler for real-time pressure data
+void handlePressure()
+{
+    ArenaString json(requestArena);
+    if (strcmp(currentConfig.currentSensor, "BMP") == 0)
+    {
+        if (!bmpInitialized)
+        {
+            server.send(500, "application/json", "{\"error\":\"BMP sensor not initialized\"}");
+            return;
+        }
+        // BMP pressure handling
+    }
+    else
+    {
+        // Flow sensor handling
+        if (flowRate == INFINITY)
+        { // Handle potential invalid values
+            server.send(500, "application/json", "{\"error\":\"Invalid flow reading\"}");
+            return;
+        }
+    }
+    json.appendf("{\"current\":%.2f,\"average\":%.2f,\"threshold\":%.2f}", liveStatus.value, liveStatus.average,
+                 liveStatus.threshold);
+    sendArena(200, "application/json", json);
+}
+
+// /api/status: every live value in one reply from the snapshot, as JSON or,
+// with ?format=cbor, as a CBOR map. The ETag follows the snapshot version and
+// the serial log, so a client revalidating with If-None-Match gets a 304
+// until something changes. The device clock (now) is sent with every body
+// but left out of the ETag, or no reply would ever be a 304; clients tick
+// from it themselves. Missing values are null.
+//
+// CBOR keys, values scaled to integers as in the store:
+//   sen  sensor name                val  latest sample (hundredths)
+//   avg  average (hundredths)       thr  threshold level (hundredths)
+//   now  Unix time of the reply     t    Unix time of the change
+//   tmp  temperature (hundredths of °C)
+//   gps  [lat, lng, satellites], coordinates in micro-degrees
+//   mot  motion state               log  serial messages so far
+void appendJsonNumber(ArenaString &json, const char *format, float value)
+{
+    if (isnan(value))
+        json += "null";
+    else
+        json.appendf(format, value);
+}
+
+void cborScaled(CborWriter &cbor, float value, float scale)
+{
+    if (isnan(value))
+        cbor.null();
+    else
+        cbor.integer(lroundf(value * scale));
+}
+
+void handleApiStatus()
+{
+    bool cbor = server.arg("format") == "cbor";
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%x.%x%s\"", (unsigned)liveStatus.version, (unsigned)serialMessageCount,
+             cbor ? "c" : "");
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", "no-cache");
+    if (strstr(server.header("If-None-Match").c_str(), etag))
+    {
+        server.send(304);
+        return;
+    }
+
+    uint32_t now = liveStatusClock();
+    uint32_t time = liveStatus.changedAt;
+    if (cbor)
+    {
+        uint8_t payload[160];
+        CborWriter out(payload, sizeof(payload));
+        out.map(10);
+        out.text("sen");
+        out.text(currentConfig.currentSensor);
+        out.text("val");
+        cborScaled(out, liveStatus.value, TS_VALUE_SCALE);
+        out.text("avg");
+        cborScaled(out, liveStatus.average, TS_VALUE_SCALE);
+        out.text("thr");
+        cborScaled(out, liveStatus.threshold, TS_VALUE_SCALE);
+        out.text("now");
+        if (now)
+            out.uint(now);
+        else
+            out.null();
+        out.text("t");
+        if (time)
+            out.uint(time);
+        else
+            out.null();
+        out.text("tmp");
+        cborScaled(out, liveStatus.temperature, 100);
+        out.text("gps");
+        if (liveStatus.gpsValid)
+        {
+            out.array(3);
+            out.integer(llround(liveStatus.lat * TS_COORD_SCALE));
+            out.integer(llround(liveStatus.lng * TS_COORD_SCALE));
+            out.uint(liveStatus.satellites);
+        }
+        else
+        {
+            out.null();
+        }
+        out.text("mot");
+        out.text(motionStateName(liveStatus.motion));
+        out.text("log");
+        out.uint(serialMessageCount);
+        if (!out.ok())
+        {
+            server.send(500, "text/plain", "Status too large");
+            return;
+        }
+        server.send_P(200, "application/cbor", (const char *)payload, out.length());
+        return;
+    }
+
+    ArenaString json(requestArena, 320);
+    json.appendf("{\"sensor\":\"%s\",\"value\":", currentConfig.currentSensor);
+    appendJsonNumber(json, "%.2f", liveStatus.value);
+    json += ",\"average\":";
+    appendJsonNumber(json, "%.2f", liveStatus.average);
+    json += ",\"threshold\":";
+    appendJsonNumber(json, "%.2f", liveStatus.threshold);
+    json += ",\"now\":";
+    if (now)
+        json.appendf("%u", (unsigned)now);
+    else
+        json += "null";
+    json += ",\"changed\":";
+    if (time)
+        json.appendf("%u", (unsigned)time);
+    else
+        json += "null";
+    json += ",\"temperature\":";
+    appendJsonNumber(json, "%.2f", liveStatus.temperature);
+    if (liveStatus.gpsValid)
+        json.appendf(",\"gps\":{\"lat\":%.6f,\"lng\":%.6f,\"satellites\":%u}", liveStatus.lat, liveStatus.lng,
+                     liveStatus.satellites);
+    else
+        json += ",\"gps\":null";
+    json.appendf(",\"motion\":\"%s\",\"log\":%u}", motionStateName(liveStatus.motion),
+                 (unsigned)serialMessageCount);
+    sendArena(200, "application/json", json);
+}
+
+// /api/chart?span=S&width=N: the last S seconds of history from the finest
+// tier reaching that far, downsampled with LTTB to at most N points, as
+// typed arrays in one little-endian buffer:
+//   uint32  count, span (s), now (Unix s, 0 without RTC), interval (s per bucket)
+//   float32 mean, min, max over the span
+//   int32   x[count]  seconds before now
+//   float32 y[count]  bucket means
+// Empty buckets are left out, so the line joins across gaps.
+void handleApiChart()
+{
+    long width = server.hasArg("width") ? server.arg("width").toInt() : CHART_DEFAULT_WIDTH;
+    width = max(3L, min(width, (long)CHART_MAX_POINTS));
+    long span = server.hasArg("span") ? server.arg("span").toInt() : CHART_DEFAULT_SPAN;
+    span = max(span, 1L);
+    const HistoryTier &tier = sensorHistory.tierFor(SEC_TO_US(span));
+    span = min(span, (long)(tier.spanUs() / 1000000));
+
+    size_t count = tier.count();
+    float *x = (float *)requestArena.allocate(count * sizeof(float), alignof(float));
+    float *y = (float *)requestArena.allocate(count * sizeof(float), alignof(float));
+    uint16_t *selected = (uint16_t *)requestArena.allocate(count * sizeof(uint16_t), alignof(uint16_t));
+    if (!x || !y || !selected)
+    {
+        server.send(500, "text/plain", "Response too large");
+        return;
+    }
+
+    TimeUs now = nowUs();
+    size_t points = 0;
+    double sum = 0;
+    float low = NAN;
+    float high = NAN;
+    for (size_t i = 0; i < count; i++)
+    {
+        const HistoryBucket &bucket = tier.bucket(i);
+        TimeUs middle = tier.startUs(i) + tier.intervalUs() / 2;
+        if (isnan(bucket.mean) || now - middle > SEC_TO_US(span))
+            continue;
+        x[points] = -(float)((now - middle) / 1000000.0);
+        y[points++] = bucket.mean;
+        sum += bucket.mean;
+        if (!(bucket.min() >= low))
+            low = bucket.min();
+        if (!(bucket.max() <= high))
+            high = bucket.max();
+    }
+    size_t kept = lttbSelect(x, y, points, width, selected);
+
+    size_t length = 7 * sizeof(uint32_t) + kept * (sizeof(int32_t) + sizeof(float));
+    uint32_t *body = (uint32_t *)requestArena.allocate(length, alignof(uint32_t));
+    if (!body)
+    {
+        server.send(500, "text/plain", "Response too large");
+        return;
+    }
+    body[0] = kept;
+    body[1] = span;
+    body[2] = liveStatusClock();
+    body[3] = tier.intervalUs() / 1000000;
+    float *summary = (float *)(body + 4);
+    summary[0] = points ? sum / points : NAN;
+    summary[1] = low;
+    summary[2] = high;
+    int32_t *xOut = (int32_t *)(body + 7);
+    float *yOut = (float *)(xOut + kept);
+    for (size_t i = 0; i < kept; i++)
+    {
+        xOut[i] = lroundf(x[selected[i]]);
+        yOut[i] = y[selected[i]];
+    }
+    server.send_P(200, "application/octet-stream", (const char *)body, length);
+}
+// Add these handlers in your code
+void handleDownloadGPSLog() {
+    sendLogCsv("gps_log.csv", "DateTime,Latitude,Longitude,Pressure", LOG_PRESSURE_EVENT, LOG_FLOW_EVENT);
+}
+
+void handleDeleteGPSLog() {
+    bool cleared = logStreams[LOG_PRESSURE_EVENT].series.clear();
+    cleared &= logStreams[LOG_FLOW_EVENT].series.clear();
+    uploadResetSeries(LOG_PRESSURE_EVENT);
+    uploadResetSeries(LOG_FLOW_EVENT);
+    mqttResetSeries(LOG_PRESSURE_EVENT);
+    mqttResetSeries(LOG_FLOW_EVENT);
+    if (cleared) {
+        server.send(200, "text/plain", "GPS log reset successfully");
+    } else {
+        server.send(500, "text/plain", "Failed to delete GPS log");
+    }
+}
+
+void handleDownloadGPSTrack() {
+    sendLogCsv("gps_track.csv", "Date,Time,Latitude,Longitude,Satellites", LOG_TRACK_POINT, -1);
+}
+
+void handleDeleteGPSTrack() {
+    bool cleared = logStreams[LOG_TRACK_POINT].series.clear();
+    uploadResetSeries(LOG_TRACK_POINT);
+    mqttResetSeries(LOG_TRACK_POINT);
+    if (cleared) {
+        server.send(200, "text/plain", "Track log reset successfully");
+    } else {
+        server.send(500, "text/plain", "Failed to delete track log");
+    }
+}
+
+// Offline map tiles, packed by tools/pack_tiles.py into one archive on the
+// card (tile_archive.h) that stays open
+#define TILE_ARCHIVE_FILE "/tiles.pak"
+#define TILE_SEND_BUFFER 1024
+
+TileArchive tileArchive;
+const char *const tileContentTypes[TILE_FORMAT_COUNT] = {"image/png", "image/jpeg", "image/webp"};
+
+void openTileArchive()
+{
+    if (!SD.exists(TILE_ARCHIVE_FILE))
+        return;
+    if (!tileArchive.begin(SD, TILE_ARCHIVE_FILE))
+    {
+        serialPrintln("Tile archive not readable");
+        return;
+    }
+    char message[60];
+    snprintf(message, sizeof(message), "Tile archive: %u tiles, zoom %u-%u", (unsigned)tileArchive.header().tileCount,
+             tileArchive.header().minZoom, tileArchive.header().maxZoom);
+    serialPrintln(message);
+}
+
+// /tile?z=&x=&y=[&v=]: one tile from the archive. A tile never changes
+// within an archive, so a request whose v names the archive (its creation
+// time, from /api/tiles) may be cached for good; others revalidate
+// against the ETag.
+void handleTile()
+{
+    if (!tileArchive.isOpen())
+    {
+        server.send(404, "text/plain", "No tile archive");
+        return;
+    }
+
+    TileIndexEntry *page = (TileIndexEntry *)requestArena.allocate(tileArchive.pageBytes(), alignof(TileIndexEntry));
+    if (!page)
+    {
+        server.send(500, "text/plain", "Response too large");
+        return;
+    }
+    long z = server.arg("z").toInt();
+    long x = server.arg("x").toInt();
+    long y = server.arg("y").toInt();
+    TileIndexEntry entry;
+    if (z < 0 || z > 24 || x < 0 || y < 0 || x >= (1L << z) || y >= (1L << z) ||
+        !tileArchive.find(z, x, y, entry, page))
+    {
+        server.send(404, "text/plain", "Tile not found");
+        return;
+    }
+
+    const TileArchiveHeader &header = tileArchive.header();
+    bool pinned = strtoul(server.arg("v").c_str(), nullptr, 10) == header.created;
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%x.%x\"", (unsigned)header.created, (unsigned)entry.offset);
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", pinned ? "public, max-age=31536000, immutable" : "no-cache");
+    if (strstr(server.header("If-None-Match").c_str(), etag))
+    {
+        server.send(304);
+        return;
+    }
+
+    if (!tileArchive.seek(entry))
+    {
+        server.send(500, "text/plain", "Failed to read tile");
+        return;
+    }
+    server.setContentLength(entry.length);
+    server.send(200, tileContentTypes[header.format], "");
+    uint8_t buffer[TILE_SEND_BUFFER];
+    for (size_t left = entry.length; left > 0;)
+    {
+        size_t read = tileArchive.read(buffer, min(left, sizeof(buffer)));
+        if (read == 0)
+        {
+            server.closeAfterResponse(); // The body falls short of its Content-Length
+            break;
+        }
+        server.sendContent((const char *)buffer, read);
+        left -= read;
+    }
+}
+
+// What the map page needs to know about the archive; "tiles" is 0 without one
+void handleApiTiles()
+{
+    ArenaString json(requestArena, 256);
+    if (!tileArchive.isOpen())
+    {
+        json += "{\"tiles\":0}";
+    }
+    else
+    {
+        const TileArchiveHeader &header = tileArchive.header();
+        json.appendf("{\"tiles\":%u,\"created\":%u,\"format\":\"%s\",\"minZoom\":%u,\"maxZoom\":%u,"
+                     "\"south\":%.6f,\"west\":%.6f,\"north\":%.6f,\"east\":%.6f}",
+                     (unsigned)header.tileCount, (unsigned)header.created, tileContentTypes[header.format] + 6,
+                     header.minZoom, header.maxZoom, header.south / TS_COORD_SCALE, header.west / TS_COORD_SCALE,
+                     header.north / TS_COORD_SCALE, header.east / TS_COORD_SCALE);
+    }
+    sendArena(200, "application/json", json);
+}
+
+void checkPressureAndLog()
+{
+    if (!bmpInitialized)
+    {
+        serialPrintln("BMP sensor not initialized");
+        return;
+    }
+
+    float rawPressure = bmp.readPressure();
     if (rawPressure <= 0)
     {
         serialPrintln("Invalid pressure reading");
@@ -972,9 +4489,14 @@ void checkPressureAndLog()
 
     float pressure = rawPressure / 100.0;
     addPressureReading(pressure);
+    sensorHistory.add(nowUs(), pressure);
 
     float averagePressure = calculateAveragePressure();
     float thresholdLevel = averagePressure * (1 + currentConfig.pressureThreshold / 100.0);
+    liveStatusSetReading(pressure, averagePressure, thresholdLevel);
+    adaptSampleInterval(pressure, averagePressure,
+                        calculateVariation(pressureHistory.readings, pressureHistory.count),
+                        currentConfig.pressureThreshold);
 
     if (pressure > thresholdLevel)
     {
@@ -983,6 +4505,7 @@ void checkPressureAndLog()
                  "Pressure threshold exceeded: %.2f hPa (Avg: %.2f, Threshold: %.2f)",
                  pressure, averagePressure, thresholdLevel);
         serialPrintln(message);
+        gpsWakeForActivity();
         logGPSData(pressure);
     }
 }
@@ -992,18 +4515,15 @@ void handleTimeTemp()
     if (rtcInitialized)
     {
         DateTime now = rtc.now();
-        String json = "{";
-        json += "\"time\":\"" + String(now.timestamp(DateTime::TIMESTAMP_TIME)) + "\",";
         float temperature = 0.00;
         if (bmpInitialized)
         {
             temperature = bmp.readTemperature();
         }
-        json += "\"temperature\":" + String(temperature, 2);
-
-        json += "}";
-
-        server.send(200, "application/json", json);
+        ArenaString json(requestArena);
+        json.appendf("{\"time\":\"%02d:%02d:%02d\",\"temperature\":%.2f}", now.hour(), now.minute(), now.second(),
+                     temperature);
+        sendArena(200, "application/json", json);
     }
     else
     {
@@ -1011,55 +4531,90 @@ void handleTimeTemp()
     }
 }
 
-void loop()
+// Scheduled jobs
+void runHttpJob()
 {
-    static unsigned long lastTrackLog = 0;
-    if (millis() - lastTrackLog >= currentConfig.trackLogInterval * 1000)
-    {
-        logGPSTrackData();
-        lastTrackLog = millis();
-    }
-
-    static unsigned long lastStatusUpdate = 0;
-    const unsigned long STATUS_UPDATE_INTERVAL = 10000; // 10 seconds
-
     server.handleClient();
-    processGPS();
+    powerUpdateClients();
+    schedulerArm(jobHttp, MS_TO_US(WiFi.softAPgetStationNum() > 0 ? HTTP_POLL_ACTIVE : HTTP_POLL_IDLE));
+}
 
+// Sample the active sensor, then re-arm at the adaptive rate
+void runSampleJob()
+{
     if (strcmp(currentConfig.currentSensor, "BMP") == 0)
     {
         if (bmpInitialized)
             checkPressureAndLog();
+        powerSetLock(power.flowLock, power.flowLockHeld, false);
     }
     else
     {
         checkFlowAndLog();
     }
+    schedulerArm(jobSample, MS_TO_US(sampler.interval));
+}
 
-    // Periodic status update
-    unsigned long currentMillis = millis();
-    if (currentMillis - lastStatusUpdate >= STATUS_UPDATE_INTERVAL)
+void runStatusJob()
+{
+    liveStatusSyncClock();
+    if (bmpInitialized)
     {
-        lastStatusUpdate = currentMillis;
+        char statusMsg[80];
+        float temperature = bmp.readTemperature();
+        float pressure = bmp.readPressure() / 100.0;
+        snprintf(statusMsg, sizeof(statusMsg), "Status - Temp: %.1f°C, Pressure: %.1f hPa",
+                 temperature, pressure);
+        serialPrintln(statusMsg);
+        liveStatusSetTemperature(temperature);
+    }
+}
 
-        if (bmpInitialized)
-        {
-            char statusMsg[80];
-            float temperature = bmp.readTemperature();
-            float pressure = bmp.readPressure() / 100.0;
-            snprintf(statusMsg, sizeof(statusMsg), "Status - Temp: %.1f°C, Pressure: %.1f hPa",
-                     temperature, pressure);
-            serialPrintln(statusMsg);
-        }
+void setupScheduler()
+{
+    schedulerInit();
+    jobHttp = schedulerAddJob(runHttpJob, 0, 0);
+    jobGps = schedulerAddJob(processGPS, MS_TO_US(GPS_POLL_INTERVAL), MS_TO_US(GPS_POLL_INTERVAL));
+    jobSample = schedulerAddJob(runSampleJob, 0, 0);
+    jobTrackLog = schedulerAddJob(logGPSTrackData, SEC_TO_US(currentConfig.trackLogInterval),
+                                  SEC_TO_US(currentConfig.trackLogInterval));
+    jobStatus = schedulerAddJob(runStatusJob, MS_TO_US(STATUS_UPDATE_INTERVAL), MS_TO_US(STATUS_UPDATE_INTERVAL));
+    jobGpsQuiet = schedulerAddJob(runGpsQuietJob, 0, MS_TO_US(GPS_BURST_GAP_MS));
+    jobGpsWake = schedulerAddJob(runGpsWakeJob, 0, JOB_NOT_ARMED);
+    jobGpsPower = schedulerAddJob(runGpsPowerJob, 0, JOB_NOT_ARMED);
+    jobGpsWakeup = schedulerAddJob(runGpsWakeupJob, 0, JOB_NOT_ARMED);
+    jobLogger = schedulerAddJob(runLoggerJob, 0, JOB_NOT_ARMED);
+    jobLogFlush = schedulerAddJob(runLogFlushJob, 0, JOB_NOT_ARMED);
+    jobUpload = schedulerAddJob(runUploadJob, SEC_TO_US(currentConfig.uploadInterval),
+                                SEC_TO_US(currentConfig.uploadInterval));
+    jobMqtt = schedulerAddJob(runMqttJob, SEC_TO_US(currentConfig.mqttBatchWindow),
+                              SEC_TO_US(currentConfig.mqttBatchWindow));
+    jobHeap = schedulerAddJob(runHeapSampleJob, SEC_TO_US(HEAP_SAMPLE_INTERVAL), 0);
+    jobBuzzerOff = schedulerAddJob(runBuzzerOffJob, 0, JOB_NOT_ARMED);
+    jobAp = schedulerAddJob(runApJob, 0, MS_TO_US(AP_IDLE_TIMEOUT));
 
-        if (gps.location.isValid())
+    // Wake the loop as soon as NMEA bytes arrive or a client joins the AP;
+    // a station leaving restarts the AP idle timeout
+    neo6m.onReceive(gpsReceive);
+    WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) { schedulerTrigger(jobHttp); },
+                 ARDUINO_EVENT_WIFI_AP_STACONNECTED);
+    WiFi.onEvent(
+        [](WiFiEvent_t event, WiFiEventInfo_t info)
         {
-            // char gpsMsg[100];
-            // snprintf(gpsMsg, sizeof(gpsMsg), "GPS - Lat: %.6f, Lng: %.6f, Satellites: %d",
-            //          gps.location.lat(), gps.location.lng(), gps.satellites.value());
-            // serialPrintln(gpsMsg);
-        }
-    }
+            power.apActivity = true;
+            schedulerTrigger(jobHttp);
+            schedulerTrigger(jobAp);
+        },
+        ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+    WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) { schedulerTrigger(jobUpload); },
+                 ARDUINO_EVENT_WIFI_STA_GOT_IP);
+
+    powerInit();
+    powerUpdateClients();
+}
 
-    delay(100);
-}
\ No newline at end of file
+void loop()
+{
+    schedulerRunDue();
+    schedulerSleep();
+}
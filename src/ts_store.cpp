@@ -0,0 +1,509 @@
+#include "ts_store.h"
+
+#include <esp_rom_crc.h>
+#include <string.h>
+#include <unistd.h>
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline size_t varintSize(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline uint8_t *putVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline const uint8_t *getVarint(const uint8_t *in, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return in;
+    }
+    return nullptr;
+}
+
+bool TsSeries::begin(fs::FS &fs, const char *name, uint8_t columns)
+{
+    fs_ = &fs;
+    columns_ = columns > TS_MAX_COLUMNS ? TS_MAX_COLUMNS : columns;
+    strncpy(name_, name, sizeof(name_) - 1);
+    snprintf(dataPath_, sizeof(dataPath_), TS_STORE_DIR "/%s.dat", name_);
+    snprintf(indexPath_, sizeof(indexPath_), TS_STORE_DIR "/%s.idx", name_);
+    if (!lock_)
+        lock_ = xSemaphoreCreateMutex();
+
+    index_.clear();
+    openCount_ = 0;
+    openBytes_ = 0;
+    openDirty_ = false;
+    openSequence_ = 0;
+    recovery_ = TsRecovery();
+
+    if (!fs.exists(TS_STORE_DIR) && !fs.mkdir(TS_STORE_DIR))
+        return false;
+
+    File indexFile = fs.open(indexPath_, FILE_READ);
+    if (indexFile)
+    {
+        TsIndexEntry entry;
+        while (indexFile.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry))
+            index_.push_back(entry);
+        indexFile.close();
+    }
+
+    size_t fileSize = 0;
+    File dataFile = fs.open(dataPath_, FILE_READ);
+    if (dataFile)
+    {
+        fileSize = dataFile.size();
+        dataFile.close();
+    }
+    uint32_t blocks = fileSize / TS_BLOCK_SIZE;
+    recovery_.bytesTruncated = fileSize % TS_BLOCK_SIZE;
+
+    // Verify the tail. A block is good if its CRC matches and its sequence
+    // follows the block before it; everything from the first bad one on is
+    // a torn or stale write.
+    uint8_t block[TS_BLOCK_SIZE];
+    const BlockHeader *header = (const BlockHeader *)block;
+    uint32_t validBlocks = blocks;
+    uint32_t lastSequence = 0;
+    bool lastSealed = true;
+    uint32_t firstChecked = blocks > TS_RECOVERY_BLOCKS ? blocks - TS_RECOVERY_BLOCKS : 0;
+    for (uint32_t slot = firstChecked; slot < blocks; slot++)
+    {
+        recovery_.blocksChecked++;
+        bool good = readBlock(slot, block) && verifyBlock(block);
+        if (good && recovery_.blocksChecked > 1 && header->sequence != lastSequence + 1)
+            good = false;
+        if (!good)
+        {
+            validBlocks = slot;
+            break;
+        }
+        lastSequence = header->sequence;
+        lastSealed = header->flags & BLOCK_SEALED;
+    }
+    if (validBlocks > 0 && validBlocks == firstChecked)
+    {
+        // Whole checked tail was bad; continue the sequence of the block
+        // before it
+        readBlock(validBlocks - 1, block);
+        lastSequence = header->sequence;
+        lastSealed = true;
+    }
+    if (validBlocks > 0)
+        openSequence_ = lastSealed ? lastSequence + 1 : lastSequence;
+
+    if (validBlocks < blocks || recovery_.bytesTruncated)
+    {
+        recovery_.blocksTruncated = blocks - validBlocks;
+        recovery_.truncateFailed = !truncateData(validBlocks);
+        blocks = validBlocks;
+    }
+
+    // The index is written after its block, so it can only be behind the
+    // data file unless the tail was just cut off
+    bool rewriteIndex = false;
+    if (index_.size() > blocks)
+    {
+        index_.resize(blocks);
+        rewriteIndex = true;
+    }
+
+    // Blocks past the index: sealed ones whose entry was lost, and at most
+    // one open block at the end
+    for (uint32_t slot = index_.size(); slot < blocks; slot++)
+    {
+        int count = readBlock(slot, block) ? decodeBlock(block, columns_, open_) : -1;
+        if (count > 0 && slot == blocks - 1 && !(header->flags & BLOCK_SEALED))
+        {
+            openCount_ = count;
+            openBytes_ = header->payloadLength;
+            break;
+        }
+
+        TsIndexEntry entry = {UINT32_MAX, 0, 0, 0};
+        if (count > 0)
+            entry = {header->minTime, header->maxTime, (uint16_t)count, 0};
+        index_.push_back(entry);
+        recovery_.indexRebuilt++;
+        rewriteIndex = true;
+    }
+
+    if (rewriteIndex)
+    {
+        indexFile = fs.open(indexPath_, FILE_WRITE);
+        if (indexFile)
+        {
+            indexFile.write((const uint8_t *)index_.data(), index_.size() * sizeof(TsIndexEntry));
+            indexFile.close();
+        }
+    }
+    return true;
+}
+
+uint32_t TsSeries::blockCrc(const uint8_t *block)
+{
+    BlockHeader header = *(const BlockHeader *)block;
+    header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header, sizeof(header));
+    return esp_rom_crc32_le(crc, block + sizeof(header), min(header.payloadLength, (uint16_t)PAYLOAD_SIZE));
+}
+
+bool TsSeries::verifyBlock(const uint8_t *block) const
+{
+    const BlockHeader *header = (const BlockHeader *)block;
+    return header->magic == BLOCK_MAGIC && header->columns == columns_ &&
+           header->payloadLength <= PAYLOAD_SIZE && header->crc == blockCrc(block);
+}
+
+// The FS wrapper has no truncate, so go through the VFS path
+bool TsSeries::truncateData(uint32_t blocks)
+{
+    char path[48];
+    snprintf(path, sizeof(path), TS_VFS_ROOT "%s", dataPath_);
+    return truncate(path, (off_t)blocks * TS_BLOCK_SIZE) == 0;
+}
+
+// Encoded size of record when it follows previous (nullptr at block start)
+size_t TsSeries::recordCost(const TsRecord *previous, const TsRecord &record) const
+{
+    size_t cost = varintSize(zigzag((int64_t)record.time - (previous ? previous->time : 0)));
+    for (int c = 0; c < columns_; c++)
+        cost += varintSize(zigzag((int64_t)record.values[c] - (previous ? previous->values[c] : 0)));
+    return cost;
+}
+
+size_t TsSeries::blockLength(const uint8_t *block)
+{
+    return sizeof(BlockHeader) + ((const BlockHeader *)block)->payloadLength;
+}
+
+uint16_t TsSeries::packBlock(const TsRecord *records, uint16_t count, uint32_t sequence, uint8_t *block) const
+{
+    uint16_t packed = 0;
+    size_t bytes = 0;
+    while (packed < count && packed < TS_BLOCK_MAX_RECORDS)
+    {
+        size_t cost = recordCost(packed ? &records[packed - 1] : nullptr, records[packed]);
+        if (bytes + cost > PAYLOAD_SIZE)
+            break;
+        bytes += cost;
+        packed++;
+    }
+    encodeBlock(records, packed, true, sequence, block);
+    return packed;
+}
+
+size_t TsSeries::encodeBlock(const TsRecord *records, uint16_t count, bool sealed, uint32_t sequence, uint8_t *block) const
+{
+    memset(block, 0, TS_BLOCK_SIZE);
+    BlockHeader *header = (BlockHeader *)block;
+    uint8_t *out = block + sizeof(BlockHeader);
+
+    header->magic = BLOCK_MAGIC;
+    header->columns = columns_;
+    header->flags = sealed ? BLOCK_SEALED : 0;
+    header->count = count;
+    header->minTime = UINT32_MAX;
+    header->maxTime = 0;
+
+    int64_t previous = 0;
+    for (int i = 0; i < count; i++)
+    {
+        out = putVarint(out, zigzag((int64_t)records[i].time - previous));
+        previous = records[i].time;
+        header->minTime = min(header->minTime, records[i].time);
+        header->maxTime = max(header->maxTime, records[i].time);
+    }
+    for (int c = 0; c < columns_; c++)
+    {
+        previous = 0;
+        for (int i = 0; i < count; i++)
+        {
+            out = putVarint(out, zigzag((int64_t)records[i].values[c] - previous));
+            previous = records[i].values[c];
+        }
+    }
+
+    header->payloadLength = out - (block + sizeof(BlockHeader));
+    header->sequence = sequence;
+    header->crc = blockCrc(block);
+    return header->payloadLength;
+}
+
+// Returns the record count, or -1 if the block is not a valid block of
+// this series
+int TsSeries::decodeBlock(const uint8_t *block, uint8_t columns, TsRecord *records)
+{
+    const BlockHeader *header = (const BlockHeader *)block;
+    if (header->magic != BLOCK_MAGIC || header->columns != columns ||
+        header->count > TS_BLOCK_MAX_RECORDS || header->payloadLength > PAYLOAD_SIZE)
+        return -1;
+
+    const uint8_t *in = block + sizeof(BlockHeader);
+    const uint8_t *end = in + header->payloadLength;
+    uint64_t raw;
+
+    int64_t previous = 0;
+    for (int i = 0; i < header->count; i++)
+    {
+        if (!(in = getVarint(in, end, raw)))
+            return -1;
+        previous += unzigzag(raw);
+        records[i].time = previous;
+    }
+    for (int c = 0; c < columns; c++)
+    {
+        previous = 0;
+        for (int i = 0; i < header->count; i++)
+        {
+            if (!(in = getVarint(in, end, raw)))
+                return -1;
+            previous += unzigzag(raw);
+            records[i].values[c] = previous;
+        }
+    }
+    for (int c = columns; c < TS_MAX_COLUMNS; c++)
+    {
+        for (int i = 0; i < header->count; i++)
+            records[i].values[c] = 0;
+    }
+    return header->count;
+}
+
+bool TsSeries::readBlock(uint32_t slot, uint8_t *block)
+{
+    File file = fs_->open(dataPath_, FILE_READ);
+    if (!file)
+        return false;
+    bool ok = file.seek(slot * TS_BLOCK_SIZE) && file.read(block, TS_BLOCK_SIZE) == TS_BLOCK_SIZE;
+    file.close();
+    return ok;
+}
+
+// Blocks are rewritten in place, so open for update rather than append
+bool TsSeries::writeBlock(uint32_t slot, bool sealed)
+{
+    uint8_t block[TS_BLOCK_SIZE];
+    encodeBlock(open_, openCount_, sealed, openSequence_, block);
+
+    File file = fs_->open(dataPath_, "r+");
+    if (!file)
+        file = fs_->open(dataPath_, "w+");
+    if (!file)
+    {
+        writeErrors_++;
+        return false;
+    }
+
+    bool ok = file.seek(slot * TS_BLOCK_SIZE) && file.write(block, TS_BLOCK_SIZE) == TS_BLOCK_SIZE;
+    file.close();
+    if (!ok)
+        writeErrors_++;
+    return ok;
+}
+
+bool TsSeries::seal()
+{
+    if (!writeBlock(index_.size(), true))
+        return false;
+
+    TsIndexEntry entry = {UINT32_MAX, 0, openCount_, 0};
+    for (int i = 0; i < openCount_; i++)
+    {
+        entry.minTime = min(entry.minTime, open_[i].time);
+        entry.maxTime = max(entry.maxTime, open_[i].time);
+    }
+    index_.push_back(entry);
+    openSequence_++;
+
+    // A lost index entry is rebuilt from the block header by begin()
+    File indexFile = fs_->open(indexPath_, FILE_APPEND);
+    if (indexFile)
+    {
+        indexFile.write((const uint8_t *)&entry, sizeof(entry));
+        indexFile.close();
+    }
+
+    openCount_ = 0;
+    openBytes_ = 0;
+    openDirty_ = false;
+    return true;
+}
+
+bool TsSeries::append(const TsRecord &record)
+{
+    lock();
+    bool ok = true;
+    if (openCount_ == TS_BLOCK_MAX_RECORDS || openBytes_ + recordCost(openCount_ ? &open_[openCount_ - 1] : nullptr, record) > PAYLOAD_SIZE)
+    {
+        if (!seal())
+        {
+            // Card is failing; start over rather than stalling every append
+            openCount_ = 0;
+            openBytes_ = 0;
+            ok = false;
+        }
+    }
+    openBytes_ += recordCost(openCount_ ? &open_[openCount_ - 1] : nullptr, record);
+    open_[openCount_++] = record;
+    openDirty_ = true;
+    unlock();
+    return ok;
+}
+
+bool TsSeries::sync()
+{
+    lock();
+    bool ok = true;
+    if (openDirty_ && openCount_ > 0)
+    {
+        ok = writeBlock(index_.size(), false);
+        openDirty_ = !ok;
+    }
+    unlock();
+    return ok;
+}
+
+bool TsSeries::clear()
+{
+    lock();
+    bool ok = true;
+    if (fs_->exists(dataPath_))
+        ok &= fs_->remove(dataPath_);
+    if (fs_->exists(indexPath_))
+        ok &= fs_->remove(indexPath_);
+    index_.clear();
+    openCount_ = 0;
+    openBytes_ = 0;
+    openDirty_ = false;
+    openSequence_ = 0;
+    unlock();
+    return ok;
+}
+
+uint32_t TsSeries::blockCount()
+{
+    lock();
+    uint32_t blocks = index_.size() + (openCount_ ? 1 : 0);
+    unlock();
+    return blocks;
+}
+
+uint32_t TsSeries::recordCount()
+{
+    lock();
+    uint32_t records = openCount_;
+    for (const TsIndexEntry &entry : index_)
+        records += entry.count;
+    unlock();
+    return records;
+}
+
+void TsIterator::reset(TsSeries &series, uint32_t from, uint32_t to)
+{
+    series_ = &series;
+    from_ = from;
+    to_ = to;
+    start_ = 0;
+    slot_ = 0;
+    nextBase_ = 0;
+    done_ = false;
+    count_ = 0;
+    position_ = 0;
+}
+
+void TsIterator::resetAtRecord(TsSeries &series, uint32_t ordinal)
+{
+    reset(series);
+    start_ = ordinal;
+}
+
+bool TsIterator::next(TsRecord &record)
+{
+    for (;;)
+    {
+        while (position_ < count_)
+        {
+            const TsRecord &candidate = records_[position_++];
+            if (candidate.time >= from_ && candidate.time <= to_)
+            {
+                ordinal_ = base_ + position_ - 1;
+                record = candidate;
+                return true;
+            }
+        }
+        if (!loadNextBlock())
+            return false;
+    }
+}
+
+bool TsIterator::loadNextBlock()
+{
+    if (done_)
+        return false;
+
+    count_ = 0;
+    position_ = 0;
+    series_->lock();
+
+    // Sealed blocks whose time range overlaps the scan. Index counts give
+    // record ordinals without reading the blocks being skipped.
+    while (slot_ < series_->index_.size())
+    {
+        const TsIndexEntry &entry = series_->index_[slot_++];
+        base_ = nextBase_;
+        nextBase_ += entry.count;
+        if (entry.count == 0 || nextBase_ <= start_ || entry.maxTime < from_ || entry.minTime > to_)
+            continue;
+
+        uint8_t block[TS_BLOCK_SIZE];
+        if (series_->readBlock(slot_ - 1, block) && series_->verifyBlock(block))
+            count_ = TsSeries::decodeBlock(block, series_->columns_, records_);
+        if (count_ > 0)
+        {
+            position_ = start_ > base_ ? start_ - base_ : 0;
+            series_->unlock();
+            return true;
+        }
+        count_ = 0;
+    }
+
+    // Then the open block straight from RAM
+    base_ = nextBase_;
+    count_ = series_->openCount_;
+    memcpy(records_, series_->open_, count_ * sizeof(TsRecord));
+    position_ = start_ > base_ ? min(start_ - base_, (uint32_t)count_) : 0;
+    done_ = true;
+    series_->unlock();
+    return position_ < count_;
+}
@@ -0,0 +1,585 @@
+// Host benchmarks for the firmware's hot paths: console logging, the
+// web pages, the three log writers, the running averages and the geofence
+// test every GPS fix runs.
+// Runs the unmodified src/main.cpp on the simulator shims (tools/sim), so
+// the code measured is the code that ships; only the Arduino core and the
+// card underneath are host stand-ins.
+//
+// Times are host times and only mean something relative to each other and
+// to the same benchmark on another commit, on the same machine. Allocation
+// counts carry over to the device: the shim String grows its buffer the way
+// the ESP32 core does, and every other heap allocation is counted too.
+//
+// Build after `pio pkg install` has fetched TinyGPSPlus:
+//
+//   LIB=.pio/libdeps/esp32doit-devkit-v1/TinyGPSPlus/src
+//   INC="-Itools/sim/include -Itools/sim -Iinclude -I$LIB"
+//   SIM="tools/sim/sim_core.cpp tools/sim/sim_fs.cpp tools/sim/sim_net.cpp tools/sim/sim_rtos.cpp"
+//   SRC="src/main.cpp src/ts_store.cpp $SIM $LIB/TinyGPS++.cpp tools/bench/bench.cpp"
+//   g++ -O2 -std=gnu++17 -pthread -DTS_VFS_ROOT='"."' $INC $SRC -o firmware_bench
+//
+// Usage:
+//
+//   firmware_bench [--filter SUBSTRING] [--min-time SEC] [--json FILE]
+//                  [--compare BASE.json]
+//
+// Each benchmark runs as many iterations as fit in --min-time (default
+// 0.1 s). --json writes the results in Google Benchmark's JSON layout plus
+// allocs_per_iter and bytes_per_iter; --compare reads such a file from an
+// earlier commit and prints the change per benchmark:
+//
+//   git stash && firmware_bench --json base.json && git stash pop
+//   firmware_bench --compare base.json
+//
+// The firmware boots into a scratch card directory under /tmp with a fixed
+// BMP180 reading and no GPS; benchmarks that need a moving vehicle with a
+// fix set one up directly.
+
+#include <chrono>
+#include <limits.h>
+#include <map>
+#include <new>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Adafruit_BMP085.h>
+#include <Arduino.h>
+#include <SD.h>
+#include <WebServer.h>
+
+#include "geofence.h"
+#include "gps_ingest.h"
+#include "page_template.h"
+#include "persistent_server.h"
+#include "sim.h"
+
+#define BENCH_MAX_ITERATIONS ((uint64_t)1000000000)
+
+void setup();
+void serialPrintln(const char *message);
+void handleSerial();
+void handleRoot();
+void writeFileList(PageWriter &out);
+void logGPSData(float pressure);
+void logGPSDataFlow(float flow);
+void logGPSTrackData();
+void runLoggerJob();
+void addPressureReading(float pressure);
+float calculateAveragePressure();
+void addFlowReading(float flow);
+float calculateAverageFlow();
+float calculateVariation(const float *readings, int count);
+void updateMotionState();
+bool vehicleIsMoving();
+
+extern GpsFix gpsFix;
+extern PersistentWebServer server;
+
+// Every operator new counts as a heap allocation, on top of the String
+// buffers the shim counts itself
+
+void *operator new(size_t size)
+{
+    simHeap.allocations++;
+    simHeap.bytes += size;
+    void *block = malloc(size ? size : 1);
+    if (!block)
+        throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void *block) noexcept
+{
+    free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    free(block);
+}
+
+// Constant sensor, the benchmarks feed readings themselves
+
+bool Adafruit_BMP085::begin(uint8_t mode)
+{
+    return true;
+}
+
+int32_t Adafruit_BMP085::readPressure()
+{
+    return 100800;
+}
+
+float Adafruit_BMP085::readTemperature()
+{
+    return 29.0f;
+}
+
+template <typename T>
+static inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static uint64_t cpuNs()
+{
+    // Process clock: the logger task runs on its own host thread
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Iteration loop handed to each benchmark:
+//
+//   while (state.keepRunning())
+//       ...;
+//
+// Timing and allocation counting cover the loop only, so per-benchmark
+// preparation goes before it.
+class BenchState
+{
+public:
+    explicit BenchState(uint64_t iterations) : iterations_(iterations) {}
+
+    bool keepRunning()
+    {
+        if (done_ == 0 && !started_)
+        {
+            started_ = true;
+            heapStart_ = simHeap;
+            cpuStart_ = cpuNs();
+            wallStart_ = std::chrono::steady_clock::now();
+        }
+        if (done_ < iterations_)
+        {
+            done_++;
+            return true;
+        }
+        std::chrono::duration<double, std::nano> wall = std::chrono::steady_clock::now() - wallStart_;
+        realNs = wall.count();
+        cpuNsTotal = cpuNs() - cpuStart_;
+        allocations = simHeap.allocations - heapStart_.allocations;
+        bytes = simHeap.bytes - heapStart_.bytes;
+        return false;
+    }
+
+    uint64_t iterations() const { return iterations_; }
+
+    double realNs = 0;
+    uint64_t cpuNsTotal = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+
+private:
+    uint64_t iterations_;
+    uint64_t done_ = 0;
+    bool started_ = false;
+    SimHeapStats heapStart_ = {};
+    uint64_t cpuStart_ = 0;
+    std::chrono::steady_clock::time_point wallStart_;
+};
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t iterations;
+    double realNs; // Per iteration
+    double cpuNs;
+    double allocations;
+    double bytes;
+};
+
+// Benchmarks
+
+static const std::map<std::string, std::string> noArgs;
+static std::string responseBody;
+
+static void benchSerialPrintln(BenchState &state)
+{
+    while (state.keepRunning())
+        serialPrintln("Pressure: 1008.42 hPa (Avg: 1008.10/T: 0.20%)");
+}
+
+static void benchHandleSerial(BenchState &state)
+{
+    for (int i = 0; i < 100; i++)
+        serialPrintln("Pressure: 1008.42 hPa (Avg: 1008.10/T: 0.20%)");
+    while (state.keepRunning())
+        server.simRequest("/serial", noArgs, responseBody);
+}
+
+static void benchHandleRoot(BenchState &state)
+{
+    while (state.keepRunning())
+        server.simRequest("/", noArgs, responseBody);
+}
+
+static void discardPage(const char *data, size_t length)
+{
+    doNotOptimize(data);
+}
+
+static void benchWriteFileList(BenchState &state)
+{
+    char buffer[1024];
+    while (state.keepRunning())
+    {
+        PageWriter out(buffer, sizeof(buffer), discardPage);
+        writeFileList(out);
+        out.flush();
+    }
+}
+
+// The writers only queue; the logger job turns records into store rows, so
+// both are timed. Full buffers hand over to the logger task as on the device.
+static void benchLogGPSData(BenchState &state)
+{
+    while (state.keepRunning())
+    {
+        logGPSData(1012.5f);
+        runLoggerJob();
+    }
+}
+
+static void benchLogGPSDataFlow(BenchState &state)
+{
+    while (state.keepRunning())
+    {
+        logGPSDataFlow(18.2f);
+        runLoggerJob();
+    }
+}
+
+static void benchLogGPSTrackData(BenchState &state)
+{
+    while (state.keepRunning())
+    {
+        logGPSTrackData();
+        runLoggerJob();
+    }
+}
+
+static void benchPressureAverage(BenchState &state)
+{
+    float pressure = 1008.0f;
+    while (state.keepRunning())
+    {
+        addPressureReading(pressure);
+        doNotOptimize(calculateAveragePressure());
+        pressure = pressure < 1012.0f ? pressure + 0.25f : 1008.0f;
+    }
+}
+
+static void benchFlowAverage(BenchState &state)
+{
+    float flow = 16.0f;
+    while (state.keepRunning())
+    {
+        addFlowReading(flow);
+        doNotOptimize(calculateAverageFlow());
+        flow = flow < 20.0f ? flow + 0.5f : 16.0f;
+    }
+}
+
+static void benchCalculateVariation(BenchState &state)
+{
+    float readings[10] = {1008.1f, 1008.3f, 1007.9f, 1008.0f, 1012.4f,
+                          1008.2f, 1008.1f, 1007.8f, 1008.0f, 1008.2f};
+    while (state.keepRunning())
+    {
+        doNotOptimize(readings);
+        doNotOptimize(calculateVariation(readings, 10));
+    }
+}
+
+// A full set of fields, 16 x 16 irregular octagons 100 m apart, crossed
+// diagonally so the fix moves through every cell of the grid
+static Geofences benchFences;
+
+static void noGeofenceChange(size_t zone, bool entered)
+{
+    doNotOptimize(zone);
+}
+
+static void benchGeofenceUpdate(BenchState &state)
+{
+    benchFences.clear();
+    for (int row = 0; row < 16; row++)
+    {
+        for (int col = 0; col < 16; col++)
+        {
+            char name[GEOFENCE_NAME_SIZE];
+            snprintf(name, sizeof(name), "Field %d-%d", row, col);
+            benchFences.beginZone(name, GEOFENCE_LOG);
+            int32_t lat = -7250000 + row * 900;
+            int32_t lng = 112750000 + col * 900;
+            for (int v = 0; v < 8; v++)
+            {
+                double angle = v * M_PI / 4;
+                int32_t radius = 350 + (v * 37 + row * 11 + col * 7) % 90;
+                benchFences.addVertex(lat + lround(radius * sin(angle)), lng + lround(radius * cos(angle)));
+            }
+            benchFences.endZone();
+        }
+    }
+    benchFences.index();
+
+    int step = 0;
+    while (state.keepRunning())
+    {
+        int32_t offset = step * 7 % 15000;
+        benchFences.update(-7250500 + offset, 112749500 + offset, noGeofenceChange);
+        step++;
+    }
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(BenchState &state);
+} benchmarks[] = {
+    {"serialPrintln", benchSerialPrintln},
+    {"handleSerial", benchHandleSerial},
+    {"handleRoot", benchHandleRoot},
+    {"writeFileList", benchWriteFileList},
+    {"logGPSData", benchLogGPSData},
+    {"logGPSDataFlow", benchLogGPSDataFlow},
+    {"logGPSTrackData", benchLogGPSTrackData},
+    {"pressureAverage", benchPressureAverage},
+    {"flowAverage", benchFlowAverage},
+    {"calculateVariation", benchCalculateVariation},
+    {"geofenceUpdate", benchGeofenceUpdate},
+};
+
+// Harness
+
+static std::string cardDir;
+
+// A handful of files for the card listing, like a few days of use leave
+static void populateCard()
+{
+    const char *names[] = {"notes.txt", "calibration.csv", "export_2024-01-01.csv", "export_2024-01-02.csv",
+                           "firmware.bin"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        File file = SD.open(String("/") + names[i], FILE_WRITE);
+        for (size_t k = 0; k < 200 * (i + 1); k++)
+            file.print("0123456789");
+        file.close();
+    }
+}
+
+// A valid fix at walking pace, held until motion detection says moving
+static void startMoving()
+{
+    gpsFix.valid = true;
+    gpsFix.lat = -7.25;
+    gpsFix.lng = 112.75;
+    gpsFix.speedKmph = 10;
+    gpsFix.hdop = 1;
+    gpsFix.satellites = 8;
+    for (int i = 0; i < 100 && !vehicleIsMoving(); i++)
+    {
+        gpsFix.timestamp = simClockUs;
+        gpsFix.lng += 0.00003;
+        updateMotionState();
+    }
+    if (!vehicleIsMoving())
+        fprintf(stderr, "bench: vehicle never started moving, log writers measure the stationary path\n");
+}
+
+static BenchResult measure(const char *name, void (*run)(BenchState &state), double minTimeSec)
+{
+    uint64_t iterations = 1;
+    for (;;)
+    {
+        BenchState state(iterations);
+        run(state);
+        double seconds = state.realNs / 1e9;
+        if (seconds >= minTimeSec || iterations >= BENCH_MAX_ITERATIONS)
+        {
+            double n = (double)iterations;
+            return {name, iterations, state.realNs / n, state.cpuNsTotal / n, state.allocations / n,
+                    state.bytes / n};
+        }
+        // Aim 40% past the minimum, growing at most tenfold per round
+        double scale = seconds > 0 ? minTimeSec * 1.4 / seconds : 10;
+        iterations = std::min(BENCH_MAX_ITERATIONS, (uint64_t)(iterations * std::min(10.0, std::max(scale, 1.5))) + 1);
+    }
+}
+
+static void writeJson(const char *path, const char *executable, const std::vector<BenchResult> &results)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"date\": \"%s\",\n", date);
+    fprintf(out, "    \"host_name\": \"%s\",\n", host);
+    fprintf(out, "    \"executable\": \"%s\",\n", executable);
+    fprintf(out, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(out, "    \"library_build_type\": \"%s\"\n", "firmware_bench");
+    fprintf(out, "  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": \"%s\",\n", r.name.c_str());
+        fprintf(out, "      \"run_name\": \"%s\",\n", r.name.c_str());
+        fprintf(out, "      \"run_type\": \"iteration\",\n");
+        fprintf(out, "      \"iterations\": %llu,\n", (unsigned long long)r.iterations);
+        fprintf(out, "      \"real_time\": %.3f,\n", r.realNs);
+        fprintf(out, "      \"cpu_time\": %.3f,\n", r.cpuNs);
+        fprintf(out, "      \"time_unit\": \"ns\",\n");
+        fprintf(out, "      \"allocs_per_iter\": %.3f,\n", r.allocations);
+        fprintf(out, "      \"bytes_per_iter\": %.3f\n", r.bytes);
+        fprintf(out, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+}
+
+// Reads the one-field-per-line layout writeJson() and Google Benchmark
+// both produce; entries without allocation counts get -1
+static bool readJson(const char *path, std::vector<BenchResult> &results)
+{
+    FILE *in = fopen(path, "r");
+    if (!in)
+        return false;
+
+    char line[512];
+    BenchResult *current = nullptr;
+    while (fgets(line, sizeof(line), in))
+    {
+        char text[256];
+        double value;
+        if (sscanf(line, " \"name\": \"%255[^\"]\"", text) == 1)
+        {
+            results.push_back({text, 0, 0, 0, -1, -1});
+            current = &results.back();
+        }
+        else if (!current)
+            continue;
+        else if (sscanf(line, " \"real_time\": %lf", &value) == 1)
+            current->realNs = value;
+        else if (sscanf(line, " \"cpu_time\": %lf", &value) == 1)
+            current->cpuNs = value;
+        else if (sscanf(line, " \"allocs_per_iter\": %lf", &value) == 1)
+            current->allocations = value;
+        else if (sscanf(line, " \"bytes_per_iter\": %lf", &value) == 1)
+            current->bytes = value;
+    }
+    fclose(in);
+    return true;
+}
+
+static void printResults(const std::vector<BenchResult> &results, const std::vector<BenchResult> &base)
+{
+    printf("%-20s %12s %12s %12s %10s %12s\n", "benchmark", "time ns", "cpu ns", "iterations", "allocs", "bytes");
+    for (const BenchResult &r : results)
+    {
+        printf("%-20s %12.1f %12.1f %12llu %10.2f %12.1f\n", r.name.c_str(), r.realNs, r.cpuNs,
+               (unsigned long long)r.iterations, r.allocations, r.bytes);
+        for (const BenchResult &b : base)
+        {
+            if (b.name != r.name)
+                continue;
+            printf("%-20s %+11.1f%%", "  vs base", b.realNs > 0 ? (r.realNs / b.realNs - 1) * 100 : 0.0);
+            printf(" %+11.1f%%", b.cpuNs > 0 ? (r.cpuNs / b.cpuNs - 1) * 100 : 0.0);
+            if (b.allocations >= 0)
+                printf(" %12s %+10.2f %+12.1f", "", r.allocations - b.allocations, r.bytes - b.bytes);
+            printf("\n");
+        }
+    }
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [--filter SUBSTRING] [--min-time SEC] [--json FILE] [--compare BASE.json]\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    const char *jsonPath = nullptr;
+    const char *basePath = nullptr;
+    double minTimeSec = 0.1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+        if (arg == "--filter" && value)
+            filter = argv[++i];
+        else if (arg == "--min-time" && value)
+            minTimeSec = atof(argv[++i]);
+        else if (arg == "--json" && value)
+            jsonPath = argv[++i];
+        else if (arg == "--compare" && value)
+            basePath = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchResult> base;
+    if (basePath && !readJson(basePath, base))
+    {
+        fprintf(stderr, "cannot read %s\n", basePath);
+        return 2;
+    }
+
+    char startDir[PATH_MAX];
+    char scratch[] = "/tmp/firmware_bench.XXXXXX";
+    if (!getcwd(startDir, sizeof(startDir)) || !mkdtemp(scratch) || chdir(scratch) != 0)
+    {
+        fprintf(stderr, "cannot create a scratch card directory\n");
+        return 2;
+    }
+    cardDir = scratch;
+    simSerialLog = fopen("/dev/null", "w");
+
+    simStartLoopTask();
+    setup();
+    populateCard();
+    startMoving();
+
+    std::vector<BenchResult> results;
+    for (const auto &benchmark : benchmarks)
+    {
+        if (filter && !strstr(benchmark.name, filter))
+            continue;
+        results.push_back(measure(benchmark.name, benchmark.run, minTimeSec));
+    }
+
+    printResults(results, base);
+    if (jsonPath)
+    {
+        // Relative to where we were started, not the scratch card
+        std::string path = jsonPath[0] == '/' ? jsonPath : std::string(startDir) + "/" + jsonPath;
+        writeJson(path.c_str(), argv[0], results);
+    }
+
+    std::string remove = "rm -rf '" + cardDir + "'";
+    if (system(remove.c_str()) != 0)
+        fprintf(stderr, "left %s behind\n", cardDir.c_str());
+    simExit(0); // The firmware's tasks are still parked on their threads
+}
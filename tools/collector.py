@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Stand-in collector for the tracker's store-and-forward upload.
+
+Accepts POST <path>?series=&generation=&offset=&count= with a body of store
+blocks, appends the decoded records to <out>/<device>_<series>_g<generation>.csv
+and answers with the number of records held for that series.
+
+    python3 tools/collector.py --port 8080 --out uploads
+    Collector URL on the device: http://<this host>:8080/ingest
+"""
+
+import argparse
+import os
+import struct
+import zlib
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from urllib.parse import parse_qs, urlparse
+
+HEADER = struct.Struct("<HBBHHIIII")  # magic, columns, flags, count, payload, min, max, sequence, crc
+BLOCK_MAGIC = 0x5354
+COORD_SCALE = 1e6
+VALUE_SCALE = 100.0
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_blocks(body):
+    """Yield rows of (time, value columns...) from concatenated blocks."""
+    pos = 0
+    while pos + HEADER.size <= len(body):
+        magic, columns, flags, count, length, _, _, sequence, crc = HEADER.unpack_from(body, pos)
+        if magic != BLOCK_MAGIC:
+            raise ValueError("bad block magic")
+        header = body[pos:pos + HEADER.size - 4] + bytes(4)  # CRC is taken with the crc field zero
+        payload = body[pos + HEADER.size:pos + HEADER.size + length]
+        if zlib.crc32(payload, zlib.crc32(header)) != crc:
+            raise ValueError("bad block crc")
+        pos += HEADER.size + length
+
+        rows = [[0] * (columns + 1) for _ in range(count)]
+        at = 0
+        for column in range(columns + 1):
+            previous = 0
+            for row in rows:
+                raw, at = read_varint(payload, at)
+                previous += unzigzag(raw)
+                row[column] = previous
+        yield from rows
+
+
+class Collector(BaseHTTPRequestHandler):
+    out_dir = "."
+
+    def do_POST(self):
+        query = {k: v[0] for k, v in parse_qs(urlparse(self.path).query).items()}
+        device = self.headers.get("X-Device", "device").replace("/", "_").replace(" ", "_")
+        series = query.get("series", "unknown").replace("/", "_")
+        path = os.path.join(self.out_dir, "%s_%s_g%s.csv" % (device, series, query.get("generation", "0")))
+        offset = int(query.get("offset", 0))
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+        try:
+            rows = list(decode_blocks(body))
+        except (ValueError, IndexError) as error:
+            self.send_error(400, str(error))
+            return
+
+        held = self.held(path)
+        # Offsets past what we hold are records the device could not read
+        # back; skip ahead. Anything below is a resend and is dropped.
+        with open(path, "a") as csv:
+            for row in rows[max(held - offset, 0):]:
+                lat, lng = row[1] / COORD_SCALE, row[2] / COORD_SCALE
+                value = row[3] if series == "track" else row[3] / VALUE_SCALE
+                csv.write("%d,%.6f,%.6f,%s\n" % (row[0], lat, lng, value))
+        held = max(held, offset + len(rows))
+        with open(path + ".count", "w") as count_file:
+            count_file.write(str(held))
+
+        reply = str(held).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(reply)))
+        self.end_headers()
+        self.wfile.write(reply)
+
+    @staticmethod
+    def held(path):
+        try:
+            with open(path + ".count") as count_file:
+                return int(count_file.read() or 0)
+        except FileNotFoundError:
+            return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--out", default="uploads")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    Collector.out_dir = args.out
+    HTTPServer(("", args.port), Collector).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
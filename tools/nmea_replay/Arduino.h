@@ -0,0 +1,27 @@
+#pragma once
+
+// Just enough of Arduino.h for TinyGPSPlus on the host. millis() follows
+// the replay clock so fix ages match what the device would have seen.
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * PI / 180.0)
+#define degrees(rad) ((rad) * 180.0 / PI)
+#define sq(x) ((x) * (x))
+
+extern uint64_t replayClockUs;
+
+inline unsigned long millis()
+{
+    return replayClockUs / 1000;
+}
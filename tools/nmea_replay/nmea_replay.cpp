@@ -0,0 +1,236 @@
+// Host replay of recorded NMEA through the firmware's GPS ingest path
+// (include/gps_ingest.h): the same gpsIngestByte() and GpsLockMonitor the
+// UART task and processGPS() use, on the same TinyGPSPlus.
+//
+// Reports sentence throughput, checksum failures and parse cost per
+// sentence type, and prints every lock transition. With --expect the
+// transitions are compared against a file of expected messages and the
+// exit status says whether they matched, so a capture plus its expected
+// transitions gates any change to the ingest path.
+//
+// Build after `pio pkg install` has fetched TinyGPSPlus:
+//
+//   LIB=.pio/libdeps/esp32doit-devkit-v1/TinyGPSPlus/src
+//   INC="-Itools/nmea_replay -Iinclude -I$LIB"
+//   SRC="tools/nmea_replay/nmea_replay.cpp $LIB/TinyGPS++.cpp"
+//   g++ -O2 -std=gnu++17 -DARDUINO=100 $INC $SRC -o nmea_replay
+//
+// Usage:
+//
+//   nmea_replay capture.nmea [--realtime] [--baud 9600] [--repeat N]
+//               [--expect transitions.txt] [--max-failed N]
+//
+// sample.nmea is a short synthetic capture (no fix, fix, too few
+// satellites, fix again, fix lost, one corrupted sentence) with its
+// transitions in sample.expect:
+//
+//   DIR=tools/nmea_replay
+//   ./nmea_replay $DIR/sample.nmea --max-failed 1 --expect $DIR/sample.expect
+//
+// By default bytes are fed as fast as possible; the replay clock still
+// advances at the UART byte rate so fix timestamps and ages are those of
+// the live link. --realtime also paces feeding to that rate.
+
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gps_ingest.h"
+
+uint64_t replayClockUs = 0;
+
+struct SentenceCost
+{
+    uint32_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+};
+
+static std::vector<char> readFile(const char *path)
+{
+    std::vector<char> data;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return data;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + read);
+    fclose(file);
+    return data;
+}
+
+static std::vector<std::string> readLines(const char *path)
+{
+    std::vector<std::string> lines;
+    std::vector<char> data = readFile(path);
+    std::string line;
+    for (char c : data)
+    {
+        if (c == '\n')
+        {
+            if (!line.empty())
+                lines.push_back(line);
+            line.clear();
+        }
+        else if (c != '\r')
+        {
+            line += c;
+        }
+    }
+    if (!line.empty())
+        lines.push_back(line);
+    return lines;
+}
+
+int main(int argc, char **argv)
+{
+    const char *capturePath = nullptr;
+    const char *expectPath = nullptr;
+    bool realtime = false;
+    unsigned baud = 9600;
+    int repeat = 1;
+    long maxFailed = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--realtime")
+            realtime = true;
+        else if (arg == "--baud" && i + 1 < argc)
+            baud = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (arg == "--expect" && i + 1 < argc)
+            expectPath = argv[++i];
+        else if (arg == "--max-failed" && i + 1 < argc)
+            maxFailed = atol(argv[++i]);
+        else if (!capturePath && arg[0] != '-')
+            capturePath = argv[i];
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!capturePath || baud == 0 || repeat < 1)
+    {
+        fprintf(stderr, "usage: %s capture.nmea [--realtime] [--baud N] [--repeat N] "
+                        "[--expect file] [--max-failed N]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<char> capture = readFile(capturePath);
+    if (capture.empty())
+    {
+        fprintf(stderr, "cannot read %s\n", capturePath);
+        return 2;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    const uint64_t byteUs = 10000000ULL / baud; // 8N1: ten bits per byte
+
+    TinyGPSPlus gps;
+    GpsLockMonitor lock;
+    std::vector<std::string> transitions;
+    std::map<std::string, SentenceCost> costs;
+    uint32_t fixes = 0;
+
+    std::string type;
+    uint64_t sentenceNs = 0;
+    bool inSentence = false;
+    Clock::time_point start = Clock::now();
+
+    for (int pass = 0; pass < repeat; pass++)
+    {
+        for (char c : capture)
+        {
+            replayClockUs += byteUs;
+            if (realtime)
+                std::this_thread::sleep_until(start + std::chrono::microseconds(replayClockUs));
+
+            if (c == '$')
+            {
+                inSentence = true;
+                sentenceNs = 0;
+                type.clear();
+            }
+            else if (inSentence && type.size() < 5 && c != ',')
+            {
+                type += c; // Talker and sentence id, e.g. GPGGA
+            }
+
+            Clock::time_point before = Clock::now();
+            GpsFix fix;
+            bool updated = gpsIngestByte(gps, c, replayClockUs, fix);
+            sentenceNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count();
+
+            if (updated)
+            {
+                fixes++;
+                GpsLockEvent event = lock.update(fix);
+                if (event != GPS_LOCK_UNCHANGED)
+                {
+                    transitions.push_back(gpsLockEventMessage(event));
+                    printf("%10.3f s  %s (%u satellites)\n", replayClockUs / 1e6,
+                           gpsLockEventMessage(event), fix.satellites);
+                }
+            }
+
+            if (c == '\n' && inSentence)
+            {
+                SentenceCost &cost = costs[type];
+                cost.count++;
+                cost.totalNs += sentenceNs;
+                if (sentenceNs > cost.maxNs)
+                    cost.maxNs = sentenceNs;
+                inSentence = false;
+            }
+        }
+    }
+
+    double wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    uint32_t sentences = gps.passedChecksum() + gps.failedChecksum();
+
+    printf("\n%u bytes, %u sentences (%u passed, %u failed checksum), %u with fix, %u fix updates\n",
+           (unsigned)gps.charsProcessed(), (unsigned)sentences, (unsigned)gps.passedChecksum(),
+           (unsigned)gps.failedChecksum(), (unsigned)gps.sentencesWithFix(), (unsigned)fixes);
+    printf("%.3f s wall for %.3f s of UART time: %.0f sentences/s, %.2f MB/s\n",
+           wallSeconds, replayClockUs / 1e6, sentences / wallSeconds,
+           gps.charsProcessed() / wallSeconds / 1e6);
+    printf("\n%-8s %10s %12s %12s\n", "sentence", "count", "mean ns", "max ns");
+    for (const auto &entry : costs)
+    {
+        printf("%-8s %10u %12.0f %12llu\n", entry.first.c_str(), entry.second.count,
+               (double)entry.second.totalNs / entry.second.count, (unsigned long long)entry.second.maxNs);
+    }
+
+    int status = 0;
+    if (maxFailed >= 0 && (long)gps.failedChecksum() > maxFailed)
+    {
+        printf("\nFAIL: %u checksum failures, at most %ld allowed\n", (unsigned)gps.failedChecksum(), maxFailed);
+        status = 1;
+    }
+    if (expectPath)
+    {
+        std::vector<std::string> expected = readLines(expectPath);
+        if (expected != transitions)
+        {
+            printf("\nFAIL: lock transitions differ from %s\n", expectPath);
+            for (size_t i = 0; i < expected.size() || i < transitions.size(); i++)
+            {
+                printf("  expected: %-20s got: %s\n", i < expected.size() ? expected[i].c_str() : "-",
+                       i < transitions.size() ? transitions[i].c_str() : "-");
+            }
+            status = 1;
+        }
+        else
+        {
+            printf("\nLock transitions match %s\n", expectPath);
+        }
+    }
+    return status;
+}
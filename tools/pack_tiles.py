@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Pack map tiles into the single-file archive the tracker serves.
+
+Takes an XYZ tile tree (<dir>/<z>/<x>/<y>.png|jpg|webp, as most tile
+downloaders write it) or an MBTiles file and writes tiles.pak, the layout
+include/tile_archive.h reads. Copy it to the root of the SD card; the map
+page at http://192.168.4.1/map then works without internet.
+
+    python3 tools/pack_tiles.py --tiles ~/tiles/farm --out tiles.pak
+    python3 tools/pack_tiles.py --tiles farm.mbtiles --out tiles.pak
+"""
+
+import argparse
+import math
+import os
+import sqlite3
+import struct
+import time
+
+MAGIC = b"TPAK"
+VERSION = 1
+HEADER = struct.Struct("<4sHBBIIIIIBBHiiii")  # TileArchiveHeader, 48 bytes
+ENTRY = struct.Struct("<QII")                 # TileIndexEntry, 16 bytes
+DIRECTORY_MAX = 512                           # TILE_DIRECTORY_MAX
+PAGE_MIN_ENTRIES = 64                         # One 1 KB read per lookup for small sets
+PAGE_MAX_ENTRIES = 1024                       # TILE_PAGE_MAX_ENTRIES
+FORMATS = {"png": 0, "jpg": 1, "jpeg": 1, "webp": 2}
+
+
+def tile_key(z, x, y):
+    return z << 48 | x << 24 | y
+
+
+def read_tree(root):
+    tiles = {}
+    extensions = set()
+    for z in os.listdir(root):
+        if not z.isdigit():
+            continue
+        for x in os.listdir(os.path.join(root, z)):
+            if not x.isdigit():
+                continue
+            for name in os.listdir(os.path.join(root, z, x)):
+                y, _, extension = name.partition(".")
+                if not y.isdigit() or extension.lower() not in FORMATS:
+                    continue
+                with open(os.path.join(root, z, x, name), "rb") as f:
+                    tiles[(int(z), int(x), int(y))] = f.read()
+                extensions.add(FORMATS[extension.lower()])
+    if len(extensions) > 1:
+        raise SystemExit("tiles must all have the same format")
+    return tiles, extensions.pop() if extensions else 0
+
+
+def read_mbtiles(path):
+    db = sqlite3.connect(path)
+    metadata = dict(db.execute("SELECT name, value FROM metadata"))
+    tiles = {}
+    for z, x, row, data in db.execute("SELECT zoom_level, tile_column, tile_row, tile_data FROM tiles"):
+        tiles[(z, x, (1 << z) - 1 - row)] = bytes(data)  # MBTiles rows count from the south
+    return tiles, FORMATS.get(metadata.get("format", "png"), 0)
+
+
+def tile_bounds(z, x, y):
+    """South, west, north, east of a tile in degrees"""
+    n = 1 << z
+
+    def lat(row):
+        return math.degrees(math.atan(math.sinh(math.pi * (1 - 2 * row / n))))
+
+    return lat(y + 1), x / n * 360 - 180, lat(y), (x + 1) / n * 360 - 180
+
+
+def pack(tiles, tile_format, out):
+    keys = sorted(tiles, key=lambda t: tile_key(*t))
+    count = len(keys)
+    page_entries = max(PAGE_MIN_ENTRIES, -(-count // DIRECTORY_MAX))
+    if page_entries > PAGE_MAX_ENTRIES:
+        raise SystemExit("%d tiles is more than one archive can index" % count)
+    pages = -(-count // page_entries)
+
+    # Identical tiles (open sea, empty fields) are stored once
+    directory_offset = HEADER.size
+    index_offset = directory_offset + pages * 8
+    data_offset = index_offset + count * ENTRY.size
+    stored = {}
+    blobs = []
+    entries = []
+    for key in keys:
+        data = tiles[key]
+        if data not in stored:
+            stored[data] = data_offset
+            blobs.append(data)
+            data_offset += len(data)
+        entries.append((tile_key(*key), stored[data], len(data)))
+    if data_offset > 0xFFFFFFFF:
+        raise SystemExit("archive would be larger than 4 GB")
+
+    zooms = [z for z, _, _ in keys]
+    top = [k for k in keys if k[0] == max(zooms)]
+    south = min(tile_bounds(*k)[0] for k in top)
+    west = min(tile_bounds(*k)[1] for k in top)
+    north = max(tile_bounds(*k)[2] for k in top)
+    east = max(tile_bounds(*k)[3] for k in top)
+
+    with open(out, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, tile_format, 0, int(time.time()), count, page_entries,
+                            directory_offset, index_offset, min(zooms), max(zooms), 0,
+                            round(south * 1e6), round(west * 1e6), round(north * 1e6), round(east * 1e6)))
+        for page in range(pages):
+            f.write(struct.pack("<Q", entries[page * page_entries][0]))
+        for entry in entries:
+            f.write(ENTRY.pack(*entry))
+        for data in blobs:
+            f.write(data)
+    print("%d tiles (%d distinct), zoom %d-%d, %d bytes" % (count, len(blobs), min(zooms), max(zooms), data_offset))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--tiles", required=True, help="XYZ tile directory or .mbtiles file")
+    parser.add_argument("--out", default="tiles.pak")
+    args = parser.parse_args()
+
+    if os.path.isdir(args.tiles):
+        tiles, tile_format = read_tree(args.tiles)
+    else:
+        tiles, tile_format = read_mbtiles(args.tiles)
+    if not tiles:
+        raise SystemExit("no tiles found in " + args.tiles)
+    pack(tiles, tile_format, args.out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,13 @@
+#pragma once
+
+// BMP180 replaying the pressure trace (see sim.cpp)
+
+#include "Arduino.h"
+
+class Adafruit_BMP085
+{
+public:
+    bool begin(uint8_t mode = 3);
+    int32_t readPressure();
+    float readTemperature();
+};
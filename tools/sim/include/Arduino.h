@@ -0,0 +1,273 @@
+#pragma once
+
+// Arduino core for the simulator: String, Print/Stream, the serial ports,
+// GPIO and interrupts. Time comes from the virtual clock (sim.h).
+
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <utility>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define ARDUINO 10819
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define PROGMEM
+#define PGM_P const char *
+#define F(x) (x)
+#define FPSTR(x) (x)
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define SERIAL_8N1 0x800001c
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * PI / 180.0)
+#define degrees(rad) ((rad) * 180.0 / PI)
+#define sq(x) ((x) * (x))
+
+using std::max;
+using std::min;
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+inline int digitalPinToInterrupt(int pin) { return pin; }
+void attachInterrupt(int pin, void (*isr)(), int mode);
+void detachInterrupt(int pin);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+// Same storage policy as the ESP32 core's WString: up to 10 characters
+// live inside the object, longer ones get a heap buffer that grows to the
+// exact need rounded up to 16 bytes. Appending therefore reallocates about
+// every 16 characters, which is what allocation counts taken on the host
+// should reflect. Heap traffic goes through simHeapRealloc()/simHeapFree().
+class String
+{
+public:
+    String(const char *s = "") { copy(s ? s : "", s ? strlen(s) : 0); }
+    String(const String &other) { copy(other.c_str(), other.len_); }
+    String(String &&other) { move(other); }
+    explicit String(char c) { copy(&c, 1); }
+    explicit String(int value, unsigned char base = 10) { formatInteger(value, base); }
+    explicit String(unsigned int value, unsigned char base = 10) { formatUnsigned(value, base); }
+    explicit String(long value, unsigned char base = 10) { formatInteger(value, base); }
+    explicit String(unsigned long value, unsigned char base = 10) { formatUnsigned(value, base); }
+    explicit String(long long value, unsigned char base = 10) { formatInteger(value, base); }
+    explicit String(unsigned long long value, unsigned char base = 10) { formatUnsigned(value, base); }
+    explicit String(float value, unsigned int decimals = 2) { formatDouble(value, decimals); }
+    explicit String(double value, unsigned int decimals = 2) { formatDouble(value, decimals); }
+    ~String();
+
+    String &operator=(const String &other);
+    String &operator=(String &&other);
+    String &operator=(const char *s);
+
+    bool concat(const char *s, unsigned int length);
+    bool concat(const char *s) { return concat(s, strlen(s)); }
+    bool concat(const String &other) { return concat(other.c_str(), other.len_); }
+    bool concat(char c) { return concat(&c, 1); }
+    String &operator+=(const String &other) { concat(other); return *this; }
+    String &operator+=(const char *s) { concat(s); return *this; }
+    String &operator+=(char c) { concat(c); return *this; }
+
+    // The left operand accumulates the sum, like the core's StringSumHelper
+    friend String operator+(String &&a, const String &b) { a += b; return std::move(a); }
+    friend String operator+(String &&a, const char *b) { a += b; return std::move(a); }
+    friend String operator+(const String &a, const String &b) { return String(a) + b; }
+    friend String operator+(const String &a, const char *b) { return String(a) + b; }
+    friend String operator+(const char *a, const String &b) { return String(a) + b; }
+
+    bool operator==(const String &other) const { return len_ == other.len_ && strcmp(c_str(), other.c_str()) == 0; }
+    bool operator==(const char *s) const { return strcmp(c_str(), s) == 0; }
+    bool operator!=(const String &other) const { return !(*this == other); }
+    bool operator!=(const char *s) const { return !(*this == s); }
+    char operator[](unsigned int i) const { return i < len_ ? c_str()[i] : 0; }
+
+    const char *c_str() const { return heap_ ? heap_ : sso_; }
+    unsigned int length() const { return len_; }
+    bool isEmpty() const { return len_ == 0; }
+    bool reserve(unsigned int size);
+
+    String substring(unsigned int from) const { return substring(from, len_); }
+    String substring(unsigned int from, unsigned int to) const;
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const char *s, unsigned int from = 0) const;
+    int indexOf(const String &s, unsigned int from = 0) const { return indexOf(s.c_str(), from); }
+    bool startsWith(const char *s) const { return strncmp(c_str(), s, strlen(s)) == 0; }
+    bool startsWith(const String &s) const { return startsWith(s.c_str()); }
+    bool endsWith(const char *s) const;
+
+    long toInt() const { return strtol(c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(c_str(), nullptr); }
+    double toDouble() const { return strtod(c_str(), nullptr); }
+    void toCharArray(char *buffer, unsigned int size) const;
+    void trim();
+    void toLowerCase();
+    void toUpperCase();
+    char *begin() { return buffer(); }
+    char *end() { return buffer() + len_; }
+
+private:
+    enum
+    {
+        SSO_CHARS = 10
+    };
+
+    char *buffer() { return heap_ ? heap_ : sso_; }
+    void copy(const char *s, unsigned int length);
+    void move(String &other);
+    void formatInteger(long long value, unsigned char base);
+    void formatUnsigned(unsigned long long value, unsigned char base);
+    void formatDouble(double value, unsigned int decimals);
+
+    char *heap_ = nullptr;
+    unsigned int capacity_ = SSO_CHARS;
+    unsigned int len_ = 0;
+    char sso_[SSO_CHARS + 1] = "";
+};
+
+void *simHeapRealloc(void *block, size_t size);
+void simHeapFree(void *block);
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = 10) { return print(String((long)value, base)); }
+    size_t print(unsigned int value, int base = 10) { return print(String((unsigned long)value, base)); }
+    size_t print(long value, int base = 10) { return print(String(value, base)); }
+    size_t print(unsigned long value, int base = 10) { return print(String(value, base)); }
+    size_t print(long long value, int base = 10) { return print(String(value, base)); }
+    size_t print(unsigned long long value, int base = 10) { return print(String(value, base)); }
+    size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T>
+    size_t println(T value, int format)
+    {
+        size_t n = print(value, format);
+        return n + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long) {}
+    long parseInt();
+    float parseFloat();
+    size_t readBytes(uint8_t *buffer, size_t length);
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+    String readString();
+    String readStringUntil(char terminator);
+};
+
+// UART. Port 0 is the console: what the firmware prints goes to the
+// simulator's serial log with a virtual timestamp per line. Other ports
+// receive what the simulator feeds them and count what is written.
+class HardwareSerial : public Stream
+{
+public:
+    explicit HardwareSerial(int port) : port_(port) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1,
+               bool invert = false, unsigned long timeout = 20000UL, uint8_t rxfifoFullThreshold = 112);
+    void end() {}
+    void setRxBufferSize(size_t size) { rxCapacity_ = size; }
+    void onReceive(std::function<void()> callback, bool onlyOnTimeout = false) { onReceive_ = callback; }
+
+    int available() override { return rx_.size(); }
+    int availableForWrite() { return 128; }
+    int peek() override { return rx_.empty() ? -1 : rx_.front(); }
+    int read() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    operator bool() const { return true; }
+
+    // Simulator side: queue received bytes (dropping what overflows the RX
+    // buffer) and run the onReceive callback as the UART event task would
+    void simReceive(const char *data, size_t length);
+    uint32_t simBytesWritten() const { return written_; }
+    uint32_t simBytesDropped() const { return dropped_; }
+
+private:
+    int port_;
+    std::deque<uint8_t> rx_;
+    size_t rxCapacity_ = 256;
+    std::function<void()> onReceive_;
+    bool lineStart_ = true;
+    uint32_t written_ = 0;
+    uint32_t dropped_ = 0;
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress
+{
+public:
+    IPAddress() : bytes_{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes_{a, b, c, d} {}
+    uint8_t operator[](int i) const { return bytes_[i]; }
+    String toString() const
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+        return String(text);
+    }
+
+private:
+    uint8_t bytes_[4];
+};
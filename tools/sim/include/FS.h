@@ -0,0 +1,84 @@
+#pragma once
+
+// Files on the simulated SD card are host files under the card directory,
+// which is the working directory while the firmware runs.
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File : public Stream
+{
+public:
+    File() {}
+    File(const std::string &path, const char *mode);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buffer, size_t size);
+    void flush() override;
+
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    operator bool() const { return state_ != nullptr; }
+
+    const char *path() const;
+    const char *name() const;
+    bool isDirectory() const;
+    File openNextFile(const char *mode = FILE_READ);
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+class FS
+{
+public:
+    File open(const char *path, const char *mode = FILE_READ, bool create = false);
+    File open(const String &path, const char *mode = FILE_READ, bool create = false)
+    {
+        return open(path.c_str(), mode, create);
+    }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
+
+// Host path of a card path
+std::string simCardPath(const char *path);
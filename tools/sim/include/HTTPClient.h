@@ -0,0 +1,22 @@
+#pragma once
+
+// There is no network in the simulator: every request fails to connect
+
+#include "Arduino.h"
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+class HTTPClient
+{
+public:
+    bool begin(const String &url) { return true; }
+    void end() {}
+    void setTimeout(uint16_t timeout) {}
+    void setReuse(bool reuse) {}
+    void addHeader(const String &name, const String &value) {}
+    int POST(uint8_t *payload, size_t size) { return HTTPC_ERROR_CONNECTION_REFUSED; }
+    int POST(const String &payload) { return HTTPC_ERROR_CONNECTION_REFUSED; }
+    String getString() { return String(); }
+    static String errorToString(int error) { return String("connection refused"); }
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+// DS3231 running off the virtual clock from the --rtc-start time
+
+#include "Arduino.h"
+
+class TimeSpan
+{
+public:
+    TimeSpan(int32_t seconds = 0) : seconds_(seconds) {}
+    int32_t totalseconds() const { return seconds_; }
+
+private:
+    int32_t seconds_;
+};
+
+class DateTime
+{
+public:
+    enum timestampOpt
+    {
+        TIMESTAMP_FULL,
+        TIMESTAMP_TIME,
+        TIMESTAMP_DATE
+    };
+
+    DateTime(uint32_t unixTime = 0);
+    DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0);
+    DateTime(const char *date, const char *time); // __DATE__, __TIME__
+
+    uint16_t year() const { return 2000 + yOff_; }
+    uint8_t month() const { return m_; }
+    uint8_t day() const { return d_; }
+    uint8_t hour() const { return hh_; }
+    uint8_t minute() const { return mm_; }
+    uint8_t second() const { return ss_; }
+    uint32_t unixtime() const;
+    String timestamp(timestampOpt option = TIMESTAMP_FULL) const;
+
+    DateTime operator+(const TimeSpan &span) const { return DateTime(unixtime() + span.totalseconds()); }
+
+private:
+    uint8_t yOff_, m_, d_, hh_, mm_, ss_;
+};
+
+class RTC_DS3231
+{
+public:
+    bool begin() { return true; }
+    bool lostPower() { return false; }
+    void adjust(const DateTime &time);
+    DateTime now();
+};
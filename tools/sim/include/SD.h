@@ -0,0 +1,16 @@
+#pragma once
+
+#include "FS.h"
+#include "SPI.h"
+
+class SDFS : public fs::FS
+{
+public:
+    bool begin(uint8_t csPin = 5);
+    void end() {}
+    uint64_t cardSize() { return 8ULL << 30; }
+    uint64_t totalBytes() { return cardSize(); }
+    uint64_t usedBytes();
+};
+
+extern SDFS SD;
@@ -0,0 +1,117 @@
+#pragma once
+
+// Web server without sockets. Handlers are registered as usual; the
+// simulator calls them with simRequest() and gets the response back. The
+// protected members a subclass can reach on the device are declared too,
+// with a listener that never has a client.
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "FS.h"
+#include "WiFi.h"
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+#define HTTP_MAX_SEND_WAIT 5000
+
+typedef enum
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_OPTIONS
+} HTTPMethod;
+
+enum HTTPClientStatus
+{
+    HC_NONE,
+    HC_WAIT_READ,
+    HC_WAIT_CLOSE
+};
+
+struct HTTPUpload
+{
+};
+
+class WebServer
+{
+public:
+    typedef std::function<void()> THandlerFunction;
+
+    explicit WebServer(int port = 80) : _server(port) {}
+    virtual ~WebServer() {}
+
+    void on(const char *uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const char *uri, HTTPMethod method, THandlerFunction handler) { handlers_[uri] = handler; }
+    void begin() {}
+    void handleClient() {}
+
+    String uri() { return String(uri_.c_str()); }
+    HTTPMethod method() { return method_; }
+    String arg(const char *name);
+    String arg(const String &name) { return arg(name.c_str()); }
+    bool hasArg(const char *name) { return args_.count(name) > 0; }
+    bool hasArg(const String &name) { return hasArg(name.c_str()); }
+    int args() { return args_.size(); }
+    String header(const char *name);
+    bool hasHeader(const char *name) { return simHeaders.count(name) > 0; }
+    void collectHeaders(const char *headers[], size_t count) {}
+
+    void setContentLength(size_t length) { _contentLength = length; }
+    void sendHeader(const String &name, const String &value, bool first = false);
+    void send(int code, const char *contentType = nullptr, const String &content = String(""));
+    void send(int code, const String &contentType, const String &content) { send(code, contentType.c_str(), content); }
+    void send_P(int code, PGM_P contentType, PGM_P content) { send(code, contentType, String(content)); }
+    void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+    void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char *content, size_t length) { body_.append(content, length); }
+    template <typename T>
+    size_t streamFile(T &file, const String &contentType)
+    {
+        send(200, contentType.c_str(), String(""));
+        uint8_t buffer[512];
+        size_t total = 0, read;
+        while ((read = file.read(buffer, sizeof(buffer))) > 0)
+        {
+            sendContent((const char *)buffer, read);
+            total += read;
+        }
+        return total;
+    }
+
+    // Simulator side. Returns the status code, or 404 for an unknown URI.
+    // Request headers come from simHeaders.
+    int simRequest(const char *uri, const std::map<std::string, std::string> &args, std::string &body,
+                   HTTPMethod method = HTTP_GET);
+    std::map<std::string, std::string> simHeaders;
+
+protected:
+    virtual size_t _currentClientWrite(const char *data, size_t length) { return _currentClient.write(data, length); }
+    bool _parseRequest(WiFiClient &client) { return false; }
+    void _handleRequest() {}
+
+    WiFiServer _server;
+    WiFiClient _currentClient;
+    HTTPClientStatus _currentStatus = HC_NONE;
+    unsigned long _statusChange = 0;
+    uint8_t _currentVersion = 1;
+    size_t _contentLength = CONTENT_LENGTH_NOT_SET;
+    std::unique_ptr<HTTPUpload> _currentUpload;
+
+private:
+    std::map<std::string, THandlerFunction> handlers_;
+    std::string uri_;
+    HTTPMethod method_ = HTTP_GET;
+    std::map<std::string, std::string> args_;
+    std::vector<std::pair<std::string, std::string>> headers_;
+    int status_ = 0;
+    std::string body_;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+// Access point that nobody joins, a station link that never connects and
+// a listening socket that nobody connects to
+
+#include <functional>
+
+#include "Arduino.h"
+
+typedef enum
+{
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_AP_STACONNECTED,
+    ARDUINO_EVENT_WIFI_AP_STADISCONNECTED,
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+typedef struct
+{
+    int unused;
+} WiFiEventInfo_t;
+
+typedef enum
+{
+    WIFI_OFF,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA
+} wifi_mode_t;
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass
+{
+public:
+    bool mode(wifi_mode_t mode)
+    {
+        mode_ = mode;
+        return true;
+    }
+    wifi_mode_t getMode() { return mode_; }
+    bool softAP(const char *ssid, const char *password = nullptr) { return true; }
+    bool softAPdisconnect(bool wifiOff = false) { return true; }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    uint8_t softAPgetStationNum() { return 0; }
+    wl_status_t begin(const char *ssid, const char *password = nullptr) { return WL_DISCONNECTED; }
+    wl_status_t status() { return WL_DISCONNECTED; }
+    bool isConnected() { return false; }
+    bool disconnect(bool wifiOff = false) { return true; }
+    bool setAutoReconnect(bool autoReconnect) { return true; }
+    bool setSleep(bool enabled) { return true; }
+    IPAddress localIP() { return IPAddress(); }
+    int32_t RSSI() { return 0; }
+    String macAddress() { return String("24:0A:C4:00:00:01"); }
+    int onEvent(std::function<void(WiFiEvent_t, WiFiEventInfo_t)> callback, WiFiEvent_t event) { return 0; }
+
+private:
+    wifi_mode_t mode_ = WIFI_OFF;
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient
+{
+public:
+    int connected() { return 0; }
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(const uint8_t *buffer, size_t size) { return 0; }
+    size_t write(const char *buffer, size_t size) { return 0; }
+    void setTimeout(uint32_t seconds) {}
+    void stop() {}
+    operator bool() { return false; }
+};
+
+class WiFiServer
+{
+public:
+    explicit WiFiServer(uint16_t port = 80) {}
+    void begin() {}
+    bool hasClient() { return false; }
+    WiFiClient available() { return WiFiClient(); }
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Arduino.h"
+
+class TwoWire
+{
+public:
+    bool begin() { return true; }
+};
+
+extern TwoWire Wire;
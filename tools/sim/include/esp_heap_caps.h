@@ -0,0 +1,41 @@
+#pragma once
+
+// Heap statistics of a freshly booted ESP32 with nothing fragmented. The
+// host heap says nothing about the device's, so the numbers are fixed and
+// the firmware's low-memory paths never trigger in the simulator.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+#define SIM_HEAP_SIZE 327680
+#define SIM_HEAP_FREE 229376
+#define SIM_HEAP_LARGEST 113792
+
+typedef struct
+{
+    size_t total_free_bytes;
+    size_t total_allocated_bytes;
+    size_t largest_free_block;
+    size_t minimum_free_bytes;
+    size_t allocated_blocks;
+    size_t free_blocks;
+    size_t total_blocks;
+} multi_heap_info_t;
+
+inline void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    info->total_free_bytes = SIM_HEAP_FREE;
+    info->total_allocated_bytes = SIM_HEAP_SIZE - SIM_HEAP_FREE;
+    info->largest_free_block = SIM_HEAP_LARGEST;
+    info->minimum_free_bytes = SIM_HEAP_FREE;
+    info->allocated_blocks = 400;
+    info->free_blocks = 12;
+    info->total_blocks = 412;
+}
+
+inline size_t heap_caps_get_total_size(uint32_t caps) { return SIM_HEAP_SIZE; }
+inline size_t heap_caps_get_free_size(uint32_t caps) { return SIM_HEAP_FREE; }
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) { return SIM_HEAP_LARGEST; }
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+inline esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us) { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_uart_wakeup(int uart) { return ESP_OK; }
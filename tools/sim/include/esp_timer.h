@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Virtual clock, µs since boot
+int64_t esp_timer_get_time();
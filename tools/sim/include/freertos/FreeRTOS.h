@@ -0,0 +1,35 @@
+#pragma once
+
+// FreeRTOS for the simulator. Tasks are host threads, but only one runs at
+// a time: a task keeps the CPU until it blocks, and blocking is where the
+// virtual clock moves (see sim_rtos.cpp). Critical sections are therefore
+// no-ops.
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef struct SimTask *TaskHandle_t;
+typedef struct SimSemaphore *SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+typedef struct
+{
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+#define portENTER_CRITICAL_ISR(mux) (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux) (void)(mux)
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(void (*entry)(void *), const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+inline BaseType_t xTaskCreate(void (*entry)(void *), const char *name, uint32_t stackDepth, void *parameter,
+                              UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(entry, name, stackDepth, parameter, priority, handle, 0);
+}
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+
+inline void gpio_ll_set_intr_type(gpio_dev_t *hw, gpio_num_t pin, gpio_int_type_t type) {}
+inline void gpio_ll_wakeup_disable(gpio_dev_t *hw, gpio_num_t pin) {}
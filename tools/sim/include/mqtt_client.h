@@ -0,0 +1,71 @@
+#pragma once
+
+// MQTT client that starts but never reaches its broker
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+#define ESP_EVENT_ANY_ID -1
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    int msg_id;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct
+{
+    const char *uri;
+    const char *client_id;
+    const char *lwt_topic;
+    const char *lwt_msg;
+    int lwt_qos;
+    int lwt_retain;
+    int lwt_msg_len;
+    int keepalive;
+    int buffer_size;
+    int out_buffer_size;
+} esp_mqtt_client_config_t;
+
+typedef void (*esp_event_handler_t)(void *args, esp_event_base_t base, int32_t eventId, void *eventData);
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+inline esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                                esp_event_handler_t handler, void *args)
+{
+    return ESP_OK;
+}
+inline esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) { return ESP_OK; }
+inline esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) { return ESP_OK; }
+inline esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) { return ESP_OK; }
+inline int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int length,
+                                   int qos, int retain, bool store)
+{
+    return -1;
+}
+inline int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int length,
+                                   int qos, int retain)
+{
+    return -1;
+}
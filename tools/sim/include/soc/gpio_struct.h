@@ -0,0 +1,8 @@
+#pragma once
+
+typedef struct
+{
+    int unused;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
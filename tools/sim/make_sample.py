@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Synthetic traces for the firmware simulator.
+
+Writes a short field session: parked with the engine running, a straight
+spraying run with pressure spikes and a flow meter at work, then parked
+again. Also writes a config.txt for the chosen sensor. The numbers are made
+up; the point is a reproducible input that exercises motion detection,
+both event detectors and the track log.
+
+    python3 tools/sim/make_sample.py --out sample
+    firmware_sim --nmea sample/drive.nmea --pressure sample/pressure.csv \\
+        --flow sample/pulses.txt --config sample/config.txt --out sim_out
+"""
+
+import argparse
+import math
+import os
+import random
+
+BOOT_MS = 1000         # First GPS burst after power-on (the simulator default)
+PARKED_S = 120
+DRIVE_S = 600
+SPEED_KMPH = 8.0
+START = (-7.250000, 112.750000)  # lat, lng
+FLOW_LPM = 16.0
+PULSES_PER_LITRE = 7.5 * 60      # calibrationFactor pulses/s per L/min
+PRESSURE_HPA = 1008.0
+
+
+def nmea(body):
+    checksum = 0
+    for c in body:
+        checksum ^= ord(c)
+    return "$%s*%02X" % (body, checksum)
+
+
+def nmea_coord(value, positive, negative, degree_digits):
+    hemisphere = positive if value >= 0 else negative
+    value = abs(value)
+    degrees = int(value)
+    minutes = (value - degrees) * 60
+    return "%0*d%08.5f" % (degree_digits, degrees, minutes), hemisphere
+
+
+def gps_sentences(t, lat, lng, speed_kmph, satellites):
+    hhmmss = "%02d%02d%02d.00" % (8 + t // 3600, t // 60 % 60, t % 60)
+    lat_text, ns = nmea_coord(lat, "N", "S", 2)
+    lng_text, ew = nmea_coord(lng, "E", "W", 3)
+    knots = speed_kmph / 1.852
+    return [
+        nmea("GPRMC,%s,A,%s,%s,%s,%s,%.3f,90.0,171026,,,A" % (hhmmss, lat_text, ns, lng_text, ew, knots)),
+        nmea("GPGGA,%s,%s,%s,%s,%s,1,%02d,1.10,40.0,M,0.0,M,," % (hhmmss, lat_text, ns, lng_text, ew, satellites)),
+        nmea("GPGSA,A,3,01,03,07,08,11,14,17,,,,,,1.90,1.10,1.50"),
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--out", default="sample")
+    parser.add_argument("--sensor", choices=("BMP", "YF401"), default="BMP")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    os.makedirs(args.out, exist_ok=True)
+    total_s = PARKED_S + DRIVE_S + PARKED_S
+    metres_per_degree = 111320.0
+
+    with open(os.path.join(args.out, "drive.nmea"), "w") as out:
+        lat, lng = START
+        for t in range(total_s):
+            driving = PARKED_S <= t < PARKED_S + DRIVE_S
+            speed = SPEED_KMPH + random.uniform(-0.5, 0.5) if driving else 0.0
+            lng += speed / 3.6 / (metres_per_degree * math.cos(math.radians(lat)))
+            jitter = 0.3 / metres_per_degree  # Position noise while parked
+            for sentence in gps_sentences(t, lat + random.uniform(-jitter, jitter),
+                                          lng + random.uniform(-jitter, jitter), speed, 8):
+                out.write(sentence + "\r\n")
+
+    # 20 Hz pressure with a spike every 45 s while spraying
+    with open(os.path.join(args.out, "pressure.csv"), "w") as out:
+        out.write("ms,hPa,degC\n")
+        for i in range(total_s * 20):
+            ms = BOOT_MS + i * 50
+            t = i / 20.0
+            hpa = PRESSURE_HPA + random.gauss(0, 0.2)
+            if PARKED_S <= t < PARKED_S + DRIVE_S and (t - PARKED_S) % 45 < 1.0:
+                hpa += 8.0 * math.sin(math.pi * ((t - PARKED_S) % 45))
+            out.write("%d,%.2f,%.1f\n" % (ms, hpa, 29.0 + t / total_s))
+
+    # Flow pulses while spraying, with surges every 60 s
+    with open(os.path.join(args.out, "pulses.txt"), "w") as out:
+        ms = BOOT_MS + PARKED_S * 1000.0
+        end = BOOT_MS + (PARKED_S + DRIVE_S) * 1000.0
+        while ms < end:
+            t = (ms - BOOT_MS) / 1000.0 - PARKED_S
+            lpm = FLOW_LPM * (1.6 if t % 60 < 3 else 1.0)
+            ms += 1000.0 / (lpm * PULSES_PER_LITRE / 60.0) * random.uniform(0.95, 1.05)
+            out.write("%.3f\n" % ms)
+
+    # Same line layout as saveConfig()
+    config = [
+        "Aspol Tracker", "sulungresearch", "SimTracker", args.sensor,
+        "0.20", "20.00", 30, 100, 2000, 0, 0, 60, "", "", "", 0, 10, 1, "",
+    ]
+    with open(os.path.join(args.out, "config.txt"), "w") as out:
+        for value in config:
+            out.write("%s\r\n" % value)
+
+    print("wrote %s: %d s of traces, first GPS burst at %d ms" % (args.out, total_s, BOOT_MS))
+
+
+if __name__ == "__main__":
+    main()
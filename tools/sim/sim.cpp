@@ -0,0 +1,455 @@
+// Whole-firmware simulator: runs the unmodified src/main.cpp and
+// src/ts_store.cpp on the host against recorded sensor traces, under a
+// virtual clock, and leaves behind the SD card the device would have
+// written. A day of field data replays in seconds, so detector settings
+// (thresholds, sample intervals, motion detection) can be compared over a
+// whole season before anyone drives a tractor.
+//
+// The firmware is built against the shims in tools/sim/include instead of
+// the Arduino core. Tasks run one at a time and the clock only moves when
+// they all block (sim_rtos.cpp), so a run is fully determined by its
+// inputs: the same traces and config give byte-identical output. Code
+// runs in zero virtual time, so timings the firmware measures itself (flush
+// durations, time spent active) read as zero.
+//
+// Build after `pio pkg install` has fetched TinyGPSPlus:
+//
+//   LIB=.pio/libdeps/esp32doit-devkit-v1/TinyGPSPlus/src
+//   INC="-Itools/sim/include -Itools/sim -Iinclude -I$LIB"
+//   SRC="src/main.cpp src/ts_store.cpp tools/sim/*.cpp $LIB/TinyGPS++.cpp"
+//   g++ -O2 -std=gnu++17 -pthread -DTS_VFS_ROOT='"."' $INC $SRC -o firmware_sim
+//
+// Usage:
+//
+//   firmware_sim [--nmea capture.nmea] [--pressure pressure.csv] [--flow pulses.txt]
+//                [--config config.txt] [--out DIR] [--rtc-start UNIX] [--nmea-start MS]
+//                [--baud 9600] [--duration SEC] [--tail SEC] [--echo]
+//
+// Traces share one time base, milliseconds since power-on:
+//
+//   pressure.csv  "ms,hPa[,degC]" per line, held until the next sample
+//   pulses.txt    one flow meter pulse per line, "ms" (fractions allowed)
+//   capture.nmea  raw NEO-6M output. Captures carry no arrival times, so
+//                 the first sentence starts at --nmea-start and each time
+//                 the capture's first sentence type comes round again a new
+//                 burst starts, as far after the last one as its UTC time
+//                 field says (1 s if it has none). Within a burst sentences
+//                 follow each other at the UART byte rate.
+//
+// The GPS is a passive replay: UBX power commands from the firmware are
+// counted but do not change what the capture delivers. There is no
+// network, so uploads and MQTT stay queued, and power management reports
+// as unsupported (no light sleep).
+//
+// DIR (default sim_out) gets the card in DIR/sd, the console in
+// DIR/serial.log and, at the end, what the download endpoints return:
+// gps_log.csv, gps_track.csv, logger.json and power.json. A card left by
+// an earlier run is picked up as the device would after a reboot, so use a
+// fresh DIR for independent runs. --config installs a config.txt (same
+// format the device writes; make_sample.py shows one) before boot.
+//
+// The run ends --tail seconds (default 30) after the last trace event, or
+// at --duration.
+
+#include <chrono>
+#include <errno.h>
+#include <limits.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Adafruit_BMP085.h>
+#include <Arduino.h>
+#include <WebServer.h>
+
+#include "persistent_server.h"
+#include "sim.h"
+
+#define SIM_FLOW_PIN 15 // FLOW_SENSOR_PIN
+
+extern HardwareSerial neo6m;
+extern PersistentWebServer server;
+
+// Next non-empty line of a trace, without its line ending
+static bool readLine(FILE *file, std::string &line)
+{
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), file))
+    {
+        line = buffer;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (!line.empty())
+            return true;
+    }
+    return false;
+}
+
+static uint64_t msToUs(double ms)
+{
+    return ms <= 0 ? 0 : (uint64_t)llround(ms * 1000.0);
+}
+
+class NmeaTrace : public SimSource
+{
+public:
+    bool open(const char *path, uint64_t startUs, unsigned baud)
+    {
+        file_ = fopen(path, "rb");
+        if (!file_)
+            return false;
+        cursorUs_ = burstUs_ = startUs;
+        byteUs_ = 10e6 / baud; // 8N1: ten bits per byte
+        load();
+        return true;
+    }
+
+    uint64_t nextUs() const override { return pending_ ? (uint64_t)llround(cursorUs_) : UINT64_MAX; }
+
+    void fire() override
+    {
+        neo6m.simReceive(line_.data(), line_.size());
+        sentences++;
+        load();
+    }
+
+    uint32_t sentences = 0;
+
+private:
+    // Seconds into the UTC day from the time field, or -1
+    static double utcSeconds(const std::string &line, const std::string &type)
+    {
+        int field = type.compare(2, 3, "GLL") == 0 ? 5 : 1;
+        size_t at = 0;
+        for (int i = 0; i < field && at != std::string::npos; i++)
+            at = line.find(',', at + 1);
+        if (at == std::string::npos || line.size() < at + 7 || !isdigit((unsigned char)line[at + 1]))
+            return -1;
+        const char *time = line.c_str() + at + 1;
+        int hhmmss = atoi(std::string(time, 6).c_str());
+        return hhmmss / 10000 * 3600 + hhmmss / 100 % 100 * 60 + hhmmss % 100 + atof(time + 6);
+    }
+
+    void load()
+    {
+        pending_ = readLine(file_, line_);
+        if (!pending_)
+            return;
+
+        std::string type = line_.size() > 6 && line_[0] == '$' ? line_.substr(1, 5) : "";
+        if (!type.empty())
+        {
+            if (leader_.empty())
+                leader_ = type;
+            if (type == leader_)
+            {
+                double utc = utcSeconds(line_, type);
+                if (started_)
+                {
+                    double gap = 1.0;
+                    if (utc >= 0 && lastUtc_ >= 0)
+                    {
+                        double seconds = utc - lastUtc_;
+                        if (seconds < 0)
+                            seconds += 86400;
+                        if (seconds > 0 && seconds <= 3600)
+                            gap = seconds;
+                    }
+                    burstUs_ += gap * 1e6;
+                    cursorUs_ = std::max(cursorUs_, burstUs_);
+                }
+                started_ = true;
+                lastUtc_ = utc;
+            }
+        }
+
+        line_ += "\r\n";
+        cursorUs_ += line_.size() * byteUs_; // Delivered once the line is in
+    }
+
+    FILE *file_ = nullptr;
+    std::string line_;
+    bool pending_ = false;
+    std::string leader_; // Sentence type that opens each burst
+    bool started_ = false;
+    double lastUtc_ = -1;
+    double burstUs_ = 0;
+    double cursorUs_ = 0;
+    double byteUs_ = 0;
+};
+
+class PressureTrace : public SimSource
+{
+public:
+    bool open(const char *path)
+    {
+        file_ = fopen(path, "rb");
+        if (!file_)
+            return false;
+        load();
+        return true;
+    }
+
+    uint64_t nextUs() const override { return pending_ ? nextUs_ : UINT64_MAX; }
+
+    void fire() override
+    {
+        hPa = nextHPa_;
+        celsius = nextCelsius_;
+        samples++;
+        load();
+    }
+
+    float hPa = 1013.25f;
+    float celsius = 20.0f;
+    uint32_t samples = 0;
+
+private:
+    void load()
+    {
+        std::string line;
+        while ((pending_ = readLine(file_, line)))
+        {
+            double ms;
+            float temperature;
+            int fields = sscanf(line.c_str(), "%lf,%f,%f", &ms, &nextHPa_, &temperature);
+            if (fields < 2)
+                continue; // Header or comment
+            nextUs_ = msToUs(ms);
+            if (fields == 3)
+                nextCelsius_ = temperature;
+            return;
+        }
+    }
+
+    FILE *file_ = nullptr;
+    bool pending_ = false;
+    uint64_t nextUs_ = 0;
+    float nextHPa_ = 0;
+    float nextCelsius_ = 20.0f;
+};
+
+class FlowTrace : public SimSource
+{
+public:
+    bool open(const char *path)
+    {
+        file_ = fopen(path, "rb");
+        if (!file_)
+            return false;
+        load();
+        return true;
+    }
+
+    uint64_t nextUs() const override { return pending_ ? nextUs_ : UINT64_MAX; }
+
+    void fire() override
+    {
+        SimIsr isr = simIsr(SIM_FLOW_PIN);
+        if (isr)
+            isr();
+        pulses++;
+        load();
+    }
+
+    uint32_t pulses = 0;
+
+private:
+    void load()
+    {
+        std::string line;
+        while ((pending_ = readLine(file_, line)))
+        {
+            char *end;
+            double ms = strtod(line.c_str(), &end);
+            if (end == line.c_str())
+                continue;
+            nextUs_ = msToUs(ms);
+            return;
+        }
+    }
+
+    FILE *file_ = nullptr;
+    bool pending_ = false;
+    uint64_t nextUs_ = 0;
+};
+
+static NmeaTrace nmea;
+static PressureTrace pressure;
+static FlowTrace flow;
+static bool pressureLoaded = false;
+static std::string outDir;
+static std::chrono::steady_clock::time_point wallStart;
+
+bool Adafruit_BMP085::begin(uint8_t mode)
+{
+    return pressureLoaded;
+}
+
+int32_t Adafruit_BMP085::readPressure()
+{
+    return lroundf(pressure.hPa * 100);
+}
+
+float Adafruit_BMP085::readTemperature()
+{
+    return pressure.celsius;
+}
+
+static bool copyFile(const char *from, const std::string &to)
+{
+    FILE *in = fopen(from, "rb");
+    if (!in)
+        return false;
+    FILE *out = fopen(to.c_str(), "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, read, out);
+    fclose(in);
+    return fclose(out) == 0;
+}
+
+// Save what an endpoint returns next to the card
+static std::string exportEndpoint(const char *uri, const char *fileName)
+{
+    std::string body;
+    int status = server.simRequest(uri, {}, body);
+    if (status != 200)
+    {
+        fprintf(stderr, "%s returned %d\n", uri, status);
+        return body;
+    }
+    FILE *file = fopen((outDir + "/" + fileName).c_str(), "wb");
+    if (file)
+    {
+        fwrite(body.data(), 1, body.size(), file);
+        fclose(file);
+    }
+    return body;
+}
+
+static void finishRun()
+{
+    exportEndpoint("/download_gps_log", "gps_log.csv");
+    exportEndpoint("/download_gps_track", "gps_track.csv");
+    std::string logger = exportEndpoint("/logger", "logger.json");
+    exportEndpoint("/power", "power.json");
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double simulated = simClockUs / 1e6;
+    fprintf(stderr, "simulated %.1f s in %.2f s wall (%.0fx)\n", simulated, wall, wall > 0 ? simulated / wall : 0);
+    fprintf(stderr, "inputs: %u NMEA sentences (%u UART bytes dropped), %u pressure samples, %u flow pulses\n",
+            nmea.sentences, neo6m.simBytesDropped(), pressure.samples, flow.pulses);
+    fprintf(stderr, "logger: %s\n", logger.c_str());
+    fprintf(stderr, "output in %s\n", outDir.c_str());
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--nmea capture.nmea] [--pressure pressure.csv] [--flow pulses.txt]\n"
+            "          [--config config.txt] [--out DIR] [--rtc-start UNIX] [--nmea-start MS]\n"
+            "          [--baud N] [--duration SEC] [--tail SEC] [--echo]\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *nmeaPath = nullptr;
+    const char *pressurePath = nullptr;
+    const char *flowPath = nullptr;
+    const char *configPath = nullptr;
+    std::string out = "sim_out";
+    double nmeaStartMs = 1000;
+    unsigned baud = 9600;
+    double durationSec = 0;
+    double tailSec = 30;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+        if (arg == "--nmea" && value)
+            nmeaPath = argv[++i];
+        else if (arg == "--pressure" && value)
+            pressurePath = argv[++i];
+        else if (arg == "--flow" && value)
+            flowPath = argv[++i];
+        else if (arg == "--config" && value)
+            configPath = argv[++i];
+        else if (arg == "--out" && value)
+            out = argv[++i];
+        else if (arg == "--rtc-start" && value)
+            simRtcStart = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--nmea-start" && value)
+            nmeaStartMs = atof(argv[++i]);
+        else if (arg == "--baud" && value)
+            baud = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--duration" && value)
+            durationSec = atof(argv[++i]);
+        else if (arg == "--tail" && value)
+            tailSec = atof(argv[++i]);
+        else if (arg == "--echo")
+            simSerialEcho = true;
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((!nmeaPath && !pressurePath && !flowPath) || baud == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (nmeaPath && !nmea.open(nmeaPath, msToUs(nmeaStartMs), baud))
+    {
+        fprintf(stderr, "cannot read %s\n", nmeaPath);
+        return 2;
+    }
+    if (pressurePath && !(pressureLoaded = pressure.open(pressurePath)))
+    {
+        fprintf(stderr, "cannot read %s\n", pressurePath);
+        return 2;
+    }
+    if (flowPath && !flow.open(flowPath))
+    {
+        fprintf(stderr, "cannot read %s\n", flowPath);
+        return 2;
+    }
+    simAddSource(&nmea);
+    simAddSource(&pressure);
+    simAddSource(&flow);
+
+    std::string card = out + "/sd";
+    if ((mkdir(out.c_str(), 0755) != 0 && errno != EEXIST) || (mkdir(card.c_str(), 0755) != 0 && errno != EEXIST))
+    {
+        fprintf(stderr, "cannot create %s\n", card.c_str());
+        return 2;
+    }
+    char resolved[PATH_MAX];
+    outDir = realpath(out.c_str(), resolved) ? resolved : out;
+    if (configPath && !copyFile(configPath, card + "/config.txt"))
+    {
+        fprintf(stderr, "cannot install %s\n", configPath);
+        return 2;
+    }
+    simSerialLog = fopen((outDir + "/serial.log").c_str(), "wb");
+    if (!simSerialLog || chdir(card.c_str()) != 0)
+    {
+        fprintf(stderr, "cannot use %s\n", outDir.c_str());
+        return 2;
+    }
+
+    wallStart = std::chrono::steady_clock::now();
+    simRun(durationSec > 0 ? (uint64_t)(durationSec * 1e6) : UINT64_MAX, (uint64_t)(tailSec * 1e6), finishRun);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Simulator internals shared by the shims and the trace players.
+
+// Virtual time in µs since power-on. It only moves while every task is
+// blocked, straight to the next input event or task deadline.
+extern uint64_t simClockUs;
+
+// Something that delivers input at points in virtual time. fire() runs in
+// the context of whichever task blocked last, like an ISR or the UART
+// event task would; it may notify tasks but must not block.
+class SimSource
+{
+public:
+    virtual ~SimSource() {}
+    virtual uint64_t nextUs() const = 0; // UINT64_MAX once exhausted
+    virtual void fire() = 0;
+};
+
+void simAddSource(SimSource *source);
+
+// Block the running task until the deadline while others run
+void simSleepUntil(uint64_t deadlineUs);
+
+// Run setup() and loop() on the calling thread until the clock would pass
+// limitUs, or tailUs after the last input event. onEnd then runs with every
+// other task stopped, and the process exits.
+[[noreturn]] void simRun(uint64_t limitUs, uint64_t tailUs, void (*onEnd)());
+
+// Lower-level entry for harnesses that drive the firmware themselves: make
+// the calling thread the Arduino loop task. Without simRun() the run never
+// ends on its own; other tasks still get the CPU whenever this one blocks.
+void simStartLoopTask();
+
+// Flush output and leave without unwinding the task threads
+[[noreturn]] void simExit(int status);
+
+// Handler attached to a pin with attachInterrupt(), or nullptr
+typedef void (*SimIsr)();
+SimIsr simIsr(int pin);
+
+// Console output (Serial), one virtual timestamp per line
+extern FILE *simSerialLog;
+extern bool simSerialEcho;
+
+// RTC reading at power-on, Unix seconds
+extern uint32_t simRtcStart;
+
+// Heap traffic of the Arduino String shim: one allocation per buffer grab
+// or growth, with the size asked for. Harnesses may count more into it.
+struct SimHeapStats
+{
+    uint64_t allocations;
+    uint64_t bytes;
+};
+extern SimHeapStats simHeap;
@@ -0,0 +1,583 @@
+// Arduino core, RTC and ESP-IDF odds and ends for the simulator
+
+#include <Arduino.h>
+#include <RTClib.h>
+#include <Wire.h>
+#include <esp_err.h>
+#include <esp_rom_crc.h>
+#include <hal/gpio_ll.h>
+#include <string>
+
+#include "sim.h"
+
+#define SIM_PIN_COUNT 40
+
+HardwareSerial Serial(0);
+TwoWire Wire;
+gpio_dev_t GPIO;
+
+FILE *simSerialLog = stdout;
+bool simSerialEcho = false;
+uint32_t simRtcStart = 1704067200; // 2024-01-01 00:00:00
+
+static uint8_t pinLevels[SIM_PIN_COUNT];
+static SimIsr pinIsrs[SIM_PIN_COUNT];
+static uint32_t cpuMhz = 240;
+
+unsigned long millis()
+{
+    return simClockUs / 1000;
+}
+
+unsigned long micros()
+{
+    return simClockUs;
+}
+
+void delay(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    simSleepUntil(simClockUs + us);
+}
+
+void yield()
+{
+    simSleepUntil(simClockUs);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < SIM_PIN_COUNT && mode == INPUT_PULLUP)
+        pinLevels[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin < SIM_PIN_COUNT)
+        pinLevels[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < SIM_PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+void attachInterrupt(int pin, void (*isr)(), int mode)
+{
+    if (pin >= 0 && pin < SIM_PIN_COUNT)
+        pinIsrs[pin] = isr;
+}
+
+void detachInterrupt(int pin)
+{
+    if (pin >= 0 && pin < SIM_PIN_COUNT)
+        pinIsrs[pin] = nullptr;
+}
+
+SimIsr simIsr(int pin)
+{
+    return pin >= 0 && pin < SIM_PIN_COUNT ? pinIsrs[pin] : nullptr;
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz)
+{
+    cpuMhz = mhz;
+    return true;
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+    return cpuMhz;
+}
+
+// String
+
+SimHeapStats simHeap;
+
+void *simHeapRealloc(void *block, size_t size)
+{
+    simHeap.allocations++;
+    simHeap.bytes += size;
+    return realloc(block, size);
+}
+
+void simHeapFree(void *block)
+{
+    free(block);
+}
+
+String::~String()
+{
+    simHeapFree(heap_);
+}
+
+String &String::operator=(const String &other)
+{
+    if (this != &other)
+        copy(other.c_str(), other.len_);
+    return *this;
+}
+
+String &String::operator=(String &&other)
+{
+    if (this != &other)
+    {
+        simHeapFree(heap_);
+        heap_ = nullptr;
+        move(other);
+    }
+    return *this;
+}
+
+String &String::operator=(const char *s)
+{
+    copy(s ? s : "", s ? strlen(s) : 0);
+    return *this;
+}
+
+bool String::reserve(unsigned int size)
+{
+    if (size <= capacity_)
+        return true;
+    unsigned int grown = (size + 16) & ~0xf;
+    char *block = (char *)simHeapRealloc(heap_, grown + 1);
+    if (!block)
+        return false;
+    if (!heap_)
+        memcpy(block, sso_, len_ + 1);
+    heap_ = block;
+    capacity_ = grown;
+    return true;
+}
+
+void String::copy(const char *s, unsigned int length)
+{
+    if (!reserve(length))
+        return;
+    memmove(buffer(), s, length);
+    buffer()[length] = '\0';
+    len_ = length;
+}
+
+void String::move(String &other)
+{
+    heap_ = other.heap_;
+    capacity_ = other.capacity_;
+    len_ = other.len_;
+    memcpy(sso_, other.sso_, sizeof(sso_));
+    other.heap_ = nullptr;
+    other.capacity_ = SSO_CHARS;
+    other.len_ = 0;
+    other.sso_[0] = '\0';
+}
+
+bool String::concat(const char *s, unsigned int length)
+{
+    if (length == 0)
+        return true;
+    // s may point into this string, so remember where before growing
+    const char *base = c_str();
+    bool inside = s >= base && s < base + len_;
+    size_t offset = s - base;
+    if (!reserve(len_ + length))
+        return false;
+    if (inside)
+        s = c_str() + offset;
+    memmove(buffer() + len_, s, length);
+    len_ += length;
+    buffer()[len_] = '\0';
+    return true;
+}
+
+void String::formatInteger(long long value, unsigned char base)
+{
+    if (value < 0 && base == 10)
+    {
+        formatUnsigned(-(unsigned long long)value, base);
+        String sign("-");
+        sign += *this;
+        *this = std::move(sign);
+        return;
+    }
+    formatUnsigned((unsigned long long)value, base);
+}
+
+void String::formatUnsigned(unsigned long long value, unsigned char base)
+{
+    if (base < 2 || base > 36)
+        base = 10;
+    char digits[65];
+    int i = sizeof(digits) - 1;
+    digits[i] = '\0';
+    do
+    {
+        int digit = value % base;
+        digits[--i] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    copy(digits + i, sizeof(digits) - 1 - i);
+}
+
+void String::formatDouble(double value, unsigned int decimals)
+{
+    char text[64];
+    int length = snprintf(text, sizeof(text), "%.*f", decimals, value);
+    copy(text, std::min(length, (int)sizeof(text) - 1));
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+    if (from > to)
+        std::swap(from, to);
+    if (from >= len_)
+        return String();
+    to = std::min(to, len_);
+    String part;
+    part.concat(c_str() + from, to - from);
+    return part;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+    if (from >= len_)
+        return -1;
+    const char *at = strchr(c_str() + from, c);
+    return at ? at - c_str() : -1;
+}
+
+int String::indexOf(const char *s, unsigned int from) const
+{
+    if (from > len_)
+        return -1;
+    const char *at = strstr(c_str() + from, s);
+    return at ? at - c_str() : -1;
+}
+
+bool String::endsWith(const char *s) const
+{
+    size_t n = strlen(s);
+    return n <= len_ && memcmp(c_str() + len_ - n, s, n) == 0;
+}
+
+void String::toCharArray(char *buffer, unsigned int size) const
+{
+    if (size == 0)
+        return;
+    unsigned int n = std::min(size - 1, len_);
+    memcpy(buffer, c_str(), n);
+    buffer[n] = '\0';
+}
+
+void String::trim()
+{
+    const char *text = c_str();
+    unsigned int first = 0, last = len_;
+    while (first < last && isspace((unsigned char)text[first]))
+        first++;
+    while (last > first && isspace((unsigned char)text[last - 1]))
+        last--;
+    memmove(buffer(), text + first, last - first);
+    len_ = last - first;
+    buffer()[len_] = '\0';
+}
+
+void String::toLowerCase()
+{
+    for (char &c : *this)
+        c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase()
+{
+    for (char &c : *this)
+        c = toupper((unsigned char)c);
+}
+
+// Print and Stream
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char small[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0)
+        return 0;
+    if ((size_t)length < sizeof(small))
+        return write((const uint8_t *)small, length);
+
+    std::string large(length + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&large[0], large.size(), format, args);
+    va_end(args);
+    return write((const uint8_t *)large.data(), length);
+}
+
+// Number parsing stops at the first character that does not fit and leaves
+// it unread, as on the device; a stream that runs dry returns 0.
+long Stream::parseInt()
+{
+    int c;
+    while ((c = peek()) >= 0 && c != '-' && !isdigit(c))
+        read();
+    if (c < 0)
+        return 0;
+
+    bool negative = false;
+    long value = 0;
+    while ((c = peek()) >= 0)
+    {
+        if (c == '-' && !negative && value == 0)
+            negative = true;
+        else if (isdigit(c))
+            value = value * 10 + c - '0';
+        else
+            break;
+        read();
+    }
+    return negative ? -value : value;
+}
+
+float Stream::parseFloat()
+{
+    int c;
+    while ((c = peek()) >= 0 && c != '-' && c != '.' && !isdigit(c))
+        read();
+    if (c < 0)
+        return 0;
+
+    std::string text;
+    while ((c = peek()) >= 0 && (isdigit(c) || (c == '-' && text.empty()) || (c == '.' && text.find('.') == std::string::npos)))
+    {
+        text += (char)c;
+        read();
+    }
+    return strtof(text.c_str(), nullptr);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+    size_t count = 0;
+    int c;
+    while (count < length && (c = read()) >= 0)
+        buffer[count++] = c;
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+    size_t count = 0;
+    int c;
+    while (count < length && (c = read()) >= 0 && c != terminator)
+        buffer[count++] = c;
+    return count;
+}
+
+// Char by char, as the core does, so allocation counts match the device
+String Stream::readString()
+{
+    String text;
+    int c;
+    while ((c = read()) >= 0)
+        text += (char)c;
+    return text;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+    String text;
+    int c;
+    while ((c = read()) >= 0 && c != terminator)
+        text += (char)c;
+    return text;
+}
+
+// HardwareSerial
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert,
+                           unsigned long timeout, uint8_t rxfifoFullThreshold)
+{
+}
+
+int HardwareSerial::read()
+{
+    if (rx_.empty())
+        return -1;
+    int c = rx_.front();
+    rx_.pop_front();
+    return c;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    written_++;
+    if (port_ != 0)
+        return 1;
+
+    if (lineStart_)
+    {
+        fprintf(simSerialLog, "[%10.3f] ", simClockUs / 1e6);
+        if (simSerialEcho && simSerialLog != stdout)
+            fprintf(stdout, "[%10.3f] ", simClockUs / 1e6);
+        lineStart_ = false;
+    }
+    if (c == '\r')
+        return 1;
+    fputc(c, simSerialLog);
+    if (simSerialEcho && simSerialLog != stdout)
+        fputc(c, stdout);
+    lineStart_ = c == '\n';
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        write(buffer[i]);
+    return size;
+}
+
+void HardwareSerial::simReceive(const char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (rx_.size() < rxCapacity_)
+            rx_.push_back((uint8_t)data[i]);
+        else
+            dropped_++;
+    }
+    if (onReceive_)
+        onReceive_();
+}
+
+// RTClib
+
+#define SECONDS_FROM_1970_TO_2000 946684800
+
+static const uint8_t daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+DateTime::DateTime(uint32_t t)
+{
+    t -= SECONDS_FROM_1970_TO_2000;
+    ss_ = t % 60;
+    t /= 60;
+    mm_ = t % 60;
+    t /= 60;
+    hh_ = t % 24;
+    uint16_t days = t / 24;
+    bool leap;
+    for (yOff_ = 0;; yOff_++)
+    {
+        leap = yOff_ % 4 == 0;
+        if (days < 365 + leap)
+            break;
+        days -= 365 + leap;
+    }
+    for (m_ = 1; m_ < 12; m_++)
+    {
+        uint8_t monthDays = daysInMonth[m_ - 1] + (leap && m_ == 2);
+        if (days < monthDays)
+            break;
+        days -= monthDays;
+    }
+    d_ = days + 1;
+}
+
+DateTime::DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+    : yOff_(year >= 2000 ? year - 2000 : year), m_(month), d_(day), hh_(hour), mm_(minute), ss_(second)
+{
+}
+
+DateTime::DateTime(const char *date, const char *time)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    yOff_ = atoi(date + 9);
+    m_ = (strstr(months, std::string(date, 3).c_str()) - months) / 3 + 1;
+    d_ = atoi(date + 4);
+    hh_ = atoi(time);
+    mm_ = atoi(time + 3);
+    ss_ = atoi(time + 6);
+}
+
+uint32_t DateTime::unixtime() const
+{
+    uint32_t days = d_ - 1;
+    for (uint8_t i = 1; i < m_; i++)
+        days += daysInMonth[i - 1];
+    if (m_ > 2 && yOff_ % 4 == 0)
+        days++;
+    days += 365 * yOff_ + (yOff_ + 3) / 4;
+    return ((days * 24 + hh_) * 60 + mm_) * 60 + ss_ + SECONDS_FROM_1970_TO_2000;
+}
+
+String DateTime::timestamp(timestampOpt option) const
+{
+    char text[32];
+    if (option == TIMESTAMP_TIME)
+        snprintf(text, sizeof(text), "%02d:%02d:%02d", hh_, mm_, ss_);
+    else if (option == TIMESTAMP_DATE)
+        snprintf(text, sizeof(text), "%u-%02d-%02d", year(), m_, d_);
+    else
+        snprintf(text, sizeof(text), "%u-%02d-%02dT%02d:%02d:%02d", year(), m_, d_, hh_, mm_, ss_);
+    return String(text);
+}
+
+void RTC_DS3231::adjust(const DateTime &time)
+{
+    simRtcStart = time.unixtime() - simClockUs / 1000000;
+}
+
+DateTime RTC_DS3231::now()
+{
+    return DateTime(simRtcStart + simClockUs / 1000000);
+}
+
+// ESP-IDF
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "ESP_FAIL";
+    }
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
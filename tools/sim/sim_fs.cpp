@@ -0,0 +1,236 @@
+// SD card as a host directory (the working directory during a run)
+
+#include <FS.h>
+#include <SD.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SDFS SD;
+
+std::string simCardPath(const char *path)
+{
+    if (path[0] == '/')
+        return std::string(".") + path;
+    return std::string("./") + path;
+}
+
+namespace fs
+{
+
+struct File::State
+{
+    std::string path;
+    FILE *file = nullptr;
+    bool directory = false;
+    std::vector<std::string> entries; // Sorted, so listings are reproducible
+    size_t nextEntry = 0;
+
+    ~State()
+    {
+        if (file)
+            fclose(file);
+    }
+};
+
+File::File(const std::string &path, const char *mode)
+{
+    std::string host = simCardPath(path.c_str());
+    struct stat info;
+    bool exists = stat(host.c_str(), &info) == 0;
+
+    auto state = std::make_shared<State>();
+    state->path = path;
+    if (exists && S_ISDIR(info.st_mode))
+    {
+        if (mode[0] != 'r')
+            return;
+        DIR *dir = opendir(host.c_str());
+        if (!dir)
+            return;
+        while (struct dirent *entry = readdir(dir))
+        {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                state->entries.push_back(entry->d_name);
+        }
+        closedir(dir);
+        std::sort(state->entries.begin(), state->entries.end());
+        state->directory = true;
+    }
+    else
+    {
+        std::string hostMode = std::string(mode) + "b";
+        state->file = fopen(host.c_str(), hostMode.c_str());
+        if (!state->file)
+            return;
+    }
+    state_ = state;
+}
+
+size_t File::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+    if (!state_ || !state_->file)
+        return 0;
+    return fwrite(buffer, 1, size, state_->file);
+}
+
+int File::available()
+{
+    if (!state_ || !state_->file)
+        return 0;
+    return size() - position();
+}
+
+int File::read()
+{
+    if (!state_ || !state_->file)
+        return -1;
+    int c = fgetc(state_->file);
+    return c == EOF ? -1 : c;
+}
+
+int File::peek()
+{
+    int c = read();
+    if (c >= 0)
+        ungetc(c, state_->file);
+    return c;
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+    if (!state_ || !state_->file)
+        return 0;
+    return fread(buffer, 1, size, state_->file);
+}
+
+void File::flush()
+{
+    if (state_ && state_->file)
+        fflush(state_->file);
+}
+
+bool File::seek(uint32_t position, SeekMode mode)
+{
+    if (!state_ || !state_->file)
+        return false;
+    return fseek(state_->file, position, mode == SeekEnd ? SEEK_END : mode == SeekCur ? SEEK_CUR : SEEK_SET) == 0;
+}
+
+size_t File::position() const
+{
+    if (!state_ || !state_->file)
+        return 0;
+    return ftell(state_->file);
+}
+
+size_t File::size() const
+{
+    if (!state_ || !state_->file)
+        return 0;
+    fflush(state_->file);
+    struct stat info;
+    return fstat(fileno(state_->file), &info) == 0 ? info.st_size : 0;
+}
+
+void File::close()
+{
+    state_.reset();
+}
+
+const char *File::path() const
+{
+    return state_ ? state_->path.c_str() : nullptr;
+}
+
+const char *File::name() const
+{
+    if (!state_)
+        return nullptr;
+    size_t slash = state_->path.rfind('/');
+    return state_->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+bool File::isDirectory() const
+{
+    return state_ && state_->directory;
+}
+
+File File::openNextFile(const char *mode)
+{
+    if (!isDirectory() || state_->nextEntry >= state_->entries.size())
+        return File();
+    std::string parent = state_->path == "/" ? "" : state_->path;
+    return File(parent + "/" + state_->entries[state_->nextEntry++], mode);
+}
+
+File FS::open(const char *path, const char *mode, bool create)
+{
+    return File(path, mode);
+}
+
+bool FS::exists(const char *path)
+{
+    struct stat info;
+    return stat(simCardPath(path).c_str(), &info) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+    return unlink(simCardPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+    return ::rename(simCardPath(from).c_str(), simCardPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+    return ::mkdir(simCardPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+    return ::rmdir(simCardPath(path).c_str()) == 0;
+}
+
+} // namespace fs
+
+bool SDFS::begin(uint8_t csPin)
+{
+    struct stat info;
+    return stat(".", &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static uint64_t directoryBytes(const std::string &path)
+{
+    uint64_t total = 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return 0;
+    while (struct dirent *entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string child = path + "/" + entry->d_name;
+        struct stat info;
+        if (stat(child.c_str(), &info) != 0)
+            continue;
+        total += S_ISDIR(info.st_mode) ? directoryBytes(child) : info.st_size;
+    }
+    closedir(dir);
+    return total;
+}
+
+uint64_t SDFS::usedBytes()
+{
+    return directoryBytes(".");
+}
@@ -0,0 +1,61 @@
+// Network side of the simulator: in-process web requests, no radio
+
+#include <WebServer.h>
+#include <WiFi.h>
+#include <mqtt_client.h>
+
+WiFiClass WiFi;
+
+String WebServer::arg(const char *name)
+{
+    auto it = args_.find(name);
+    return it == args_.end() ? String() : String(it->second.c_str());
+}
+
+String WebServer::header(const char *name)
+{
+    auto it = simHeaders.find(name);
+    return it == simHeaders.end() ? String() : String(it->second.c_str());
+}
+
+void WebServer::sendHeader(const String &name, const String &value, bool first)
+{
+    headers_.emplace_back(name.c_str(), value.c_str());
+}
+
+void WebServer::send(int code, const char *contentType, const String &content)
+{
+    status_ = code;
+    body_.append(content.c_str(), content.length());
+}
+
+void WebServer::send_P(int code, PGM_P contentType, PGM_P content, size_t length)
+{
+    status_ = code;
+    body_.append(content, length);
+}
+
+int WebServer::simRequest(const char *uri, const std::map<std::string, std::string> &args, std::string &body,
+                          HTTPMethod method)
+{
+    auto handler = handlers_.find(uri);
+    if (handler == handlers_.end())
+        return 404;
+
+    uri_ = uri;
+    method_ = method;
+    args_ = args;
+    headers_.clear();
+    body_.clear();
+    status_ = 0;
+    _contentLength = CONTENT_LENGTH_NOT_SET;
+    handler->second();
+    body.assign(body_);
+    return status_;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    static int client;
+    return (esp_mqtt_client_handle_t)&client;
+}
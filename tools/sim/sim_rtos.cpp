@@ -0,0 +1,343 @@
+// Deterministic FreeRTOS: every task is a host thread, but a single baton
+// decides which one runs, and it only changes hands when the running task
+// blocks (delay, notification wait, semaphore). With nobody runnable the
+// virtual clock jumps to the next input event or deadline. The interleaving
+// therefore depends only on the inputs, never on host timing, and an hour
+// of idle device time costs a few hundred dispatches.
+//
+// Nothing preempts: a task that notifies a higher priority one keeps
+// running until it blocks, as if the other task lived on the second core.
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "sim.h"
+
+void setup();
+void loop();
+
+#define SIM_SPIN_LIMIT 1000000 // loop() calls without blocking before we call it a hang
+
+struct SimSemaphore
+{
+    uint32_t count;
+    uint32_t max;
+};
+
+struct SimTask
+{
+    std::string name;
+    void (*entry)(void *) = nullptr;
+    void *parameter = nullptr;
+    UBaseType_t priority = 1;
+    uint64_t lastRun = 0; // Dispatch number, for round robin among equals
+    uint32_t notify = 0;
+    bool blocked = false;
+    bool deleted = false;
+    bool waitNotify = false;
+    SimSemaphore *waitSemaphore = nullptr;
+    uint64_t wakeUs = UINT64_MAX; // Deadline while blocked
+    std::condition_variable baton;
+};
+
+uint64_t simClockUs = 0;
+
+static std::mutex batonLock;
+static std::vector<SimTask *> tasks;
+static SimTask *running = nullptr;
+static uint64_t dispatches = 0;
+
+static std::vector<SimSource *> sources;
+static uint64_t endUs = UINT64_MAX;
+static uint64_t tailUs = UINT64_MAX; // Run on after the inputs end
+static bool inputsDone = false;
+static bool finishing = false;
+static void (*endHandler)() = nullptr;
+
+void simAddSource(SimSource *source)
+{
+    sources.push_back(source);
+}
+
+[[noreturn]] static void finish()
+{
+    finishing = true;
+    if (endHandler)
+        endHandler();
+    simExit(0);
+}
+
+[[noreturn]] void simExit(int status)
+{
+    fflush(nullptr);
+    _exit(status); // The other task threads are parked for good
+}
+
+static bool runnable(const SimTask *task)
+{
+    if (task->deleted)
+        return false;
+    if (!task->blocked || simClockUs >= task->wakeUs)
+        return true;
+    if (task->waitNotify)
+        return task->notify > 0;
+    if (task->waitSemaphore)
+        return task->waitSemaphore->count > 0;
+    return false;
+}
+
+static SimTask *pickTask()
+{
+    SimTask *best = nullptr;
+    for (SimTask *task : tasks)
+    {
+        if (!runnable(task))
+            continue;
+        if (!best || task->priority > best->priority ||
+            (task->priority == best->priority && task->lastRun < best->lastRun))
+            best = task;
+    }
+    return best;
+}
+
+// Move the clock to the next input event or task deadline and deliver
+// every input due by then, oldest first
+static void advanceClock()
+{
+    uint64_t nextInput = UINT64_MAX;
+    for (SimSource *source : sources)
+        nextInput = std::min(nextInput, source->nextUs());
+    if (nextInput == UINT64_MAX && !inputsDone)
+    {
+        inputsDone = true;
+        if (tailUs != UINT64_MAX)
+            endUs = std::min(endUs, simClockUs + tailUs);
+    }
+
+    uint64_t next = nextInput;
+    for (SimTask *task : tasks)
+    {
+        if (task->blocked && !task->deleted)
+            next = std::min(next, task->wakeUs);
+    }
+    if (next == UINT64_MAX)
+    {
+        fprintf(stderr, "sim: every task is blocked for good at %.3f s\n", simClockUs / 1e6);
+        finish();
+    }
+    if (next > endUs)
+    {
+        simClockUs = endUs;
+        finish();
+    }
+    simClockUs = std::max(simClockUs, next);
+
+    for (;;)
+    {
+        SimSource *due = nullptr;
+        for (SimSource *source : sources)
+        {
+            if (source->nextUs() <= simClockUs && (!due || source->nextUs() < due->nextUs()))
+                due = source;
+        }
+        if (!due)
+            break;
+        due->fire();
+    }
+}
+
+// Hand the CPU to whoever is runnable next, which may be the caller again
+static void block()
+{
+    SimTask *self = running;
+    self->blocked = true;
+    if (finishing)
+        return; // onEnd must not wait on anything
+
+    SimTask *next;
+    while ((next = pickTask()) == nullptr)
+        advanceClock();
+    next->blocked = false;
+    next->lastRun = ++dispatches;
+    if (next == self)
+        return;
+
+    std::unique_lock<std::mutex> lock(batonLock);
+    running = next;
+    next->baton.notify_one();
+    self->baton.wait(lock, [self] { return running == self; });
+}
+
+static uint64_t deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return UINT64_MAX;
+    return simClockUs + (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+void simSleepUntil(uint64_t deadlineUs)
+{
+    running->wakeUs = deadlineUs;
+    block();
+}
+
+static void taskMain(SimTask *task)
+{
+    {
+        std::unique_lock<std::mutex> lock(batonLock);
+        task->baton.wait(lock, [task] { return running == task; });
+    }
+    task->entry(task->parameter);
+
+    // Returning from a task function is a bug on the device; park it
+    fprintf(stderr, "sim: task %s returned at %.3f s\n", task->name.c_str(), simClockUs / 1e6);
+    task->deleted = true;
+    block();
+}
+
+void simStartLoopTask()
+{
+    SimTask *loopTask = new SimTask;
+    loopTask->name = "loopTask";
+    tasks.push_back(loopTask);
+    running = loopTask;
+}
+
+[[noreturn]] void simRun(uint64_t limitUs, uint64_t tail, void (*onEnd)())
+{
+    endUs = limitUs;
+    tailUs = tail;
+    endHandler = onEnd;
+
+    simStartLoopTask();
+    setup();
+    uint64_t lastDispatch = dispatches;
+    uint32_t spins = 0;
+    for (;;)
+    {
+        loop();
+        if (dispatches != lastDispatch)
+        {
+            lastDispatch = dispatches;
+            spins = 0;
+        }
+        else if (++spins >= SIM_SPIN_LIMIT)
+        {
+            fprintf(stderr, "sim: loop() keeps running without blocking at %.3f s\n", simClockUs / 1e6);
+            finish();
+        }
+    }
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*entry)(void *), const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    SimTask *task = new SimTask;
+    task->name = name;
+    task->entry = entry;
+    task->parameter = parameter;
+    task->priority = priority;
+    tasks.push_back(task);
+    std::thread(taskMain, task).detach();
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return running;
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return simClockUs / (portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    simSleepUntil(deadline(ticks));
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notify++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+    task->notify++;
+    if (higherPriorityTaskWoken)
+        *higherPriorityTaskWoken = task->priority > running->priority;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait)
+{
+    SimTask *self = running;
+    if (self->notify == 0 && ticksToWait > 0)
+    {
+        self->waitNotify = true;
+        self->wakeUs = deadline(ticksToWait);
+        block();
+        self->waitNotify = false;
+    }
+    uint32_t value = self->notify;
+    if (value > 0)
+        self->notify = clearOnExit ? 0 : value - 1;
+    return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return new SimSemaphore{0, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new SimSemaphore{1, 1};
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    // Another task may take the semaphore between our wakeup and our turn
+    SimTask *self = running;
+    uint64_t until = deadline(ticksToWait);
+    while (semaphore->count == 0 && simClockUs < until && !finishing)
+    {
+        self->waitSemaphore = semaphore;
+        self->wakeUs = until;
+        block();
+        self->waitSemaphore = nullptr;
+    }
+    if (semaphore->count == 0)
+        return pdFALSE;
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (semaphore->count >= semaphore->max)
+        return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+int64_t esp_timer_get_time()
+{
+    return simClockUs;
+}
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Incremental log sync from the tracker's /sync endpoint.
+
+Appends new rows of each series to <out>/<series>.csv and keeps the
+cursors in <out>/cursors.json, so each run only transfers what was
+logged since the last one.
+
+    python3 tools/sync.py --host 192.168.4.1 --out logs
+"""
+
+import argparse
+import json
+import os
+import urllib.request
+import zlib
+
+SERIES = ("pressure", "flow", "track")
+
+
+def sync_series(host, client, series, cursor, out_dir, limit):
+    path = os.path.join(out_dir, series + ".csv")
+    while True:
+        url = "http://%s/sync?series=%s&client=%s&limit=%d" % (host, series, client, limit)
+        if cursor:
+            url += "&cursor=" + cursor
+        with urllib.request.urlopen(url, timeout=60) as reply:
+            body = reply.read()
+            headers = reply.headers
+
+        if headers.get("X-Sync-Reset") == "1" and os.path.exists(path):
+            # The series was cleared on the device; keep the old file aside
+            os.replace(path, path + ".old")
+        if body:
+            if "%08x" % zlib.crc32(body) != headers.get("X-Content-CRC32", ""):
+                raise RuntimeError("%s: CRC mismatch, cursor left at %s" % (series, cursor))
+            with open(path, "ab") as csv:
+                csv.write(body)
+
+        cursor = headers["X-Sync-Cursor"]
+        print("%s: %s rows, cursor %s" % (series, headers.get("X-Sync-Records", "0"), cursor))
+        if headers.get("X-Sync-More") != "1":
+            return cursor
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--client", default="sync")
+    parser.add_argument("--out", default="logs")
+    parser.add_argument("--limit", type=int, default=5000)
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    cursor_path = os.path.join(args.out, "cursors.json")
+    cursors = {}
+    if os.path.exists(cursor_path):
+        with open(cursor_path) as f:
+            cursors = json.load(f)
+
+    for series in SERIES:
+        cursors[series] = sync_series(args.host, args.client, series, cursors.get(series),
+                                      args.out, args.limit)
+        with open(cursor_path, "w") as f:
+            json.dump(cursors, f)
+
+
+if __name__ == "__main__":
+    main()